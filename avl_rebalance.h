@@ -0,0 +1,324 @@
+#ifndef AVL_REBALANCE_H
+#define AVL_REBALANCE_H
+
+/**
+ * The AVL rebalancing steps shared by CompactAVLTree and IndexedAVLTree,
+ * written once over a small policy that says how to follow and change the
+ * links, so a fix to the retrace logic lands in both trees.
+ *
+ * Links names nodes by a Handle (a node pointer, or a 32-bit index into
+ * the tree's arrays) and provides:
+ *
+ *   static Handle none();                    // the handle of no node
+ *   Handle left(Handle node) const;          // likewise right and parent
+ *   int balance(Handle node) const;          // right height minus left
+ *   void setLeft(Handle node, Handle child) const;  // likewise setRight
+ *   void setParent(Handle node, Handle parent) const;
+ *   void setBalance(Handle node, int balance) const;
+ *   void setRoot(Handle node) const;
+ *
+ * A Links object is a view of one tree and cheap to copy; the trees make
+ * a rebalancer on the spot for each insert or remove. A balance of +-2 is
+ * never stored, since the compact node has no room for it: a node is
+ * rotated as soon as it would reach it.
+ */
+template <class Links>
+class AVLRebalancer
+{
+public:
+    typedef typename Links::Handle Handle;
+
+    explicit AVLRebalancer(const Links& links);
+
+    // Links child where old was under parent (or as the root)
+    void replaceChild(Handle parent, Handle old, Handle child);
+    void insertFix(Handle node);
+    void removeFix(Handle parent, bool leftShrank);
+    void swapWithPredecessor(Handle node, Handle pred);
+
+protected:
+    Handle rotateLeft(Handle node);
+    Handle rotateRight(Handle node);
+    Handle rotateRightLeft(Handle node);
+    Handle rotateLeftRight(Handle node);
+    Handle fixRightHeavy(Handle node);
+    Handle fixLeftHeavy(Handle node);
+
+    Links links_;
+};
+
+/*
+  --------------------------------------------------
+  Begin implementations for the AVLRebalancer class.
+  --------------------------------------------------
+*/
+
+template<class Links>
+AVLRebalancer<Links>::AVLRebalancer(const Links& links) :
+    links_(links)
+{
+}
+
+template<class Links>
+void AVLRebalancer<Links>::replaceChild(Handle parent, Handle old, Handle child)
+{
+    if (parent == Links::none()) {
+        links_.setRoot(child);
+    }
+    else if (links_.left(parent) == old) {
+        links_.setLeft(parent, child);
+    }
+    else {
+        links_.setRight(parent, child);
+    }
+    if (child != Links::none()) {
+        links_.setParent(child, parent);
+    }
+}
+
+/**
+* Rotates node's right child up and returns it. node is two levels taller
+* on the right; the new balances follow from the child's balance, which
+* is 0 only during a remove (and then the subtree keeps its height).
+*/
+template<class Links>
+typename AVLRebalancer<Links>::Handle AVLRebalancer<Links>::rotateLeft(Handle node)
+{
+    Handle child = links_.right(node);
+    Handle inner = links_.left(child);
+    links_.setRight(node, inner);
+    if (inner != Links::none()) {
+        links_.setParent(inner, node);
+    }
+    replaceChild(links_.parent(node), node, child);
+    links_.setLeft(child, node);
+    links_.setParent(node, child);
+
+    if (links_.balance(child) == 0) {
+        links_.setBalance(node, 1);
+        links_.setBalance(child, -1);
+    }
+    else {
+        links_.setBalance(node, 0);
+        links_.setBalance(child, 0);
+    }
+    return child;
+}
+
+/**
+* Mirror image of rotateLeft.
+*/
+template<class Links>
+typename AVLRebalancer<Links>::Handle AVLRebalancer<Links>::rotateRight(Handle node)
+{
+    Handle child = links_.left(node);
+    Handle inner = links_.right(child);
+    links_.setLeft(node, inner);
+    if (inner != Links::none()) {
+        links_.setParent(inner, node);
+    }
+    replaceChild(links_.parent(node), node, child);
+    links_.setRight(child, node);
+    links_.setParent(node, child);
+
+    if (links_.balance(child) == 0) {
+        links_.setBalance(node, -1);
+        links_.setBalance(child, 1);
+    }
+    else {
+        links_.setBalance(node, 0);
+        links_.setBalance(child, 0);
+    }
+    return child;
+}
+
+/**
+* Double rotation for a node two levels taller on the right whose right
+* child leans left: the grandchild comes up and returns as the new root.
+*/
+template<class Links>
+typename AVLRebalancer<Links>::Handle AVLRebalancer<Links>::rotateRightLeft(Handle node)
+{
+    Handle child = links_.right(node);
+    Handle grand = links_.left(child);
+    Handle grandLeft = links_.left(grand);
+    Handle grandRight = links_.right(grand);
+
+    links_.setLeft(child, grandRight);
+    if (grandRight != Links::none()) {
+        links_.setParent(grandRight, child);
+    }
+    links_.setRight(node, grandLeft);
+    if (grandLeft != Links::none()) {
+        links_.setParent(grandLeft, node);
+    }
+    replaceChild(links_.parent(node), node, grand);
+    links_.setRight(grand, child);
+    links_.setParent(child, grand);
+    links_.setLeft(grand, node);
+    links_.setParent(node, grand);
+
+    links_.setBalance(node, links_.balance(grand) > 0 ? -1 : 0);
+    links_.setBalance(child, links_.balance(grand) < 0 ? 1 : 0);
+    links_.setBalance(grand, 0);
+    return grand;
+}
+
+/**
+* Mirror image of rotateRightLeft.
+*/
+template<class Links>
+typename AVLRebalancer<Links>::Handle AVLRebalancer<Links>::rotateLeftRight(Handle node)
+{
+    Handle child = links_.left(node);
+    Handle grand = links_.right(child);
+    Handle grandLeft = links_.left(grand);
+    Handle grandRight = links_.right(grand);
+
+    links_.setRight(child, grandLeft);
+    if (grandLeft != Links::none()) {
+        links_.setParent(grandLeft, child);
+    }
+    links_.setLeft(node, grandRight);
+    if (grandRight != Links::none()) {
+        links_.setParent(grandRight, node);
+    }
+    replaceChild(links_.parent(node), node, grand);
+    links_.setLeft(grand, child);
+    links_.setParent(child, grand);
+    links_.setRight(grand, node);
+    links_.setParent(node, grand);
+
+    links_.setBalance(node, links_.balance(grand) < 0 ? 1 : 0);
+    links_.setBalance(child, links_.balance(grand) > 0 ? -1 : 0);
+    links_.setBalance(grand, 0);
+    return grand;
+}
+
+/**
+* Rebalances node, whose stored balance is +1 and whose right side has
+* just grown (or left side shrunk) by one. Returns the subtree's new root.
+*/
+template<class Links>
+typename AVLRebalancer<Links>::Handle AVLRebalancer<Links>::fixRightHeavy(Handle node)
+{
+    return (links_.balance(links_.right(node)) >= 0) ? rotateLeft(node) : rotateRightLeft(node);
+}
+
+/**
+* Mirror image of fixRightHeavy.
+*/
+template<class Links>
+typename AVLRebalancer<Links>::Handle AVLRebalancer<Links>::fixLeftHeavy(Handle node)
+{
+    return (links_.balance(links_.left(node)) <= 0) ? rotateRight(node) : rotateLeftRight(node);
+}
+
+/**
+* Walks up from a new leaf, updating balances until a subtree stops
+* growing. At most one (single or double) rotation is needed.
+*/
+template<class Links>
+void AVLRebalancer<Links>::insertFix(Handle node)
+{
+    for (Handle parent = links_.parent(node); parent != Links::none();
+         node = parent, parent = links_.parent(node)) {
+        int balance = links_.balance(parent) + ((links_.left(parent) == node) ? -1 : 1);
+        if (balance == 0) {
+            links_.setBalance(parent, 0);
+            return;
+        }
+        if (balance == 2) {
+            fixRightHeavy(parent);
+            return;
+        }
+        if (balance == -2) {
+            fixLeftHeavy(parent);
+            return;
+        }
+        links_.setBalance(parent, balance);
+    }
+}
+
+/**
+* Walks up from parent, one of whose sides (the left one if leftShrank)
+* just lost a level, updating balances and rotating until a subtree keeps
+* its height.
+*/
+template<class Links>
+void AVLRebalancer<Links>::removeFix(Handle parent, bool leftShrank)
+{
+    while (parent != Links::none()) {
+        Handle grand = links_.parent(parent);
+        bool parentIsLeft = grand != Links::none() && links_.left(grand) == parent;
+        int balance = links_.balance(parent) + (leftShrank ? 1 : -1);
+        if (balance == 1 || balance == -1) {
+            links_.setBalance(parent, balance);
+            return;
+        }
+        if (balance == 0) {
+            links_.setBalance(parent, 0);
+        }
+        else {
+            Handle sibling = (balance > 0) ? links_.right(parent) : links_.left(parent);
+            bool keepsHeight = links_.balance(sibling) == 0;
+            if (balance > 0) {
+                fixRightHeavy(parent);
+            }
+            else {
+                fixLeftHeavy(parent);
+            }
+            if (keepsHeight) {
+                return;
+            }
+        }
+        leftShrank = parentIsLeft;
+        parent = grand;
+    }
+}
+
+/**
+* Moves pred (node's predecessor, the rightmost node of its left subtree)
+* into node's place and node into pred's, balances included, so that
+* iterators to pred stay valid. Afterwards node has no right child.
+*/
+template<class Links>
+void AVLRebalancer<Links>::swapWithPredecessor(Handle node, Handle pred)
+{
+    Handle left = links_.left(node);
+    Handle right = links_.right(node);
+    Handle predParent = links_.parent(pred);
+    Handle predLeft = links_.left(pred);
+    int nodeBalance = links_.balance(node);
+    int predBalance = links_.balance(pred);
+
+    replaceChild(links_.parent(node), node, pred);
+    links_.setRight(pred, right);
+    links_.setParent(right, pred);
+    if (predParent == node) {
+        links_.setLeft(pred, node);
+        links_.setParent(node, pred);
+    }
+    else {
+        links_.setLeft(pred, left);
+        links_.setParent(left, pred);
+        links_.setRight(predParent, node);
+        links_.setParent(node, predParent);
+    }
+    links_.setLeft(node, predLeft);
+    if (predLeft != Links::none()) {
+        links_.setParent(predLeft, node);
+    }
+    links_.setRight(node, Links::none());
+
+    links_.setBalance(pred, nodeBalance);
+    links_.setBalance(node, predBalance);
+}
+
+/*
+  ------------------------------------------------
+  End implementations for the AVLRebalancer class.
+  ------------------------------------------------
+*/
+
+#endif
@@ -6,7 +6,13 @@
 #include <cstdlib>
 #include <cstdint>
 #include <algorithm>
+#include <functional>
+#include <cstring>
+#include <stdexcept>
+#include <istream>
+#include <ostream>
 #include "bst.h"
+#include "tree_codec.h"
 
 struct KeyError { };
 
@@ -21,6 +27,10 @@ class AVLNode : public Node<Key, Value>
 public:
     // Constructor/destructor.
     AVLNode(const Key& key, const Value& value, AVLNode<Key, Value>* parent);
+    template<typename... KeyArgs, typename... ValueArgs>
+    AVLNode(std::piecewise_construct_t, std::tuple<KeyArgs...>&& keyArgs,
+            std::tuple<ValueArgs...>&& valueArgs, AVLNode<Key, Value>* parent);
+    AVLNode(ItemMaker<Key, Value>& maker, AVLNode<Key, Value>* parent);
     virtual ~AVLNode();
 
     // Getter/setter for the node's height.
@@ -28,15 +38,21 @@ public:
     void setBalance (int8_t balance);
     void updateBalance(int8_t diff);
 
+    // Getter/setter for the number of nodes in this node's subtree. Only
+    // kept up to date by trees with order statistics enabled.
+    uint32_t getSize () const;
+    void setSize (uint32_t size);
+
     // Getters for parent, left, and right. These need to be redefined since they
-    // return pointers to AVLNodes - not plain Nodes. See the Node class in bst.h
-    // for more information.
-    virtual AVLNode<Key, Value>* getParent() const override;
-    virtual AVLNode<Key, Value>* getLeft() const override;
-    virtual AVLNode<Key, Value>* getRight() const override;
+    // return pointers to AVLNodes - not plain Nodes. They hide (not override)
+    // the Node getters; see the Node class in bst.h for more information.
+    AVLNode<Key, Value>* getParent() const;
+    AVLNode<Key, Value>* getLeft() const;
+    AVLNode<Key, Value>* getRight() const;
 
 protected:
     int8_t balance_;    // effectively a signed char
+    uint32_t size_;     // sits in balance_'s padding, so costs no space
 };
 
 /*
@@ -50,7 +66,29 @@ protected:
 */
 template<class Key, class Value>
 AVLNode<Key, Value>::AVLNode(const Key& key, const Value& value, AVLNode<Key, Value> *parent) :
-    Node<Key, Value>(key, value, parent), balance_(0)
+    Node<Key, Value>(key, value, parent), balance_(0), size_(1)
+{
+
+}
+
+/**
+* A piecewise constructor forwarding the key and value arguments to the base class.
+*/
+template<class Key, class Value>
+template<typename... KeyArgs, typename... ValueArgs>
+AVLNode<Key, Value>::AVLNode(std::piecewise_construct_t, std::tuple<KeyArgs...>&& keyArgs,
+                             std::tuple<ValueArgs...>&& valueArgs, AVLNode<Key, Value> *parent) :
+    Node<Key, Value>(std::piecewise_construct, std::move(keyArgs), std::move(valueArgs), parent), balance_(0), size_(1)
+{
+
+}
+
+/**
+* A constructor taking the item from maker, see ItemMaker.
+*/
+template<class Key, class Value>
+AVLNode<Key, Value>::AVLNode(ItemMaker<Key, Value>& maker, AVLNode<Key, Value> *parent) :
+    Node<Key, Value>(maker, parent), balance_(0), size_(1)
 {
 
 }
@@ -92,7 +130,25 @@ void AVLNode<Key, Value>::updateBalance(int8_t diff)
 }
 
 /**
-* An overridden function for getting the parent since a static_cast is necessary to make sure
+* A getter for the subtree size of a AVLNode.
+*/
+template<class Key, class Value>
+uint32_t AVLNode<Key, Value>::getSize() const
+{
+    return size_;
+}
+
+/**
+* A setter for the subtree size of a AVLNode.
+*/
+template<class Key, class Value>
+void AVLNode<Key, Value>::setSize(uint32_t size)
+{
+    size_ = size;
+}
+
+/**
+* A redefined getter for the parent since a static_cast is necessary to make sure
 * that our node is a AVLNode.
 */
 template<class Key, class Value>
@@ -102,7 +158,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getParent() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
@@ -111,7 +167,7 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getLeft() const
 }
 
 /**
-* Overridden for the same reasons as above.
+* Redefined for the same reasons as above.
 */
 template<class Key, class Value>
 AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
@@ -127,71 +183,213 @@ AVLNode<Key, Value> *AVLNode<Key, Value>::getRight() const
 */
 
 
-template <class Key, class Value>
-class AVLTree : public BinarySearchTree<Key, Value>
+/**
+* A self-balancing AVL tree. With OrderStats set, every node also tracks the
+* size of its subtree (kept through rotations, insertFix/removeFix, bulk
+* loads, split and join) and rank/select/count answer order-statistic
+* queries in O(log n). Sizes are 32 bits, so such trees hold at most
+* 2^32 - 1 entries. Without it, the size bookkeeping compiles away.
+*/
+template <class Key, class Value, class Compare = std::less<Key>, bool OrderStats = false>
+class AVLTree : public BinarySearchTree<Key, Value, Compare>
 {
 public:
-    virtual void insert (const std::pair<const Key, Value> &new_item); // TODO
+    typedef typename BinarySearchTree<Key, Value, Compare>::iterator iterator;
+    typedef typename BinarySearchTree<Key, Value, Compare>::const_iterator const_iterator;
+    typedef typename BinarySearchTree<Key, Value, Compare>::reverse_iterator reverse_iterator;
+    typedef typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator const_reverse_iterator;
+    typedef typename BinarySearchTree<Key, Value, Compare>::BalanceReport BalanceReport;
+
+    AVLTree();
+    explicit AVLTree(const Compare& comp);
+    template<typename InputIt>
+    AVLTree(InputIt first, InputIt last, const Compare& comp = Compare());
+    template<typename InputIt>
+    void assign_parallel(InputIt first, InputIt last, unsigned threads = 0);
     virtual void remove(const Key& key);  // TODO
+
+    // Range operations in O(log n) (plus the removed entries for erase)
+    void split(const Key& key, AVLTree<Key, Value, Compare, OrderStats>& right);
+    void join(AVLTree<Key, Value, Compare, OrderStats>& right);
+    void erase(const Key& lo, const Key& hi);
+
+    // Batched updates. The batch is sorted once and merged in with one
+    // recursive pass of splits and joins, O(m log(n/m + 1)) for m keys
+    // against n entries. Both return how many entries were added/removed.
+    template<typename InputIt>
+    std::size_t insert_batch(InputIt first, InputIt last);
+    template<typename InputIt>
+    std::size_t erase_batch(InputIt first, InputIt last);
+
+    // Streaming checkpoints that keep the exact shape, see serialize()
+    void serialize(std::ostream& out) const;
+    void deserialize(std::istream& in);
+
+    // Like BinarySearchTree::balanceReport, but also checks every balance_
+    virtual BalanceReport balanceReport() const;
+
+    // Order statistics, only available with OrderStats
+    std::size_t rank(const Key& key) const;
+    iterator select(std::size_t k) const;
+    std::size_t count(const Key& lo, const Key& hi) const;
 protected:
     virtual void nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2);
 
+    // The inserting functions (insert, emplace, try_emplace) are the
+    // BinarySearchTree ones, which build AVLNodes and rebalance through these
+    virtual Node<Key, Value>* createLeaf(ItemMaker<Key, Value>& maker);
+    virtual void afterInsert(Node<Key, Value>* node);
+    virtual void buildSorted(std::vector<std::pair<Key, Value> >& items);
+
     // Add helper functions here
     void rotateLeft (AVLNode<Key, Value>* current);
     void rotateRight (AVLNode<Key, Value>* current);
     void insertFix (AVLNode<Key, Value>* parent, AVLNode<Key, Value>* child);
+    void insertBalance (AVLNode<Key, Value>* newNode);
+    void unlinkNode (AVLNode<Key, Value>* removeNode);
+
+    // Split/join helpers working on detached subtrees of known height
+    static int subtreeHeight (AVLNode<Key, Value>* root);
+    AVLNode<Key, Value>* rebalanceAt (AVLNode<Key, Value>* node, bool& grew);
+    AVLNode<Key, Value>* joinNodes (AVLNode<Key, Value>* left, int leftHeight, AVLNode<Key, Value>* mid,
+                                    AVLNode<Key, Value>* right, int rightHeight, int& height);
+    AVLNode<Key, Value>* joinTrees (AVLNode<Key, Value>* left, int leftHeight,
+                                    AVLNode<Key, Value>* right, int rightHeight, int& height);
+    void splitNodes (AVLNode<Key, Value>* root, int height, const Key& key,
+                     AVLNode<Key, Value>*& left, int& leftHeight,
+                     AVLNode<Key, Value>*& right, int& rightHeight);
+    AVLNode<Key, Value>* unionNodes (AVLNode<Key, Value>* root, int height,
+                                     std::vector<AVLNode<Key, Value>*>& batch, std::size_t lo, std::size_t hi,
+                                     int& newHeight, std::size_t& added);
+    AVLNode<Key, Value>* differenceNodes (AVLNode<Key, Value>* root, int height,
+                                          const std::vector<Key>& keys, std::size_t lo, std::size_t hi,
+                                          int& newHeight, std::size_t& removed);
     void removeFix (AVLNode<Key, Value>* current, int8_t diff);
 		AVLNode<Key, Value>* predecessor(AVLNode<Key, Value>* current);
+
+    // Subtree size bookkeeping; no-ops without OrderStats
+    static uint32_t sizeOf (AVLNode<Key, Value>* node);
+    static void updateSize (AVLNode<Key, Value>* node);
+    static void addToPathSizes (AVLNode<Key, Value>* node, long delta);
+    std::size_t countBelow (const Key& key, bool inclusive) const;
+
+    // Serialized form: nodes go out in pre-order in blocks of SHAPE_BLOCK,
+    // each block being one 4-bit shape code per node followed by the items
+    static const std::size_t SHAPE_BLOCK = 64;
+    static const unsigned char HAS_LEFT = 1;
+    static const unsigned char HAS_RIGHT = 2;
+    static const int BALANCE_SHIFT = 2;
+
+    // Compares a node's balance_ against its actual height difference
+    struct StoredBalanceMatches
+    {
+        bool operator()(AVLNode<Key, Value>* node, int actual) const
+        {
+            return node->getBalance() == actual;
+        }
+    };
+
+    // Sets each bulk-loaded node's balance from its subtree heights
+    struct SetBalance
+    {
+        void operator()(AVLNode<Key, Value>* node, int leftHeight, int rightHeight) const
+        {
+            node->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+            updateSize(node);
+        }
+    };
 };
 
-/*
- * Recall: If key is already in the tree, you should 
- * overwrite the current value with the updated value.
- */
-template<class Key, class Value>
-void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
+/**
+* Default constructor; sizes the node pool for AVLNodes.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+AVLTree<Key, Value, Compare, OrderStats>::AVLTree() :
+    BinarySearchTree<Key, Value, Compare>(sizeof(AVLNode<Key, Value>), Compare())
 {
-    // TODO
-    // Create a new AVLNode with the given key-value pair
-    AVLNode<Key, Value>* newNode = new AVLNode<Key, Value>(new_item.first, new_item.second, nullptr);
-    newNode->setBalance(0);
 
-    // If the tree is empty, set the new node as the root
-    if (this->root_ == nullptr) {
-        this->root_ = newNode;
-        return;
-    }
+}
 
-    AVLNode<Key, Value>* temp = static_cast<AVLNode<Key, Value>*>(this->root_);
+/**
+* Constructor for an AVLTree ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+AVLTree<Key, Value, Compare, OrderStats>::AVLTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare>(sizeof(AVLNode<Key, Value>), comp)
+{
 
-    // Traverse the tree to find the appropriate position to insert the new node
-    while (true) {
-        if (newNode->getKey() == temp->getKey()) {
-            // If the key already exists, swap the nodes and delete the duplicate
-            nodeSwap(newNode, temp);
-            delete temp;
-            return;
-        } else if (newNode->getKey() < temp->getKey()) {
-            if (temp->getLeft() == nullptr) {
-                // If the left child is null, insert the new node as the left child
-                temp->setLeft(newNode);
-                newNode->setParent(temp);
-                break;
-            }
-            temp = temp->getLeft();
-        } else if (newNode->getKey() > temp->getKey()) {
-            if (temp->getRight() == nullptr) {
-                // If the right child is null, insert the new node as the right child
-                temp->setRight(newNode);
-                newNode->setParent(temp);
-                break;
-            }
-            temp = temp->getRight();
-        }
-    }
+}
 
-    // Perform AVL tree fixing if necessary
+/**
+* Builds an AVLTree holding the items of [first, last) in linear time.
+* See assign().
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+template<typename InputIt>
+AVLTree<Key, Value, Compare, OrderStats>::AVLTree(InputIt first, InputIt last, const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare>(sizeof(AVLNode<Key, Value>), comp)
+{
+    this->assign(first, last);
+}
+
+/**
+* The bulk build behind BinarySearchTree::assign(), in O(n) with no
+* descents or rotations: the sorted items are linked into a height-balanced
+* tree and every node gets its balance from the subtree heights.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::buildSorted(std::vector<std::pair<Key, Value> >& items)
+{
+    this->template buildFromSorted<AVLNode<Key, Value> >(items, SetBalance());
+}
+
+/**
+* Same as assign(), but sorts the input and builds the tree on up to threads
+* threads (0 means one per core). Each worker links a height-balanced
+* subtree over its own slice of the sorted items and the calling thread
+* stitches them together, so the result is the tree assign() would build.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+template<typename InputIt>
+void AVLTree<Key, Value, Compare, OrderStats>::assign_parallel(InputIt first, InputIt last, unsigned threads)
+{
+    std::vector<std::pair<Key, Value> > items;
+    this->collectSorted(first, last, items, this->threadCount(threads));
+    this->clear();
+    this->template buildFromSortedParallel<AVLNode<Key, Value> >(items, SetBalance(), threads);
+}
+
+/**
+* Builds an unlinked AVLNode for BinarySearchTree::emplaceNode.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+Node<Key, Value>* AVLTree<Key, Value, Compare, OrderStats>::createLeaf(ItemMaker<Key, Value>& maker)
+{
+    return this->template createNode<AVLNode<Key, Value> >(maker);
+}
+
+/**
+* Rebalances after BinarySearchTree::emplaceNode linked in node.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::afterInsert(Node<Key, Value>* node)
+{
+    insertBalance(static_cast<AVLNode<Key, Value>*>(node));
+}
+
+/**
+* Restores the AVL balances after newNode has been linked in as a leaf.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::insertBalance (AVLNode<Key, Value>* newNode)
+{
     AVLNode<Key, Value>* parent = newNode->getParent();
+    addToPathSizes(parent, 1);
+
+    // Perform AVL tree fixing if necessary
+    if (parent == NULL) {
+        return;
+    }
     if (parent->getBalance() == -1 || parent->getBalance() == 1) {
         parent->setBalance(0);
     } else if (parent->getBalance() == 0) {
@@ -200,12 +398,13 @@ void AVLTree<Key, Value>::insert (const std::pair<const Key, Value> &new_item)
         } else if (parent->getRight() == newNode) {
             parent->updateBalance(1);
         }
+        BST_STAT(++this->stats_.retraces;)
         insertFix(parent, newNode);
     }
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateLeft (AVLNode<Key, Value>* current)
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::rotateLeft (AVLNode<Key, Value>* current)
 {
 		AVLNode<Key, Value>* child = current->getRight();
 		AVLNode<Key, Value>* parent = current->getParent();
@@ -230,10 +429,12 @@ void AVLTree<Key, Value>::rotateLeft (AVLNode<Key, Value>* current)
 		}
 
 		child->setLeft(current);
+		updateSize(current);
+		updateSize(child);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::rotateRight (AVLNode<Key, Value>* current)
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::rotateRight (AVLNode<Key, Value>* current)
 {
     AVLNode<Key, Value>* child = current->getLeft();
 		AVLNode<Key, Value>* parent = current->getParent();
@@ -258,15 +459,18 @@ void AVLTree<Key, Value>::rotateRight (AVLNode<Key, Value>* current)
 		}
 
 		child->setRight(current);
+		updateSize(current);
+		updateSize(child);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::insertFix (AVLNode<Key, Value>* parent, AVLNode<Key, Value>* child)
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::insertFix (AVLNode<Key, Value>* parent, AVLNode<Key, Value>* child)
 {
     AVLNode<Key, Value>* grand = parent->getParent();
     if (parent == NULL || grand == NULL) {
         return;
     }
+    BST_STAT(++this->stats_.retraceSteps;)
 
     if (grand->getLeft() == parent) {
         grand->updateBalance(-1);
@@ -279,11 +483,13 @@ void AVLTree<Key, Value>::insertFix (AVLNode<Key, Value>* parent, AVLNode<Key, V
         }
         else if (grand->getBalance() == -2) {
             if (parent->getLeft() == child) {
+                BST_STAT(++this->stats_.singleRotations;)
                 rotateRight(grand);
                 parent->setBalance(0);
                 grand->setBalance(0);
             }
             else if (parent->getRight() == child) {
+                BST_STAT(++this->stats_.doubleRotations;)
                 rotateLeft(parent);
                 rotateRight(grand);
 
@@ -316,11 +522,13 @@ void AVLTree<Key, Value>::insertFix (AVLNode<Key, Value>* parent, AVLNode<Key, V
         }
         else if (grand->getBalance() == 2) {
             if (parent->getRight() == child) {
+                BST_STAT(++this->stats_.singleRotations;)
                 rotateLeft(grand);
                 parent->setBalance(0);
                 grand->setBalance(0);
             }
             else if (parent->getLeft() == child) {
+                BST_STAT(++this->stats_.doubleRotations;)
                 rotateRight(parent);
                 rotateLeft(grand);
 
@@ -348,8 +556,8 @@ void AVLTree<Key, Value>::insertFix (AVLNode<Key, Value>* parent, AVLNode<Key, V
  * Recall: The writeup specifies that if a node has 2 children you
  * should swap with the predecessor and then remove.
  */
-template<class Key, class Value>
-void AVLTree<Key, Value>:: remove(const Key& key)
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>:: remove(const Key& key)
 {
     // TODO
     // If the tree is empty, do nothing
@@ -358,84 +566,69 @@ void AVLTree<Key, Value>:: remove(const Key& key)
     }
 
     // Find the node with the specified key
-    AVLNode<Key, Value>* removeNode = static_cast<AVLNode<Key, Value>*>(this->internalFind(key));
+    AVLNode<Key, Value>* removeNode = this->template findNode<AVLNode<Key, Value> >(key);
 
     // If the node with the specified key doesn't exist, do nothing
     if (removeNode != nullptr) {
-        // If the node to be removed has two children, swap with its predecessor
-        if (removeNode->getLeft() && removeNode->getRight()) {
-            nodeSwap(removeNode, predecessor(removeNode));
-        }
-
-        // Determine the parent of the node to be removed and calculate the balance difference
-        AVLNode<Key, Value>* par = removeNode->getParent();
-        int8_t diff = 0;
-        if (par != nullptr) {
-            diff = (par->getLeft() == removeNode) ? 1 : -1;
-        }
-
-        // Update the parent of the child node
-        AVLNode<Key, Value>* childNode = (removeNode->getLeft() != nullptr) ? removeNode->getLeft() : removeNode->getRight();
-        if (childNode != nullptr) {
-            childNode->setParent(par);
-        }
-
-        // Update the root if necessary
-        if (removeNode == this->root_) {
-            this->root_ = childNode;
-        } else {
-            if (par->getLeft() == removeNode) {
-                par->setLeft(childNode);
-            } else {
-                par->setRight(childNode);
-            }
-        }
-
-        // Delete the node to be removed and perform AVL tree fixing if necessary
-        delete removeNode;
-        removeFix(par, diff);
+        unlinkNode(removeNode);
+        this->destroyNode(removeNode);
     }
 }
 
-template<class Key, class Value>
-AVLNode<Key, Value>* AVLTree<Key, Value>::predecessor(AVLNode<Key, Value>* current)
+/**
+* Takes node out of the tree and rebalances, without destroying it.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::unlinkNode(AVLNode<Key, Value>* removeNode)
 {
-		if (current == NULL) {
-				return NULL;
-		}
-		
-		if (current->getLeft()) {
-				AVLNode<Key, Value>* pred = current->getLeft();
+    // If the node to be removed has two children, swap with its predecessor
+    if (removeNode->getLeft() && removeNode->getRight()) {
+        nodeSwap(removeNode, predecessor(removeNode));
+    }
 
-				while (pred->getRight() != NULL) {
-						pred = pred->getRight();
-				}
+    // Determine the parent of the node to be removed and calculate the balance difference
+    AVLNode<Key, Value>* par = removeNode->getParent();
+    int8_t diff = 0;
+    if (par != nullptr) {
+        diff = (par->getLeft() == removeNode) ? 1 : -1;
+    }
 
-				return pred;
-		}
-		else {
-				AVLNode<Key, Value>* pred = current;
-				AVLNode<Key, Value>* par = pred->getParent();
+    // Update the parent of the child node
+    AVLNode<Key, Value>* childNode = (removeNode->getLeft() != nullptr) ? removeNode->getLeft() : removeNode->getRight();
+    if (childNode != nullptr) {
+        childNode->setParent(par);
+    }
 
-				while (par != NULL) {
-						if (par->getRight() == pred) {
-								return par;
-						}
+    // Update the root if necessary
+    if (removeNode == this->root_) {
+        this->root_ = childNode;
+    } else {
+        if (par->getLeft() == removeNode) {
+            par->setLeft(childNode);
+        } else {
+            par->setRight(childNode);
+        }
+    }
 
-						pred = par;
-						par = pred->getParent();
-				}
-		}
+    // Perform AVL tree fixing if necessary
+    addToPathSizes(par, -1);
+    BST_STAT(this->stats_.retraces += (par != NULL);)
+    removeFix(par, diff);
+}
 
-		return NULL;
+template<class Key, class Value, class Compare, bool OrderStats>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare, OrderStats>::predecessor(AVLNode<Key, Value>* current)
+{
+		return BinarySearchTree<Key, Value, Compare>::predecessorOf(current);
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::removeFix (AVLNode<Key, Value>* current, int8_t diff)
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::removeFix (AVLNode<Key, Value>* current, int8_t diff)
 {
     if (current == NULL) {
         return;
     }
+    BST_STAT(++this->stats_.retraceSteps;)
 
     AVLNode<Key, Value>* parent = current->getParent();
     int8_t ndiff = 0;
@@ -453,18 +646,21 @@ void AVLTree<Key, Value>::removeFix (AVLNode<Key, Value>* current, int8_t diff)
             AVLNode<Key, Value>* child = current->getLeft();
 
             if (child->getBalance() == -1) {
+                BST_STAT(++this->stats_.singleRotations;)
                 rotateRight(current);
                 current->setBalance(0);
                 child->setBalance(0);
                 removeFix(parent, ndiff);
             }
             else if (child->getBalance() == 0) {
+                BST_STAT(++this->stats_.singleRotations;)
                 rotateRight(current);
                 current->setBalance(-1);
                 child->setBalance(1);
             }
             else if (child->getBalance() == 1) {
                 AVLNode<Key, Value>* grandchild = child->getRight();
+                BST_STAT(++this->stats_.doubleRotations;)
                 rotateLeft(child);
                 rotateRight(current);
 
@@ -500,18 +696,21 @@ void AVLTree<Key, Value>::removeFix (AVLNode<Key, Value>* current, int8_t diff)
             AVLNode<Key, Value>* child = current->getRight();
 
             if (child->getBalance() == 1) {
+                BST_STAT(++this->stats_.singleRotations;)
                 rotateLeft(current);
                 current->setBalance(0);
                 child->setBalance(0);
                 removeFix(parent, ndiff);
             }
             else if (child->getBalance() == 0) {
+                BST_STAT(++this->stats_.singleRotations;)
                 rotateLeft(current);
                 current->setBalance(1);
                 child->setBalance(-1);
             }
             else if (child->getBalance() == -1) {
                 AVLNode<Key, Value>* grandchild = child->getLeft();
+                BST_STAT(++this->stats_.doubleRotations;)
                 rotateRight(child);
                 rotateLeft(current);
 
@@ -544,13 +743,825 @@ void AVLTree<Key, Value>::removeFix (AVLNode<Key, Value>* current, int8_t diff)
     }
 }
 
-template<class Key, class Value>
-void AVLTree<Key, Value>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+/**
+* Moves every entry with a key not less than key into right, whose previous
+* contents are discarded; this tree keeps the smaller keys. Runs in
+* O(log n): the tree is cut along the search path for key and the pieces
+* are rejoined with joinNodes. No node is copied; right shares this tree's
+* node slabs from now on.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::split(const Key& key, AVLTree<Key, Value, Compare, OrderStats>& right)
+{
+    if (&right == this) {
+        return;
+    }
+    right.clear();
+
+    AVLNode<Key, Value>* leftRoot = NULL;
+    AVLNode<Key, Value>* rightRoot = NULL;
+    int leftHeight = 0;
+    int rightHeight = 0;
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    splitNodes(root, subtreeHeight(root), key, leftRoot, leftHeight, rightRoot, rightHeight);
+
+    this->root_ = leftRoot;
+    right.root_ = rightRoot;
+    if (rightRoot != NULL) {
+        right.rightmost_ = this->rightmost_;
+        this->rightmost_ = NULL;
+        this->pool_.shareWith(right.pool_);
+    }
+}
+
+/**
+* Moves every entry of right into this tree, leaving right empty. Every key
+* in this tree must be less than every key in right. Runs in O(log n).
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::join(AVLTree<Key, Value, Compare, OrderStats>& right)
 {
-    BinarySearchTree<Key, Value>::nodeSwap(n1, n2);
+    if (&right == this || right.root_ == NULL) {
+        return;
+    }
+
+    AVLNode<Key, Value>* leftRoot = static_cast<AVLNode<Key, Value>*>(this->root_);
+    AVLNode<Key, Value>* rightRoot = static_cast<AVLNode<Key, Value>*>(right.root_);
+    right.root_ = NULL;
+    this->rightmost_ = right.rightmost_;
+    right.rightmost_ = NULL;
+    this->pool_.absorb(right.pool_);
+
+    int height = 0;
+    this->root_ = joinTrees(leftRoot, subtreeHeight(leftRoot),
+                            rightRoot, subtreeHeight(rightRoot), height);
+}
+
+/**
+* Removes every entry with lo <= key < hi, in O(log n + number removed).
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::erase(const Key& lo, const Key& hi)
+{
+    if (!this->comp_(lo, hi)) {
+        return;
+    }
+
+    AVLNode<Key, Value>* below = NULL;
+    AVLNode<Key, Value>* rest = NULL;
+    AVLNode<Key, Value>* doomed = NULL;
+    AVLNode<Key, Value>* above = NULL;
+    int belowHeight = 0;
+    int restHeight = 0;
+    int doomedHeight = 0;
+    int aboveHeight = 0;
+
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    splitNodes(root, subtreeHeight(root), lo, below, belowHeight, rest, restHeight);
+    splitNodes(rest, restHeight, hi, doomed, doomedHeight, above, aboveHeight);
+
+    this->destroySubtree(doomed);
+
+    int height = 0;
+    this->root_ = joinTrees(below, belowHeight, above, aboveHeight, height);
+}
+
+/**
+* Writes the tree to out: a header (magic, version, item count), then the
+* nodes in pre-order in blocks of SHAPE_BLOCK. A block starts with a 4-bit
+* code per node, two to a byte: bit 0 set if the node has a left child,
+* bit 1 if it has a right child, and bits 2-3 its balance plus one. The
+* node items follow in the same order, written with TreeCodec. Shape and
+* balance cost half a byte per node, and only one block of node pointers
+* is held at a time. Numbers are written in the machine's byte order.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::serialize(std::ostream& out) const
+{
+    std::vector<AVLNode<Key, Value>*> stack;
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    uint64_t count = 0;
+    for (iterator it = this->begin(); it != this->end(); ++it) {
+        ++count;
+    }
+
+    const char magic[8] = { 'A', 'V', 'L', 'T', 'R', 'E', 'E', 0 };
+    uint32_t version = 1;
+    out.write(magic, sizeof(magic));
+    out.write(reinterpret_cast<const char*>(&version), sizeof(version));
+    out.write(reinterpret_cast<const char*>(&count), sizeof(count));
+
+    if (root != NULL) {
+        stack.push_back(root);
+    }
+    AVLNode<Key, Value>* block[SHAPE_BLOCK];
+    unsigned char codes[SHAPE_BLOCK / 2];
+    while (!stack.empty()) {
+        std::size_t used = 0;
+        while (used < SHAPE_BLOCK && !stack.empty()) {
+            AVLNode<Key, Value>* node = stack.back();
+            stack.pop_back();
+            if (node->getRight() != NULL) {
+                stack.push_back(node->getRight());
+            }
+            if (node->getLeft() != NULL) {
+                stack.push_back(node->getLeft());
+            }
+            block[used++] = node;
+        }
+
+        for (std::size_t i = 0; i < (used + 1) / 2; ++i) {
+            codes[i] = 0;
+        }
+        for (std::size_t i = 0; i < used; ++i) {
+            unsigned char code = static_cast<unsigned char>(
+                (block[i]->getLeft() != NULL ? HAS_LEFT : 0) |
+                (block[i]->getRight() != NULL ? HAS_RIGHT : 0) |
+                ((block[i]->getBalance() + 1) << BALANCE_SHIFT));
+            codes[i / 2] |= static_cast<unsigned char>(code << (4 * (i % 2)));
+        }
+        out.write(reinterpret_cast<const char*>(codes), static_cast<std::streamsize>((used + 1) / 2));
+        for (std::size_t i = 0; i < used; ++i) {
+            TreeCodec<Key>::write(out, block[i]->getKey());
+            TreeCodec<Value>::write(out, block[i]->getValue());
+        }
+    }
+}
+
+/**
+* Replaces the contents of the tree with a tree written by serialize(),
+* rebuilding the same shape and balances in one pass over the stream with
+* no rotations: each node is linked in where the pre-order shape codes say
+* it goes, keeping only the nodes still waiting for a right child. A second
+* O(n) pass, in post-order, checks that every stored balance matches the
+* subtree heights and that keys increase in order, and with OrderStats
+* fills in subtree sizes. On malformed or truncated input the tree is left
+* unchanged and std::runtime_error is thrown.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::deserialize(std::istream& in)
+{
+    char magic[8];
+    uint32_t version = 0;
+    uint64_t count = 0;
+    in.read(magic, sizeof(magic));
+    in.read(reinterpret_cast<char*>(&version), sizeof(version));
+    in.read(reinterpret_cast<char*>(&count), sizeof(count));
+    if (!in || std::memcmp(magic, "AVLTREE", 8) != 0 || version != 1) {
+        throw std::runtime_error("not a serialized AVLTree");
+    }
+
+    AVLNode<Key, Value>* root = NULL;
+    // Where the next node goes: the root if parent is NULL, else parent's
+    // left or right child
+    AVLNode<Key, Value>* parent = NULL;
+    bool asRight = false;
+    bool open = true;
+    std::vector<AVLNode<Key, Value>*> waiting;
+    unsigned char codes[SHAPE_BLOCK / 2];
+    try {
+        for (uint64_t done = 0; done < count; ) {
+            uint64_t left = count - done;
+            std::size_t used = (left < SHAPE_BLOCK) ? static_cast<std::size_t>(left) : SHAPE_BLOCK;
+            in.read(reinterpret_cast<char*>(codes), static_cast<std::streamsize>((used + 1) / 2));
+            for (std::size_t i = 0; i < used; ++i, ++done) {
+                unsigned char code = (codes[i / 2] >> (4 * (i % 2))) & 0xF;
+                int balance = (code >> BALANCE_SHIFT) - 1;
+                Key key = TreeCodec<Key>::read(in);
+                Value value = TreeCodec<Value>::read(in);
+                if (!in || !open || balance > 1) {
+                    throw std::runtime_error("malformed serialized AVLTree");
+                }
+
+                AVLNode<Key, Value>* node = this->template createNode<AVLNode<Key, Value> >(
+                    std::piecewise_construct, std::forward_as_tuple(std::move(key)),
+                    std::forward_as_tuple(std::move(value)));
+                node->setParent(parent);
+                node->setBalance(static_cast<int8_t>(balance));
+                if (parent == NULL) {
+                    root = node;
+                }
+                else if (asRight) {
+                    parent->setRight(node);
+                }
+                else {
+                    parent->setLeft(node);
+                }
+
+                if (code & HAS_LEFT) {
+                    if (code & HAS_RIGHT) {
+                        waiting.push_back(node);
+                    }
+                    parent = node;
+                    asRight = false;
+                }
+                else if (code & HAS_RIGHT) {
+                    parent = node;
+                    asRight = true;
+                }
+                else if (!waiting.empty()) {
+                    parent = waiting.back();
+                    waiting.pop_back();
+                    asRight = true;
+                }
+                else {
+                    open = false;
+                }
+            }
+        }
+        if (open && count > 0) {
+            throw std::runtime_error("truncated serialized AVLTree");
+        }
+
+        // The subtrees finished so far that have no parent visited yet;
+        // post-order puts a node's right subtree on top of its left one
+        struct Subtree
+        {
+            int height;
+            AVLNode<Key, Value>* lowest;
+            AVLNode<Key, Value>* highest;
+        };
+        std::vector<Subtree> done;
+        this->forEachPostOrder(root, [this, &done](AVLNode<Key, Value>* node) {
+            Subtree tree = { 1, node, node };
+            int rightHeight = 0;
+            int leftHeight = 0;
+            if (node->getRight() != NULL) {
+                Subtree right = done.back();
+                done.pop_back();
+                if (!this->comp_(node->getKey(), right.lowest->getKey())) {
+                    throw std::runtime_error("malformed serialized AVLTree");
+                }
+                rightHeight = right.height;
+                tree.highest = right.highest;
+            }
+            if (node->getLeft() != NULL) {
+                Subtree left = done.back();
+                done.pop_back();
+                if (!this->comp_(left.highest->getKey(), node->getKey())) {
+                    throw std::runtime_error("malformed serialized AVLTree");
+                }
+                leftHeight = left.height;
+                tree.lowest = left.lowest;
+            }
+            if (node->getBalance() != rightHeight - leftHeight) {
+                throw std::runtime_error("malformed serialized AVLTree");
+            }
+            tree.height = 1 + std::max(leftHeight, rightHeight);
+            if (OrderStats) {
+                updateSize(node);
+            }
+            done.push_back(tree);
+        });
+    }
+    catch (...) {
+        this->destroySubtree(root);
+        throw;
+    }
+
+    this->destroySubtree(this->root_);
+    this->root_ = root;
+    this->rightmost_ = NULL;
+}
+
+/**
+* Inserts every key/value pair in [first, last), overwriting the values of
+* keys already present; for keys repeated in the batch the last value
+* wins. The batch is sorted and turned into nodes up front, so an
+* exception leaves the tree unchanged. Returns the number of new keys.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+template<typename InputIt>
+std::size_t AVLTree<Key, Value, Compare, OrderStats>::insert_batch(InputIt first, InputIt last)
+{
+    std::vector<std::pair<Key, Value> > items;
+    this->collectSorted(first, last, items);
+    std::vector<AVLNode<Key, Value>*> batch;
+    this->createSortedNodes(items, batch);
+
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    std::size_t added = 0;
+    int height = 0;
+    root = unionNodes(root, subtreeHeight(root), batch, 0, batch.size(), height, added);
+    if (root != NULL) {
+        root->setParent(NULL);
+    }
+    this->root_ = root;
+    this->rightmost_ = NULL;
+    return added;
+}
+
+/**
+* Removes every key in [first, last) that is present and returns how many
+* were. Keys may come in any order and repeat.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+template<typename InputIt>
+std::size_t AVLTree<Key, Value, Compare, OrderStats>::erase_batch(InputIt first, InputIt last)
+{
+    std::vector<Key> keys(first, last);
+    const Compare& comp = this->comp_;
+    std::sort(keys.begin(), keys.end(), comp);
+    keys.erase(std::unique(keys.begin(), keys.end(),
+        [&comp](const Key& a, const Key& b) { return !comp(a, b); }), keys.end());
+
+    AVLNode<Key, Value>* root = static_cast<AVLNode<Key, Value>*>(this->root_);
+    std::size_t removed = 0;
+    int height = 0;
+    root = differenceNodes(root, subtreeHeight(root), keys, 0, keys.size(), height, removed);
+    if (root != NULL) {
+        root->setParent(NULL);
+    }
+    this->root_ = root;
+    return removed;
+}
+
+/**
+* Merges the sorted, unlinked nodes batch[lo, hi) into the detached
+* subtree root (of the given height) and returns the new root. root's key
+* splits the batch in two; each half is merged into the matching child
+* and the results are rejoined under root with joinNodes. A batch node
+* whose key root already holds gives up its value to root and is freed.
+* Where the tree runs out, the rest of the batch is linked into a
+* balanced subtree directly.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare, OrderStats>::unionNodes (
+    AVLNode<Key, Value>* root, int height,
+    std::vector<AVLNode<Key, Value>*>& batch, std::size_t lo, std::size_t hi,
+    int& newHeight, std::size_t& added)
+{
+    if (lo == hi) {
+        newHeight = height;
+        return root;
+    }
+    if (root == NULL) {
+        added += hi - lo;
+        return this->linkSubtree(batch, lo, hi, newHeight, SetBalance());
+    }
+
+    // First batch node not less than root's key
+    const Compare& comp = this->comp_;
+    std::size_t mid = std::lower_bound(batch.begin() + lo, batch.begin() + hi, root,
+        [&comp](AVLNode<Key, Value>* a, AVLNode<Key, Value>* b) {
+            return comp(a->getKey(), b->getKey());
+        }) - batch.begin();
+    std::size_t rightLo = mid;
+    if (mid < hi && !comp(root->getKey(), batch[mid]->getKey())) {
+        root->getValue() = std::move(batch[mid]->getValue());
+        this->destroyNode(batch[mid]);
+        ++rightLo;
+    }
+
+    AVLNode<Key, Value>* lsub = root->getLeft();
+    AVLNode<Key, Value>* rsub = root->getRight();
+    int lsubHeight = (root->getBalance() <= 0) ? height - 1 : height - 2;
+    int rsubHeight = (root->getBalance() >= 0) ? height - 1 : height - 2;
+    if (lsub != NULL) {
+        lsub->setParent(NULL);
+    }
+    if (rsub != NULL) {
+        rsub->setParent(NULL);
+    }
+    root->setLeft(NULL);
+    root->setRight(NULL);
+
+    int leftHeight = 0;
+    int rightHeight = 0;
+    AVLNode<Key, Value>* left = unionNodes(lsub, lsubHeight, batch, lo, mid, leftHeight, added);
+    AVLNode<Key, Value>* right = unionNodes(rsub, rsubHeight, batch, rightLo, hi, rightHeight, added);
+    return joinNodes(left, leftHeight, root, right, rightHeight, newHeight);
+}
+
+/**
+* Removes the keys in keys[lo, hi) (sorted, no repeats) from the detached
+* subtree root and returns the new root, splitting the keys at root's key
+* and rejoining the pruned children like unionNodes. Subtrees no key falls
+* into are left untouched.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare, OrderStats>::differenceNodes (
+    AVLNode<Key, Value>* root, int height,
+    const std::vector<Key>& keys, std::size_t lo, std::size_t hi,
+    int& newHeight, std::size_t& removed)
+{
+    if (lo == hi || root == NULL) {
+        newHeight = height;
+        return root;
+    }
+
+    std::size_t mid = std::lower_bound(keys.begin() + lo, keys.begin() + hi, root->getKey(),
+                                       this->comp_) - keys.begin();
+    bool found = mid < hi && !this->comp_(root->getKey(), keys[mid]);
+
+    AVLNode<Key, Value>* lsub = root->getLeft();
+    AVLNode<Key, Value>* rsub = root->getRight();
+    int lsubHeight = (root->getBalance() <= 0) ? height - 1 : height - 2;
+    int rsubHeight = (root->getBalance() >= 0) ? height - 1 : height - 2;
+    if (lsub != NULL) {
+        lsub->setParent(NULL);
+    }
+    if (rsub != NULL) {
+        rsub->setParent(NULL);
+    }
+    root->setLeft(NULL);
+    root->setRight(NULL);
+
+    int leftHeight = 0;
+    int rightHeight = 0;
+    AVLNode<Key, Value>* left = differenceNodes(lsub, lsubHeight, keys, lo, mid, leftHeight, removed);
+    AVLNode<Key, Value>* right = differenceNodes(rsub, rsubHeight, keys, found ? mid + 1 : mid, hi,
+                                                 rightHeight, removed);
+    if (found) {
+        this->destroyNode(root);
+        ++removed;
+        return joinTrees(left, leftHeight, right, rightHeight, newHeight);
+    }
+    return joinNodes(left, leftHeight, root, right, rightHeight, newHeight);
+}
+
+/**
+* Returns the height of an AVL subtree in O(log n) by following the taller
+* child at every level, as told by the balance factors.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+int AVLTree<Key, Value, Compare, OrderStats>::subtreeHeight (AVLNode<Key, Value>* root)
+{
+    int height = 0;
+    while (root != NULL) {
+        ++height;
+        root = (root->getBalance() < 0) ? root->getLeft() : root->getRight();
+    }
+    return height;
+}
+
+/**
+* Rotates node, whose balance is +2 or -2, back into balance and returns
+* the new root of its subtree. grew is set if the subtree is still one
+* level taller than it was before the growth that unbalanced it, which
+* only happens when the taller child has balance 0 (possible after a join,
+* never after a plain insert).
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare, OrderStats>::rebalanceAt (AVLNode<Key, Value>* node, bool& grew)
+{
+    grew = false;
+    if (node->getBalance() == 2) {
+        AVLNode<Key, Value>* child = node->getRight();
+        if (child->getBalance() >= 0) {
+            BST_STAT(++this->stats_.singleRotations;)
+            rotateLeft(node);
+            if (child->getBalance() == 0) {
+                node->setBalance(1);
+                child->setBalance(-1);
+                grew = true;
+            }
+            else {
+                node->setBalance(0);
+                child->setBalance(0);
+            }
+            return child;
+        }
+        AVLNode<Key, Value>* grandchild = child->getLeft();
+        BST_STAT(++this->stats_.doubleRotations;)
+        rotateRight(child);
+        rotateLeft(node);
+        node->setBalance(grandchild->getBalance() == 1 ? -1 : 0);
+        child->setBalance(grandchild->getBalance() == -1 ? 1 : 0);
+        grandchild->setBalance(0);
+        return grandchild;
+    }
+    else {
+        AVLNode<Key, Value>* child = node->getLeft();
+        if (child->getBalance() <= 0) {
+            BST_STAT(++this->stats_.singleRotations;)
+            rotateRight(node);
+            if (child->getBalance() == 0) {
+                node->setBalance(-1);
+                child->setBalance(1);
+                grew = true;
+            }
+            else {
+                node->setBalance(0);
+                child->setBalance(0);
+            }
+            return child;
+        }
+        AVLNode<Key, Value>* grandchild = child->getRight();
+        BST_STAT(++this->stats_.doubleRotations;)
+        rotateLeft(child);
+        rotateRight(node);
+        node->setBalance(grandchild->getBalance() == -1 ? 1 : 0);
+        child->setBalance(grandchild->getBalance() == 1 ? -1 : 0);
+        grandchild->setBalance(0);
+        return grandchild;
+    }
+}
+
+/**
+* Joins two detached subtrees with mid between them (every key in left <
+* mid < every key in right) and returns the root of the result; height
+* receives its height. mid is hung off the spine of the taller subtree at
+* the level where the heights match and the growth is retraced upwards, so
+* the cost is O(|leftHeight - rightHeight| + 1).
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare, OrderStats>::joinNodes (
+    AVLNode<Key, Value>* left, int leftHeight, AVLNode<Key, Value>* mid,
+    AVLNode<Key, Value>* right, int rightHeight, int& height)
+{
+    bool leftTaller = leftHeight > rightHeight + 1;
+    bool rightTaller = rightHeight > leftHeight + 1;
+
+    if (!leftTaller && !rightTaller) {
+        mid->setParent(NULL);
+        mid->setLeft(left);
+        mid->setRight(right);
+        if (left != NULL) {
+            left->setParent(mid);
+        }
+        if (right != NULL) {
+            right->setParent(mid);
+        }
+        mid->setBalance(static_cast<int8_t>(rightHeight - leftHeight));
+        updateSize(mid);
+        height = std::max(leftHeight, rightHeight) + 1;
+        return mid;
+    }
+
+    // Walk down the inner spine of the taller side to a subtree whose height
+    // is within one of the shorter side
+    AVLNode<Key, Value>* top = leftTaller ? left : right;
+    int shortHeight = leftTaller ? rightHeight : leftHeight;
+    AVLNode<Key, Value>* parent = NULL;
+    AVLNode<Key, Value>* cur = top;
+    int curHeight = leftTaller ? leftHeight : rightHeight;
+    while (curHeight > shortHeight + 1) {
+        parent = cur;
+        if (leftTaller) {
+            curHeight -= (cur->getBalance() >= 0) ? 1 : 2;
+            cur = cur->getRight();
+        }
+        else {
+            curHeight -= (cur->getBalance() <= 0) ? 1 : 2;
+            cur = cur->getLeft();
+        }
+    }
+
+    // Put mid in cur's place with cur and the shorter subtree as children
+    AVLNode<Key, Value>* shorter = leftTaller ? right : left;
+    mid->setParent(parent);
+    if (leftTaller) {
+        mid->setLeft(cur);
+        mid->setRight(shorter);
+        parent->setRight(mid);
+        mid->setBalance(static_cast<int8_t>(shortHeight - curHeight));
+    }
+    else {
+        mid->setLeft(shorter);
+        mid->setRight(cur);
+        parent->setLeft(mid);
+        mid->setBalance(static_cast<int8_t>(curHeight - shortHeight));
+    }
+    if (cur != NULL) {
+        cur->setParent(mid);
+    }
+    if (shorter != NULL) {
+        shorter->setParent(mid);
+    }
+    updateSize(mid);
+    addToPathSizes(parent, static_cast<long>(sizeOf(shorter)) + 1);
+
+    // mid's subtree is one taller than cur's was; retrace that growth
+    AVLNode<Key, Value>* child = mid;
+    AVLNode<Key, Value>* node = parent;
+    bool grew = true;
+    while (node != NULL) {
+        node->updateBalance(node->getLeft() == child ? -1 : 1);
+        if (node->getBalance() == 0) {
+            grew = false;
+            break;
+        }
+        if (node->getBalance() == 2 || node->getBalance() == -2) {
+            node = rebalanceAt(node, grew);
+            if (!grew) {
+                break;
+            }
+        }
+        child = node;
+        node = node->getParent();
+    }
+
+    height = (leftTaller ? leftHeight : rightHeight) + (grew ? 1 : 0);
+    if (node == NULL) {
+        return child;
+    }
+    return (node->getParent() == NULL) ? node : top;
+}
+
+/**
+* Joins two detached subtrees (every key in left < every key in right)
+* by pulling the smallest node out of right to serve as the middle node.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+AVLNode<Key, Value>* AVLTree<Key, Value, Compare, OrderStats>::joinTrees (
+    AVLNode<Key, Value>* left, int leftHeight,
+    AVLNode<Key, Value>* right, int rightHeight, int& height)
+{
+    if (left == NULL) {
+        height = rightHeight;
+        return right;
+    }
+    if (right == NULL) {
+        height = leftHeight;
+        return left;
+    }
+
+    // Remove the smallest node from right, using root_ as scratch space
+    AVLNode<Key, Value>* mid = right;
+    while (mid->getLeft() != NULL) {
+        mid = mid->getLeft();
+    }
+    this->root_ = right;
+    right->setParent(NULL);
+    unlinkNode(mid);
+    right = static_cast<AVLNode<Key, Value>*>(this->root_);
+    rightHeight = subtreeHeight(right);
+
+    return joinNodes(left, leftHeight, mid, right, rightHeight, height);
+}
+
+/**
+* Splits the detached subtree root (of the given height) into the nodes with
+* keys less than key (left) and the rest (right), reporting both heights.
+* Each level of the search path is rejoined onto one side with joinNodes;
+* the join costs telescope, so the whole split is O(height).
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::splitNodes (AVLNode<Key, Value>* root, int height, const Key& key,
+                                               AVLNode<Key, Value>*& left, int& leftHeight,
+                                               AVLNode<Key, Value>*& right, int& rightHeight)
+{
+    if (root == NULL) {
+        left = right = NULL;
+        leftHeight = rightHeight = 0;
+        return;
+    }
+
+    AVLNode<Key, Value>* lsub = root->getLeft();
+    AVLNode<Key, Value>* rsub = root->getRight();
+    int lsubHeight = (root->getBalance() <= 0) ? height - 1 : height - 2;
+    int rsubHeight = (root->getBalance() >= 0) ? height - 1 : height - 2;
+    if (lsub != NULL) {
+        lsub->setParent(NULL);
+    }
+    if (rsub != NULL) {
+        rsub->setParent(NULL);
+    }
+    root->setLeft(NULL);
+    root->setRight(NULL);
+
+    if (this->comp_(root->getKey(), key)) {
+        // root and its left subtree stay left; split the right subtree
+        AVLNode<Key, Value>* midLeft = NULL;
+        int midLeftHeight = 0;
+        splitNodes(rsub, rsubHeight, key, midLeft, midLeftHeight, right, rightHeight);
+        left = joinNodes(lsub, lsubHeight, root, midLeft, midLeftHeight, leftHeight);
+    }
+    else {
+        // root and its right subtree go right; split the left subtree
+        AVLNode<Key, Value>* midRight = NULL;
+        int midRightHeight = 0;
+        splitNodes(lsub, lsubHeight, key, left, leftHeight, midRight, midRightHeight);
+        right = joinNodes(midRight, midRightHeight, root, rsub, rsubHeight, rightHeight);
+    }
+}
+
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::nodeSwap( AVLNode<Key,Value>* n1, AVLNode<Key,Value>* n2)
+{
+    BinarySearchTree<Key, Value, Compare>::nodeSwap(n1, n2);
     int8_t tempB = n1->getBalance();
     n1->setBalance(n2->getBalance());
     n2->setBalance(tempB);
+    uint32_t tempS = n1->getSize();
+    n1->setSize(n2->getSize());
+    n2->setSize(tempS);
+}
+
+/**
+* Checks heights in one O(n) pass and also counts the nodes whose stored
+* balance_ disagrees with their actual subtree heights.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+typename AVLTree<Key, Value, Compare, OrderStats>::BalanceReport
+AVLTree<Key, Value, Compare, OrderStats>::balanceReport () const
+{
+    return this->template makeBalanceReport<AVLNode<Key, Value> >(StoredBalanceMatches());
+}
+
+/**
+* Returns the number of entries with keys less than key (or not greater
+* than key, if inclusive), in O(log n).
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+std::size_t AVLTree<Key, Value, Compare, OrderStats>::countBelow (const Key& key, bool inclusive) const
+{
+    static_assert(OrderStats, "order statistics need AVLTree<Key, Value, Compare, true>");
+    std::size_t below = 0;
+    AVLNode<Key, Value>* node = static_cast<AVLNode<Key, Value>*>(this->root_);
+    while (node != NULL) {
+        bool goLeft = inclusive ? this->comp_(key, node->getKey())
+                                : !this->comp_(node->getKey(), key);
+        if (goLeft) {
+            node = node->getLeft();
+        }
+        else {
+            below += sizeOf(node->getLeft()) + 1;
+            node = node->getRight();
+        }
+    }
+    return below;
+}
+
+/**
+* Returns how many keys in the tree are less than key.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+std::size_t AVLTree<Key, Value, Compare, OrderStats>::rank (const Key& key) const
+{
+    return countBelow(key, false);
+}
+
+/**
+* Returns an iterator to the k-th smallest entry (counting from 0), or
+* end() if the tree has k or fewer entries.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+typename AVLTree<Key, Value, Compare, OrderStats>::iterator
+AVLTree<Key, Value, Compare, OrderStats>::select (std::size_t k) const
+{
+    static_assert(OrderStats, "order statistics need AVLTree<Key, Value, Compare, true>");
+    AVLNode<Key, Value>* node = static_cast<AVLNode<Key, Value>*>(this->root_);
+    while (node != NULL) {
+        std::size_t leftSize = sizeOf(node->getLeft());
+        if (k < leftSize) {
+            node = node->getLeft();
+        }
+        else if (k == leftSize) {
+            break;
+        }
+        else {
+            k -= leftSize + 1;
+            node = node->getRight();
+        }
+    }
+    return this->iteratorAt(node);
+}
+
+/**
+* Returns how many keys k in the tree satisfy lo <= k <= hi.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+std::size_t AVLTree<Key, Value, Compare, OrderStats>::count (const Key& lo, const Key& hi) const
+{
+    if (this->comp_(hi, lo)) {
+        return 0;
+    }
+    return countBelow(hi, true) - countBelow(lo, false);
+}
+
+/**
+* Returns the subtree size of node, or 0 for NULL.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+uint32_t AVLTree<Key, Value, Compare, OrderStats>::sizeOf (AVLNode<Key, Value>* node)
+{
+    return (node == NULL) ? 0 : node->getSize();
+}
+
+/**
+* Recomputes node's subtree size from its children's.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::updateSize (AVLNode<Key, Value>* node)
+{
+    if (OrderStats) {
+        node->setSize(sizeOf(node->getLeft()) + sizeOf(node->getRight()) + 1);
+    }
+}
+
+/**
+* Adds delta to the subtree size of node and every ancestor of it.
+*/
+template<class Key, class Value, class Compare, bool OrderStats>
+void AVLTree<Key, Value, Compare, OrderStats>::addToPathSizes (AVLNode<Key, Value>* node, long delta)
+{
+    if (OrderStats) {
+        for (; node != NULL; node = node->getParent()) {
+            node->setSize(static_cast<uint32_t>(node->getSize() + delta));
+        }
+    }
 }
 
 
@@ -0,0 +1,218 @@
+#include <iostream>
+#include <cstdlib>
+#include <cstdint>
+#include <cmath>
+#include <chrono>
+#include <map>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "bst.h"
+#include "avlbst.h"
+
+using namespace std;
+
+// Throughput of BinarySearchTree, AVLTree and std::map on insert, find,
+// in-order iteration and remove, for several key streams and sizes from
+// minSize to maxSize (growing tenfold). Results go to stdout as JSON.
+//
+// usage: bst-bench [maxSize] [minSize]
+//
+// Key streams:
+//   sequential  0, 1, 2, ...
+//   random      uniform over [0, 4n)
+//   zipfian     Zipf(0.99) over [0, n), so most inserts hit a few hot keys
+//   adversarial 0, n-1, 1, n-2, ... which makes an unbalanced tree a zigzag chain
+//
+// Lookups and removes use a shuffled copy of the inserted keys.
+// BinarySearchTree is quadratic on the sequential and adversarial
+// streams, so those runs are skipped above DEGENERATE_LIMIT keys.
+
+static const size_t DEGENERATE_LIMIT = 20000;
+
+// Cheap random numbers (xorshift), so the generator is not what we measure
+struct Rng
+{
+    explicit Rng(uint64_t seed) : state(seed * 2654435761ULL + 1) { }
+    uint64_t next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+    double unit()
+    {
+        return (next() >> 11) * (1.0 / 9007199254740992.0);
+    }
+    uint64_t state;
+};
+
+// Zipf sampler from Gray et al., "Quickly Generating Billion-Record
+// Synthetic Databases": O(n) setup, O(1) per sample, no tables
+class Zipf
+{
+public:
+    Zipf(uint64_t n, double theta) : n_(n), theta_(theta)
+    {
+        double zeta2 = 1.0 + pow(0.5, theta);
+        zetan_ = 0;
+        for (uint64_t i = 1; i <= n; ++i) {
+            zetan_ += 1.0 / pow(static_cast<double>(i), theta);
+        }
+        alpha_ = 1.0 / (1.0 - theta);
+        eta_ = (1.0 - pow(2.0 / n, 1.0 - theta)) / (1.0 - zeta2 / zetan_);
+    }
+    uint64_t next(Rng& rng)
+    {
+        double u = rng.unit();
+        double uz = u * zetan_;
+        if (uz < 1.0) return 0;
+        if (uz < 1.0 + pow(0.5, theta_)) return 1;
+        uint64_t k = static_cast<uint64_t>(n_ * pow(eta_ * u - eta_ + 1.0, alpha_));
+        return k < n_ ? k : n_ - 1;
+    }
+private:
+    uint64_t n_;
+    double theta_;
+    double zetan_;
+    double alpha_;
+    double eta_;
+};
+
+static vector<long> makeKeys(const string& dist, size_t n)
+{
+    vector<long> keys;
+    keys.reserve(n);
+    Rng rng(n);
+    if (dist == "sequential") {
+        for (size_t i = 0; i < n; ++i) keys.push_back(static_cast<long>(i));
+    }
+    else if (dist == "random") {
+        for (size_t i = 0; i < n; ++i) keys.push_back(static_cast<long>(rng.next() % (4 * n)));
+    }
+    else if (dist == "zipfian") {
+        Zipf zipf(n, 0.99);
+        for (size_t i = 0; i < n; ++i) keys.push_back(static_cast<long>(zipf.next(rng)));
+    }
+    else {
+        for (size_t lo = 0, hi = n; lo < hi; ) {
+            keys.push_back(static_cast<long>(lo++));
+            if (lo < hi) keys.push_back(static_cast<long>(--hi));
+        }
+    }
+    return keys;
+}
+
+static vector<long> shuffled(vector<long> keys)
+{
+    Rng rng(keys.size() + 17);
+    for (size_t i = keys.size(); i > 1; --i) {
+        swap(keys[i - 1], keys[rng.next() % i]);
+    }
+    return keys;
+}
+
+// The same four operations on each kind of tree
+struct BstOps
+{
+    typedef BinarySearchTree<long, long> Tree;
+    static const char* name() { return "BinarySearchTree"; }
+    static void insert(Tree& t, long k) { t.insert(make_pair(k, k)); }
+    static bool find(const Tree& t, long k) { return t.find(k) != t.end(); }
+    static void remove(Tree& t, long k) { t.remove(k); }
+};
+
+struct AvlOps
+{
+    typedef AVLTree<long, long> Tree;
+    static const char* name() { return "AVLTree"; }
+    static void insert(Tree& t, long k) { t.insert(make_pair(k, k)); }
+    static bool find(const Tree& t, long k) { return t.find(k) != t.end(); }
+    static void remove(Tree& t, long k) { t.remove(k); }
+};
+
+struct MapOps
+{
+    typedef map<long, long> Tree;
+    static const char* name() { return "std::map"; }
+    static void insert(Tree& t, long k) { t[k] = k; }
+    static bool find(const Tree& t, long k) { return t.find(k) != t.end(); }
+    static void remove(Tree& t, long k) { t.erase(k); }
+};
+
+typedef chrono::steady_clock Clock;
+
+static bool firstRecord = true;
+static uint64_t checksum = 0;
+
+static void record(const char* tree, const string& dist, size_t n, const char* op, size_t ops, Clock::time_point start)
+{
+    double ns = chrono::duration<double, nano>(Clock::now() - start).count();
+    double perOp = ops > 0 ? ns / ops : 0;
+    cout << (firstRecord ? "\n" : ",\n") << "    {\"tree\": \"" << tree << "\", \"distribution\": \"" << dist
+         << "\", \"size\": " << n << ", \"op\": \"" << op << "\", \"ops\": " << ops
+         << ", \"ns_per_op\": " << perOp << ", \"ops_per_sec\": " << (perOp > 0 ? 1e9 / perOp : 0) << "}";
+    firstRecord = false;
+}
+
+template<typename Ops>
+void run(const string& dist, const vector<long>& keys, const vector<long>& probes)
+{
+    size_t n = keys.size();
+    if (string(Ops::name()) == "BinarySearchTree" && (dist == "sequential" || dist == "adversarial") &&
+        n > DEGENERATE_LIMIT) {
+        return;
+    }
+
+    typename Ops::Tree tree;
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        Ops::insert(tree, keys[i]);
+    }
+    record(Ops::name(), dist, n, "insert", n, start);
+
+    start = Clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        checksum += Ops::find(tree, probes[i]);
+    }
+    record(Ops::name(), dist, n, "find", n, start);
+
+    start = Clock::now();
+    size_t items = 0;
+    for (typename Ops::Tree::iterator it = tree.begin(); it != tree.end(); ++it) {
+        checksum += static_cast<uint64_t>(it->second);
+        ++items;
+    }
+    record(Ops::name(), dist, n, "iterate", items, start);
+
+    start = Clock::now();
+    for (size_t i = 0; i < n; ++i) {
+        Ops::remove(tree, probes[i]);
+    }
+    record(Ops::name(), dist, n, "remove", n, start);
+}
+
+int main(int argc, char *argv[])
+{
+    size_t maxSize = 1000000;
+    size_t minSize = 1000;
+    if (argc > 1) maxSize = strtoul(argv[1], NULL, 10);
+    if (argc > 2) minSize = strtoul(argv[2], NULL, 10);
+
+    const char* dists[] = { "sequential", "random", "zipfian", "adversarial" };
+    cout << "{\n  \"min_size\": " << minSize << ",\n  \"max_size\": " << maxSize
+         << ",\n  \"degenerate_limit\": " << DEGENERATE_LIMIT << ",\n  \"results\": [";
+    for (size_t n = minSize; n <= maxSize && n > 0; n *= 10) {
+        for (size_t d = 0; d < sizeof(dists) / sizeof(dists[0]); ++d) {
+            cerr << dists[d] << " " << n << endl;
+            vector<long> keys = makeKeys(dists[d], n);
+            vector<long> probes = shuffled(keys);
+            run<BstOps>(dists[d], keys, probes);
+            run<AvlOps>(dists[d], keys, probes);
+            run<MapOps>(dists[d], keys, probes);
+        }
+    }
+    cout << "\n  ],\n  \"checksum\": " << checksum << "\n}" << endl;
+    return 0;
+}
@@ -1,7 +1,17 @@
 #include <iostream>
 #include <map>
+#include <sstream>
+#include <vector>
+#include <cstdio>
+#include <functional>
 #include "bst.h"
 #include "avlbst.h"
+#include "rbbst.h"
+#include "compact_avlbst.h"
+#include "indexed_avlbst.h"
+#include "persistent_avlbst.h"
+#include "btree.h"
+#include "mapped_bst.h"
 
 using namespace std;
 
@@ -44,5 +54,162 @@ int main(int argc, char *argv[])
     cout << "Erasing b" << endl;
     at.remove('b');
 
+    // Custom comparator: keys iterate in descending order
+    AVLTree<char,int,std::greater<char> > dt;
+    dt.insert(std::make_pair('a',1));
+    dt.insert(std::make_pair('b',2));
+    dt.insert(std::make_pair('c',3));
+
+    cout << "\nDescending AVLTree contents:" << endl;
+    for(AVLTree<char,int,std::greater<char> >::iterator it = dt.begin(); it != dt.end(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+
+    // Range scan starting mid-tree
+    cout << "\nKeys from b down to a:" << endl;
+    for(AVLTree<char,int,std::greater<char> >::iterator it = dt.lower_bound('b'); it != dt.upper_bound('a'); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+
+    // Reverse iteration
+    cout << "\nDescending AVLTree contents, reversed:" << endl;
+    for(AVLTree<char,int,std::greater<char> >::const_reverse_iterator it = dt.crbegin(); it != dt.crend(); ++it) {
+        cout << it->first << " " << it->second << endl;
+    }
+
+    // Batched updates
+    std::vector<std::pair<char,int> > batch;
+    batch.push_back(std::make_pair('e',5));
+    batch.push_back(std::make_pair('d',4));
+    batch.push_back(std::make_pair('a',10));
+    std::vector<char> gone;
+    gone.push_back('b');
+    gone.push_back('z');
+    cout << "\nBatch insert added " << dt.insert_batch(batch.begin(), batch.end()) << " key(s)" << endl;
+    cout << "Batch erase removed " << dt.erase_batch(gone.begin(), gone.end()) << " key(s)" << endl;
+    dt.print();
+
+    // Parallel bulk load from unsorted pairs
+    AVLTree<int,int> pl;
+    std::vector<std::pair<int,int> > unsorted;
+    for(int i = 0; i < 200000; ++i) {
+        unsorted.push_back(std::make_pair((i * 7919) % 200000, i));
+    }
+    pl.assign_parallel(unsorted.begin(), unsorted.end(), 4);
+    cout << "\nParallel load: " << (pl.isBalanced() ? "balanced" : "unbalanced")
+         << ", smallest key " << pl.begin()->first << endl;
+
+    // Read-only copy in a cache-friendly layout
+    FrozenTree<int,int> frozen = pl.freeze();
+    cout << "Frozen copy: " << frozen.size() << " item(s), value at 1234: " << frozen[1234]
+         << ", first key above 199990: " << frozen.upper_bound(199990)->first << endl;
+
+    // The same operations on a B-tree, checked against the AVL tree
+    BTree<int,int> bt2;
+    for(AVLTree<int,int>::iterator it = pl.begin(); it != pl.end(); ++it) {
+        bt2.insert(*it);
+    }
+    for(int i = 0; i < 200000; i += 3) {
+        pl.remove(i);
+        bt2.remove(i);
+    }
+    bool same = true;
+    BTree<int,int>::iterator bit = bt2.begin();
+    for(AVLTree<int,int>::iterator it = pl.begin(); it != pl.end(); ++it, ++bit) {
+        same = same && bit != bt2.end() && bit->first == it->first && bit->second == it->second;
+    }
+    same = same && bit == bt2.end();
+    cout << "B-tree: " << bt2.size() << " item(s), " << (same ? "matches" : "differs from")
+         << " the AVL tree, value at 1234: " << bt2[1234] << endl;
+
+    // Save to a file and query it in place
+    writeMappedTree(pl, "bst-test.map");
+    {
+        MappedTree<int,int> mapped("bst-test.map");
+        cout << "Mapped file: " << mapped.size() << " item(s), value at 1234: " << mapped[1234]
+             << ", has 3: " << (mapped.find(3) != mapped.end()) << endl;
+    }
+    std::remove("bst-test.map");
+
+    // Checkpoint to a stream and reload the exact same tree
+    std::stringstream checkpoint;
+    pl.serialize(checkpoint);
+    AVLTree<int,int> reloaded;
+    reloaded.deserialize(checkpoint);
+    cout << "Checkpoint: " << checkpoint.str().size() << " bytes, reloaded tree "
+         << (reloaded.isBalanced() ? "balanced" : "unbalanced") << ", value at 1234: " << reloaded[1234] << endl;
+
+    // The same updates on a red-black tree
+    RedBlackTree<int,int> rb;
+    for(int i = 0; i < 1000; ++i) {
+        rb.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        rb.remove(i);
+    }
+    cout << "Red-black tree: " << (rb.isRedBlack() ? "valid" : "INVALID") << ", value at 500: " << rb[500]
+         << ", has 501: " << (rb.find(501) != rb.end()) << endl;
+
+    // Nearly ordered keys, each insert searching from the previous one
+    AVLTree<int,int> stamps;
+    AVLTree<int,int>::iterator last = stamps.end();
+    for(int i = 0; i < 1000; ++i) {
+        last = stamps.insert(last, std::make_pair(i * 10 + (i % 3) * 7, i));
+    }
+    cout << "Hinted inserts: " << (stamps.isBalanced() ? "balanced" : "unbalanced")
+         << ", near the last key: " << stamps.find(last, 9990)->second << endl;
+
+    // Compact nodes: no vtable, balance in the parent pointer's low bits
+    CompactAVLTree<int,int> compact;
+    for(int i = 0; i < 1000; ++i) {
+        compact.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        compact.remove(i);
+    }
+    cout << "Compact AVL tree: " << compact.size() << " item(s), "
+         << (compact.isBalanced() ? "balanced" : "unbalanced") << ", value at 500: " << compact[500]
+         << ", " << sizeof(CompactAVLNode<int,int>) << " bytes/node vs "
+         << sizeof(AVLNode<int,int>) << " for AVLNode" << endl;
+
+    // Index-linked nodes: keys, values and 32-bit links in separate arrays
+    IndexedAVLTree<int,int> indexed;
+    indexed.reserve(1000);
+    for(int i = 0; i < 1000; ++i) {
+        indexed.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        indexed.remove(i);
+    }
+    cout << "Indexed AVL tree: " << indexed.size() << " item(s), "
+         << (indexed.isBalanced() ? "balanced" : "unbalanced") << ", value at 500: " << indexed[500]
+         << ", first key: " << indexed.begin()->first << endl;
+
+    // Hot-path counters, all 0 unless built with DEFS=-DBST_STATS
+    AVLTree<int,int> counted;
+    for(int i = 0; i < 1000; ++i) {
+        counted.insert(std::make_pair(i, i));
+    }
+    for(int i = 0; i < 1000; i += 3) {
+        counted.remove(i);
+    }
+    TreeStats st = counted.stats();
+    cout << "Stats: " << st.comparisons << " comparisons over " << st.descents << " descents, "
+         << st.singleRotations << " single and " << st.doubleRotations << " double rotations, "
+         << st.retraceSteps << " retrace steps in " << st.retraces << " retraces, "
+         << st.nodeSwaps << " node swaps" << endl;
+    counted.resetStats();
+
+    // Snapshots keep seeing the version they were taken from
+    PersistentAVLTree<char,int> pt;
+    pt.insert(std::make_pair('a',1));
+    PersistentAVLTree<char,int>::Snapshot before = pt.snapshot();
+    pt.insert(std::make_pair('b',2));
+    pt.remove('a');
+    PersistentAVLTree<char,int>::Snapshot after = pt.snapshot();
+
+    cout << "\nSnapshot before: " << before.size() << " item(s), has a: " << before.contains('a') << endl;
+    cout << "Snapshot after: " << after.size() << " item(s), has a: " << after.contains('a') << endl;
+
     return 0;
 }
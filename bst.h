@@ -4,20 +4,82 @@
 #include <iostream>
 #include <exception>
 #include <cstdlib>
+#include <string>
 #include <utility>
+#include <tuple>
+#include <functional>
+#include <vector>
+#include <algorithm>
+#include <new>
+#include <iterator>
+#include <cstddef>
+#include <type_traits>
+#include <cstdint>
+#include <memory>
+#include <thread>
+#include "node_pool.h"
+#include "frozen_bst.h"
+
+/**
+* Builds a node's item on demand. emplace wraps its arguments in one, so
+* that a tree's virtual node factory (see BinarySearchTree::createLeaf)
+* can construct the item in place without knowing the argument types.
+*/
+template <typename Key, typename Value>
+class ItemMaker
+{
+public:
+    virtual std::pair<const Key, Value> make() = 0;
+protected:
+    ~ItemMaker() { }
+};
+
+/**
+* An ItemMaker holding references to a key and the value's constructor
+* arguments. make() forwards them, so it may only be called once.
+*/
+template <typename Key, typename Value, typename K, typename... Args>
+class ForwardingItemMaker : public ItemMaker<Key, Value>
+{
+public:
+    ForwardingItemMaker(K&& key, Args&&... args) :
+        key_(std::forward<K>(key)),
+        args_(std::forward<Args>(args)...)
+    {
+    }
+
+    virtual std::pair<const Key, Value> make()
+    {
+        return std::pair<const Key, Value>(std::piecewise_construct,
+            std::forward_as_tuple(std::forward<K>(key_)), std::move(args_));
+    }
+
+private:
+    K&& key_;
+    std::tuple<Args&&...> args_;
+};
 
 /**
  * A templated class for a Node in a search tree.
- * The getters for parent/left/right are virtual so
- * that they can be overridden for future kinds of
- * search trees, such as Red Black trees, Splay trees,
- * and AVL trees.
+ * The getters for parent/left/right are NOT virtual so
+ * that tree descents compile down to plain loads. Node
+ * types for future kinds of search trees, such as Red
+ * Black trees, Splay trees, and AVL trees, hide them with
+ * getters returning their own pointer type, and the tree
+ * helpers are templated on the node type so that each tree
+ * gets the right getters at compile time. Only the
+ * destructor stays virtual, so that a tree can destroy its
+ * nodes through a base pointer.
  */
 template <typename Key, typename Value>
 class Node
 {
 public:
     Node(const Key& key, const Value& value, Node<Key, Value>* parent);
+    template<typename... KeyArgs, typename... ValueArgs>
+    Node(std::piecewise_construct_t, std::tuple<KeyArgs...>&& keyArgs,
+         std::tuple<ValueArgs...>&& valueArgs, Node<Key, Value>* parent);
+    Node(ItemMaker<Key, Value>& maker, Node<Key, Value>* parent);
     virtual ~Node();
 
     const std::pair<const Key, Value>& getItem() const;
@@ -26,9 +88,9 @@ public:
     const Value& getValue() const;
     Value& getValue();
 
-    virtual Node<Key, Value>* getParent() const;
-    virtual Node<Key, Value>* getLeft() const;
-    virtual Node<Key, Value>* getRight() const;
+    Node<Key, Value>* getParent() const;
+    Node<Key, Value>* getLeft() const;
+    Node<Key, Value>* getRight() const;
 
     void setParent(Node<Key, Value>* parent);
     void setLeft(Node<Key, Value>* left);
@@ -61,6 +123,36 @@ Node<Key, Value>::Node(const Key& key, const Value& value, Node<Key, Value>* par
 
 }
 
+/**
+* Piecewise constructor that builds the key and value in place from the
+* forwarded argument tuples, as std::pair's piecewise constructor does.
+*/
+template<typename Key, typename Value>
+template<typename... KeyArgs, typename... ValueArgs>
+Node<Key, Value>::Node(std::piecewise_construct_t, std::tuple<KeyArgs...>&& keyArgs,
+                       std::tuple<ValueArgs...>&& valueArgs, Node<Key, Value>* parent) :
+    item_(std::piecewise_construct, std::move(keyArgs), std::move(valueArgs)),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
+/**
+* Constructor that takes its item from maker.make(), which the compiler
+* builds straight into the node.
+*/
+template<typename Key, typename Value>
+Node<Key, Value>::Node(ItemMaker<Key, Value>& maker, Node<Key, Value>* parent) :
+    item_(maker.make()),
+    parent_(parent),
+    left_(NULL),
+    right_(NULL)
+{
+
+}
+
 /**
 * Destructor, which does not need to do anything since the pointers inside of a node
 * are only used as references to existing nodes. The nodes pointed to by parent/left/right
@@ -118,7 +210,7 @@ Value& Node<Key, Value>::getValue()
 }
 
 /**
-* An implementation of the virtual function for retreiving the parent.
+* A getter for the parent.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getParent() const
@@ -127,7 +219,7 @@ Node<Key, Value>* Node<Key, Value>::getParent() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the left child.
+* A getter for the left child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getLeft() const
@@ -136,7 +228,7 @@ Node<Key, Value>* Node<Key, Value>::getLeft() const
 }
 
 /**
-* An implementation of the virtual function for retreiving the right child.
+* A getter for the right child.
 */
 template<typename Key, typename Value>
 Node<Key, Value>* Node<Key, Value>::getRight() const
@@ -186,31 +278,148 @@ void Node<Key, Value>::setValue(const Value& value)
   ---------------------------------------
 */
 
+/**
+* Counters for the hot paths of a search tree, see BinarySearchTree::stats().
+* They are only kept when the program is built with -DBST_STATS (e.g.
+* DEFS=-DBST_STATS with the Makefile); otherwise stats() always returns
+* zeros and the trees carry no counting code or data. The counters are
+* plain integers, so with BST_STATS concurrent readers of one tree race on
+* them; use them single-threaded.
+*/
+struct TreeStats
+{
+    static const int DEPTH_BUCKETS = 64;
+
+    std::uint64_t comparisons;      // Compare calls made by descents
+    std::uint64_t nodesVisited;     // nodes stepped through by descents
+    std::uint64_t descents;         // searches from the root
+    std::uint64_t singleRotations;  // AVL rebalances needing one rotation
+    std::uint64_t doubleRotations;  // AVL rebalances needing two rotations
+    std::uint64_t retraces;         // AVL insert/remove retracing passes
+    std::uint64_t retraceSteps;     // ancestors visited by those passes
+    std::uint64_t nodeSwaps;        // removes that swapped with the predecessor
+    // depthHistogram[d] counts descents that visited d nodes; the last
+    // bucket also takes every deeper descent
+    std::uint64_t depthHistogram[DEPTH_BUCKETS];
+
+    TreeStats() { reset(); }
+
+    void reset()
+    {
+        comparisons = nodesVisited = descents = 0;
+        singleRotations = doubleRotations = 0;
+        retraces = retraceSteps = nodeSwaps = 0;
+        for (int i = 0; i < DEPTH_BUCKETS; ++i) {
+            depthHistogram[i] = 0;
+        }
+    }
+
+    void recordDescent(std::size_t depth)
+    {
+        ++descents;
+        nodesVisited += depth;
+        comparisons += depth;
+        ++depthHistogram[depth < DEPTH_BUCKETS - 1 ? depth : DEPTH_BUCKETS - 1];
+    }
+};
+
+// BST_STAT(statement) runs statement only in a BST_STATS build
+#ifdef BST_STATS
+#define BST_STAT(...) __VA_ARGS__
+#else
+#define BST_STAT(...)
+#endif
+
+/**
+* The distance BinarySearchTree::nearest uses by default: |a - b| for
+* arithmetic keys, in the unsigned type of the same width for integers.
+* That gap is exact even between keys at opposite ends of the range
+* (INT_MIN and INT_MAX), where a signed subtraction would overflow. Other
+* key types pass a distance of their own to nearest.
+*/
+template <typename Key>
+struct KeyDistance
+{
+    static_assert(std::is_arithmetic<Key>::value && !std::is_same<Key, bool>::value,
+                  "nearest() needs a distance functor for non-arithmetic keys");
+
+    typedef typename std::conditional<std::is_integral<Key>::value,
+                                      std::make_unsigned<Key>,
+                                      std::remove_cv<Key> >::type::type result_type;
+
+    result_type operator()(const Key& a, const Key& b) const
+    {
+        // Unsigned subtraction wraps modulo 2^N, which leaves the exact gap
+        return static_cast<result_type>(a < b ? result_type(b) - result_type(a)
+                                              : result_type(a) - result_type(b));
+    }
+};
+
 /**
 * A templated unbalanced binary search tree.
+* Keys are ordered by Compare (std::less<Key> by default), and every
+* descent makes a single Compare call per level. If Compare declares
+* is_transparent (e.g. std::less<> in C++14 and later), find and
+* operator[] also accept any type comparable with Key, such as a
+* std::string_view for std::string keys, without building a Key.
 */
-template <typename Key, typename Value>
+template <typename Key, typename Value, typename Compare = std::less<Key> >
 class BinarySearchTree
 {
 public:
     BinarySearchTree(); //TODO
+    explicit BinarySearchTree(const Compare& comp);
+    template<typename InputIt>
+    BinarySearchTree(InputIt first, InputIt last, const Compare& comp = Compare());
     virtual ~BinarySearchTree(); //TODO
     virtual void insert(const std::pair<const Key, Value>& keyValuePair); //TODO
+    virtual void insert(std::pair<const Key, Value>&& keyValuePair);
     virtual void remove(const Key& key); //TODO
     void clear(); //TODO
+    template<typename InputIt>
+    void assign(InputIt first, InputIt last);
     bool isBalanced() const; //TODO
+
+    /**
+    * The result of a full balance check, see balanceReport().
+    */
+    struct BalanceReport
+    {
+        bool balanced;                          // no node's subtree heights differ by more than 1
+        int height;                             // height of the tree, 0 if empty
+        std::size_t nodes;                      // number of nodes checked
+        const Node<Key, Value>* firstUnbalanced; // first violating node in post-order, or NULL
+        std::size_t balanceMismatches;          // nodes whose stored balance is wrong (AVL only)
+        const Node<Key, Value>* firstMismatch;  // first such node in post-order, or NULL
+    };
+    virtual BalanceReport balanceReport() const;
+    FrozenTree<Key, Value, Compare> freeze() const;
+    TreeStats stats() const;
+    void resetStats();
     void print() const;
     bool empty() const;
 
-    template<typename PPKey, typename PPValue>
-    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue> & tree);
+    template<typename PPKey, typename PPValue, typename PPCompare>
+    friend void prettyPrintBST(BinarySearchTree<PPKey, PPValue, PPCompare> & tree);
+protected:
+    // Lets derived trees size the node pool for their own node type.
+    BinarySearchTree(std::size_t nodeSize, const Compare& comp);
 public:
     /**
     * An internal iterator class for traversing the contents of the BST.
+    * It is bidirectional: stepping follows parent pointers, so a full scan
+    * in either direction costs O(1) amortized per step, and decrementing
+    * end() moves to the largest item.
     */
     class iterator  // TODO
     {
     public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
         iterator();
 
         std::pair<const Key,Value>& operator*() const;
@@ -220,24 +429,108 @@ public:
         bool operator!=(const iterator& rhs) const;
 
         iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
 
     protected:
-        friend class BinarySearchTree<Key, Value>;
-        iterator(Node<Key,Value>* ptr);
+        friend class BinarySearchTree<Key, Value, Compare>;
+        iterator(Node<Key,Value>* ptr, const BinarySearchTree* tree);
         Node<Key, Value> *current_;
+        const BinarySearchTree* tree_;  // lets end() step back to the largest item
+    };
+
+    /**
+    * Like iterator, but only gives read access to the items.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        const std::pair<const Key,Value>& operator*() const;
+        const std::pair<const Key,Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        iterator it_;
     };
 
+    typedef std::reverse_iterator<iterator> reverse_iterator;
+    typedef std::reverse_iterator<const_iterator> const_reverse_iterator;
+
 public:
     iterator begin() const;
     iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    reverse_iterator rbegin() const;
+    reverse_iterator rend() const;
+    const_reverse_iterator crbegin() const;
+    const_reverse_iterator crend() const;
     iterator find(const Key& key) const;
     Value& operator[](const Key& key);
     Value const & operator[](const Key& key) const;
 
+    // Ordered lookups. Each is one O(log n) descent and returns an iterator
+    // that can be advanced from there, so a scan of k items is O(log n + k).
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+    std::pair<iterator, iterator> equal_range(const Key& key) const;
+    iterator floor(const Key& key) const;
+    iterator ceiling(const Key& key) const;
+    iterator nearest(const Key& key) const;
+    template<typename Distance>
+    iterator nearest(const Key& key, Distance distance) const;
+
+    // Finger search: these start from a nearby entry (say the last one
+    // inserted) instead of the root and cost O(log d) for a key d entries
+    // away from it in a balanced tree. A hint of end() stands for the
+    // largest entry. insert overwrites an existing value like insert(pair);
+    // a key past the largest one, or one falling right next to the hint,
+    // is linked in without searching at all.
+    iterator insert(iterator hint, const std::pair<const Key, Value>& keyValuePair);
+    iterator find(iterator finger, const Key& key) const;
+
+    // Move-aware insertion. These search first and only allocate a node
+    // when the key is new. emplace overwrites an existing value (like
+    // insert); try_emplace leaves it untouched.
+    template<typename V>
+    std::pair<iterator, bool> emplace(const Key& key, V&& value);
+    template<typename V>
+    std::pair<iterator, bool> emplace(Key&& key, V&& value);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(const Key& key, Args&&... args);
+    template<typename... Args>
+    std::pair<iterator, bool> try_emplace(Key&& key, Args&&... args);
+
+    // Heterogeneous lookup, only available when Compare is transparent
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    iterator find(const K& key) const;
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    Value& operator[](const K& key);
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    Value const & operator[](const K& key) const;
+
 protected:
     // Mandatory helper functions
     Node<Key, Value>* internalFind(const Key& k) const; // TODO
     Node<Key, Value> *getSmallestNode() const;  // TODO
+    Node<Key, Value> *getLargestNode() const;
     static Node<Key, Value>* predecessor(Node<Key, Value>* current); // TODO
     // Note:  static means these functions don't have a "this" pointer
     //        and instead just use the input argument.
@@ -249,13 +542,125 @@ protected:
     // Add helper functions here
 		static Node<Key, Value>* successor(Node<Key, Value>* current);
 
+    // Descent/walk helpers templated on the node type, so trees with
+    // derived nodes (e.g. AVLNode) walk them without casts or virtual calls
+    template<typename NodeType>
+    static NodeType* predecessorOf(NodeType* current);
+    template<typename NodeType>
+    static NodeType* successorOf(NodeType* current);
+    template<typename NodeType, typename K>
+    NodeType* findNode(const K& key) const;
+    template<typename NodeType, typename K>
+    NodeType* floorNode(const K& key) const;
+    template<typename NodeType, typename K>
+    NodeType* floorNodeFrom(NodeType* start, const K& key) const;
+    template<typename NodeType, typename K>
+    NodeType* fingerStart(NodeType* finger, const K& key) const;
+    Node<Key, Value>* fingerOf(const iterator& hint) const;
+    bool hintSlot(Node<Key, Value>* hint, const Key& key, Node<Key, Value>*& parent, bool& isLeft);
+    Node<Key, Value>* largestNode();
+    template<typename NodeType, typename K>
+    NodeType* boundNode(const K& key, bool upper) const;
+    template<typename NodeType>
+    NodeType* findInsertPos(NodeType* start, const Key& key, NodeType*& parent, bool& isLeft) const;
+    template<typename NodeType, typename Visit>
+    static void forEachPostOrder(NodeType* root, Visit visit);
+
 		void clearHelp(Node<Key, Value>* current);
 
-		bool balanceHelp(Node<Key, Value>* root) const;
+    template<typename NodeType, typename CheckStored>
+    int balanceHelp(NodeType* current, BalanceReport& report, CheckStored checkStored) const;
+    template<typename NodeType, typename CheckStored>
+    static int checkNode(NodeType* current, int leftHeight, int rightHeight,
+                         BalanceReport& report, CheckStored& checkStored);
+    template<typename NodeType, typename CheckStored>
+    BalanceReport makeBalanceReport(CheckStored checkStored) const;
+    struct NoStoredBalance
+    {
+        bool operator()(Node<Key, Value>*, int) const { return true; }
+    };
+
+    // Node storage helpers; all nodes live in pool_
+    template<typename NodeType, typename... Args>
+    NodeType* createNode(Args&&... args);
+    template<typename NodeType, typename... Args>
+    static NodeType* createNodeIn(NodePool& pool, Args&&... args);
+    void destroyNode(Node<Key, Value>* node);
+    void destroySubtree(Node<Key, Value>* root);
+
+    // Node factory hooks. Every mutator creates nodes and rebalances
+    // through these, so a derived tree with its own node type overrides
+    // them and stays valid when used through a BinarySearchTree reference.
+    // createLeaf returns an unlinked node; afterInsert runs once the new
+    // node is linked in as a leaf.
+    virtual Node<Key, Value>* createLeaf(ItemMaker<Key, Value>& maker);
+    virtual void afterInsert(Node<Key, Value>* node);
+    // Builds root_ for assign() from sorted, duplicate-free items (see
+    // buildFromSorted) in the tree's own node type
+    virtual void buildSorted(std::vector<std::pair<Key, Value> >& items);
+
+    // Shared body of the inserting functions: links in a new node built
+    // from key and valueArgs, or returns the node already holding key
+    template<typename K, typename... Args>
+    std::pair<Node<Key, Value>*, bool> emplaceNode(K&& key, Args&&... valueArgs);
+    template<typename K, typename... Args>
+    std::pair<Node<Key, Value>*, bool> emplaceNodeFrom(Node<Key, Value>* start, K&& key, Args&&... valueArgs);
+    template<typename K, typename... Args>
+    Node<Key, Value>* attachLeaf(Node<Key, Value>* parent, bool isLeft, K&& key, Args&&... valueArgs);
+    iterator iteratorAt(Node<Key, Value>* node) const;
+
+    // Bulk loading: collect a key-ordered, duplicate-free copy of a range,
+    // then turn it into a height-balanced tree of NodeType in linear time.
+    // onLinked(node, leftHeight, rightHeight) is called on every node once
+    // its subtrees are linked so derived trees can fill in extra fields.
+    template<typename InputIt>
+    void collectSorted(InputIt first, InputIt last, std::vector<std::pair<Key, Value> >& items,
+                       unsigned threads = 1) const;
+    template<typename NodeType, typename OnLinked>
+    void buildFromSorted(std::vector<std::pair<Key, Value> >& items, OnLinked onLinked);
+    template<typename NodeType>
+    void createSortedNodes(std::vector<std::pair<Key, Value> >& items, std::vector<NodeType*>& nodes);
+    template<typename NodeType, typename OnLinked>
+    static NodeType* linkSubtree(std::vector<NodeType*>& nodes, std::size_t lo, std::size_t hi,
+                                 int& height, OnLinked onLinked);
+
+    // Parallel bulk loading: the items are split into 2^depth slices along
+    // the same midpoints linkSubtree uses; each slice is turned into nodes
+    // and linked by a worker thread with its own NodePool, and the calling
+    // thread links the few nodes above the slices.
+    template<typename NodeType, typename OnLinked>
+    void buildFromSortedParallel(std::vector<std::pair<Key, Value> >& items, OnLinked onLinked,
+                                 unsigned threads);
+    template<typename NodeType>
+    static void planSlices(std::vector<std::pair<Key, Value> >& items, std::vector<NodeType*>& nodes,
+                           std::size_t lo, std::size_t hi, int depth,
+                           std::vector<std::size_t>& slices, NodePool& pool);
+    template<typename NodeType, typename OnLinked>
+    static NodeType* linkAboveSlices(std::vector<NodeType*>& nodes, std::size_t lo, std::size_t hi, int depth,
+                                     const std::vector<NodeType*>& roots, const std::vector<int>& heights,
+                                     std::size_t& slice, int& height, OnLinked onLinked);
+    void sortParallel(std::vector<std::pair<Key, Value> >& items, unsigned threads) const;
+    template<typename Task>
+    static void runParallel(std::size_t tasks, unsigned threads, Task task);
+    static unsigned threadCount(unsigned threads);
+    static const std::size_t MIN_PARALLEL_ITEMS = 1 << 16;
+
+    struct IgnoreHeights
+    {
+        void operator()(Node<Key, Value>*, int, int) const { }
+    };
 
 protected:
     Node<Key, Value>* root_;
-    // You should not need other data members
+    // The node with the largest key, or NULL if not known. Linking in a
+    // new largest key keeps it; destroying it, clear() and the bulk
+    // operations that replace root_ reset it.
+    Node<Key, Value>* rightmost_;
+    NodePool pool_;
+    Compare comp_;
+#ifdef BST_STATS
+    mutable TreeStats stats_;
+#endif
 };
 
 /*
@@ -267,29 +672,32 @@ Begin implementations for the BinarySearchTree::iterator class.
 /**
 * Explicit constructor that initializes an iterator with a given node pointer.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator(Node<Key,Value> *ptr)
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::iterator::iterator(Node<Key,Value> *ptr,
+    const BinarySearchTree* tree)
 {
     // TODO
 		current_ = ptr;
+		tree_ = tree;
 }
 
 /**
 * A default constructor that initializes the iterator to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::iterator::iterator() 
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::iterator::iterator() 
 {
     // TODO
 		current_ = NULL;
+		tree_ = NULL;
 }
 
 /**
 * Provides access to the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 std::pair<const Key,Value> &
-BinarySearchTree<Key, Value>::iterator::operator*() const
+BinarySearchTree<Key, Value, Compare>::iterator::operator*() const
 {
     return current_->getItem();
 }
@@ -297,9 +705,9 @@ BinarySearchTree<Key, Value>::iterator::operator*() const
 /**
 * Provides access to the address of the item.
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 std::pair<const Key,Value> *
-BinarySearchTree<Key, Value>::iterator::operator->() const
+BinarySearchTree<Key, Value, Compare>::iterator::operator->() const
 {
     return &(current_->getItem());
 }
@@ -308,10 +716,10 @@ BinarySearchTree<Key, Value>::iterator::operator->() const
 * Checks if 'this' iterator's internals have the same value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator==(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare>::iterator::operator==(
+    const BinarySearchTree<Key, Value, Compare>::iterator& rhs) const
 {
     // TODO
 		return current_ == rhs.current_;
@@ -321,10 +729,10 @@ BinarySearchTree<Key, Value>::iterator::operator==(
 * Checks if 'this' iterator's internals have a different value
 * as 'rhs'
 */
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
 bool
-BinarySearchTree<Key, Value>::iterator::operator!=(
-    const BinarySearchTree<Key, Value>::iterator& rhs) const
+BinarySearchTree<Key, Value, Compare>::iterator::operator!=(
+    const BinarySearchTree<Key, Value, Compare>::iterator& rhs) const
 {
     // TODO
 		return current_ != rhs.current_;
@@ -334,9 +742,9 @@ BinarySearchTree<Key, Value>::iterator::operator!=(
 /**
 * Advances the iterator's location using an in-order sequencing
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator&
-BinarySearchTree<Key, Value>::iterator::operator++()
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator&
+BinarySearchTree<Key, Value, Compare>::iterator::operator++()
 {
     // TODO
 
@@ -344,6 +752,47 @@ BinarySearchTree<Key, Value>::iterator::operator++()
 		return *this;
 }
 
+/**
+* Advances the iterator, returning its previous position
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Moves the iterator back to the previous item in order. Moving back
+* from end() lands on the largest item.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator&
+BinarySearchTree<Key, Value, Compare>::iterator::operator--()
+{
+    if (current_ == NULL) {
+        current_ = tree_->getLargestNode();
+    }
+    else {
+        current_ = predecessor(current_);
+    }
+    return *this;
+}
+
+/**
+* Moves the iterator back, returning its previous position
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
+}
+
 
 /*
 -------------------------------------------------------------
@@ -351,6 +800,124 @@ End implementations for the BinarySearchTree::iterator class.
 -------------------------------------------------------------
 */
 
+/*
+--------------------------------------------------------------------
+Begin implementations for the BinarySearchTree::const_iterator class.
+--------------------------------------------------------------------
+*/
+
+/**
+* A default constructor that initializes the iterator to NULL.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::const_iterator::const_iterator() :
+    it_()
+{
+}
+
+/**
+* Converts a mutable iterator to a read-only one at the same position.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::const_iterator::const_iterator(const iterator& it) :
+    it_(it)
+{
+}
+
+/**
+* Provides read access to the item.
+*/
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value> &
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return *it_;
+}
+
+/**
+* Provides the address of the item.
+*/
+template<class Key, class Value, class Compare>
+const std::pair<const Key,Value> *
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return it_.operator->();
+}
+
+/**
+* Checks if both iterators are at the same position
+*/
+template<class Key, class Value, class Compare>
+bool
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator==(
+    const BinarySearchTree<Key, Value, Compare>::const_iterator& rhs) const
+{
+    return it_ == rhs.it_;
+}
+
+/**
+* Checks if the iterators are at different positions
+*/
+template<class Key, class Value, class Compare>
+bool
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator!=(
+    const BinarySearchTree<Key, Value, Compare>::const_iterator& rhs) const
+{
+    return it_ != rhs.it_;
+}
+
+/**
+* Advances to the next item in order
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator&
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    ++it_;
+    return *this;
+}
+
+/**
+* Advances the iterator, returning its previous position
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++it_;
+    return old;
+}
+
+/**
+* Moves back to the previous item in order, or from end() to the largest
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator&
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    --it_;
+    return *this;
+}
+
+/**
+* Moves the iterator back, returning its previous position
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --it_;
+    return old;
+}
+
+/*
+------------------------------------------------------------------
+End implementations for the BinarySearchTree::const_iterator class.
+------------------------------------------------------------------
+*/
+
 /*
 -----------------------------------------------------
 Begin implementations for the BinarySearchTree class.
@@ -360,16 +927,59 @@ Begin implementations for the BinarySearchTree class.
 /**
 * Default constructor for a BinarySearchTree, which sets the root to NULL.
 */
-template<class Key, class Value>
-BinarySearchTree<Key, Value>::BinarySearchTree() 
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree() :
+    root_(NULL),
+    rightmost_(NULL),
+    pool_(sizeof(Node<Key, Value>)),
+    comp_()
 {
-    // TODO
 
-		root_ = NULL;
 }
 
-template<typename Key, typename Value>
-BinarySearchTree<Key, Value>::~BinarySearchTree()
+/**
+* Constructor for a BinarySearchTree ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(const Compare& comp) :
+    root_(NULL),
+    rightmost_(NULL),
+    pool_(sizeof(Node<Key, Value>)),
+    comp_(comp)
+{
+
+}
+
+/**
+* Constructor for derived trees whose nodes are larger than a plain Node.
+*/
+template<class Key, class Value, class Compare>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(std::size_t nodeSize, const Compare& comp) :
+    root_(NULL),
+    rightmost_(NULL),
+    pool_(nodeSize),
+    comp_(comp)
+{
+
+}
+
+/**
+* Builds a tree holding the items of [first, last) in a single linear pass.
+* See assign().
+*/
+template<class Key, class Value, class Compare>
+template<typename InputIt>
+BinarySearchTree<Key, Value, Compare>::BinarySearchTree(InputIt first, InputIt last, const Compare& comp) :
+    root_(NULL),
+    rightmost_(NULL),
+    pool_(sizeof(Node<Key, Value>)),
+    comp_(comp)
+{
+    assign(first, last);
+}
+
+template<typename Key, typename Value, typename Compare>
+BinarySearchTree<Key, Value, Compare>::~BinarySearchTree()
 {
     // TODO
 		clear();
@@ -378,14 +988,14 @@ BinarySearchTree<Key, Value>::~BinarySearchTree()
 /**
  * Returns true if tree is empty
 */
-template<class Key, class Value>
-bool BinarySearchTree<Key, Value>::empty() const
+template<class Key, class Value, class Compare>
+bool BinarySearchTree<Key, Value, Compare>::empty() const
 {
     return root_ == NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::print() const
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::print() const
 {
     printRoot(root_);
     std::cout << "\n";
@@ -394,35 +1004,87 @@ void BinarySearchTree<Key, Value>::print() const
 /**
 * Returns an iterator to the "smallest" item in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::begin() const
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::begin() const
 {
-    BinarySearchTree<Key, Value>::iterator begin(getSmallestNode());
+    BinarySearchTree<Key, Value, Compare>::iterator begin(getSmallestNode(), this);
     return begin;
 }
 
 /**
 * Returns an iterator whose value means INVALID
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::end() const
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::end() const
 {
-    BinarySearchTree<Key, Value>::iterator end(NULL);
+    BinarySearchTree<Key, Value, Compare>::iterator end(NULL, this);
     return end;
 }
 
+/**
+* Read-only versions of begin() and end()
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::cbegin() const
+{
+    return const_iterator(begin());
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_iterator
+BinarySearchTree<Key, Value, Compare>::cend() const
+{
+    return const_iterator(end());
+}
+
+/**
+* Returns a reverse iterator to the largest item, for scanning in
+* descending order up to rend()
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rbegin() const
+{
+    return reverse_iterator(end());
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::reverse_iterator
+BinarySearchTree<Key, Value, Compare>::rend() const
+{
+    return reverse_iterator(begin());
+}
+
+/**
+* Read-only versions of rbegin() and rend()
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::crbegin() const
+{
+    return const_reverse_iterator(cend());
+}
+
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator
+BinarySearchTree<Key, Value, Compare>::crend() const
+{
+    return const_reverse_iterator(cbegin());
+}
+
 /**
 * Returns an iterator to the item with the given key, k
 * or the end iterator if k does not exist in the tree
 */
-template<class Key, class Value>
-typename BinarySearchTree<Key, Value>::iterator
-BinarySearchTree<Key, Value>::find(const Key & k) const
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(const Key & k) const
 {
     Node<Key, Value> *curr = internalFind(k);
-    BinarySearchTree<Key, Value>::iterator it(curr);
+    BinarySearchTree<Key, Value, Compare>::iterator it(curr, this);
     return it;
 }
 
@@ -430,15 +1092,15 @@ BinarySearchTree<Key, Value>::find(const Key & k) const
  * @precondition The key exists in the map
  * Returns the value associated with the key
  */
-template<class Key, class Value>
-Value& BinarySearchTree<Key, Value>::operator[](const Key& key)
+template<class Key, class Value, class Compare>
+Value& BinarySearchTree<Key, Value, Compare>::operator[](const Key& key)
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
     return curr->getValue();
 }
-template<class Key, class Value>
-Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
+template<class Key, class Value, class Compare>
+Value const & BinarySearchTree<Key, Value, Compare>::operator[](const Key& key) const
 {
     Node<Key, Value> *curr = internalFind(key);
     if(curr == NULL) throw std::out_of_range("Invalid key");
@@ -446,69 +1108,360 @@ Value const & BinarySearchTree<Key, Value>::operator[](const Key& key) const
 }
 
 /**
-* An insert method to insert into a Binary Search Tree.
-* The tree will not remain balanced when inserting.
-* Recall: If key is already in the tree, you should 
-* overwrite the current value with the updated value.
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none.
 */
-template<class Key, class Value>
-void BinarySearchTree<Key, Value>::insert(const std::pair<const Key, Value> &keyValuePair)
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::lower_bound(const Key& key) const
 {
-    // TODO
-		// Create a new node with the specified key and value
-    Node<Key, Value>* newNode = new Node<Key, Value>(keyValuePair.first, keyValuePair.second, NULL);
+    return iterator(boundNode<Node<Key, Value> >(key, false), this);
+}
 
-    // If the tree is empty, set the new node as the root
-    if (root_ == nullptr) {
-        root_ = newNode;
-        return;
-    }
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or end() if there is none.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return iterator(boundNode<Node<Key, Value> >(key, true), this);
+}
 
-    // Traverse the tree to find the appropriate position to insert the new node
-    Node<Key, Value>* temp = root_;
-    while (temp) {
-        if (keyValuePair.first == temp->getKey()) {
-            // If the key already exists, overwrite the current value with the updated value
-            temp->setValue(keyValuePair.second);
-            delete newNode; // Delete the new node since it's not needed
-            return;
-        } else if (keyValuePair.first < temp->getKey()) {
-            if (temp->getLeft() == nullptr) {
-                // If the left child is null, insert the new node as the left child
-                temp->setLeft(newNode);
-                newNode->setParent(temp);
-                return;
-            }
-            temp = temp->getLeft();
-        } else {
-            if (temp->getRight() == nullptr) {
-                // If the right child is null, insert the new node as the right child
-                temp->setRight(newNode);
-                newNode->setParent(temp);
-                return;
-            }
-            temp = temp->getRight();
-        }
+/**
+* Returns the range of items with the given key: empty if key is absent,
+* otherwise just that item, since keys are unique.
+*/
+template<class Key, class Value, class Compare>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator,
+          typename BinarySearchTree<Key, Value, Compare>::iterator>
+BinarySearchTree<Key, Value, Compare>::equal_range(const Key& key) const
+{
+    Node<Key, Value>* first = boundNode<Node<Key, Value> >(key, false);
+    Node<Key, Value>* last = first;
+    if (first != NULL && !comp_(key, first->getKey())) {
+        last = successor(first);
     }
+    return std::make_pair(iterator(first, this), iterator(last, this));
 }
 
+/**
+* Returns an iterator to the item with the greatest key not greater than
+* key, or end() if every key is greater.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::floor(const Key& key) const
+{
+    return iterator(floorNode<Node<Key, Value> >(key), this);
+}
 
 /**
-* A remove method to remove a specific key from a Binary Search Tree.
-* Recall: The writeup specifies that if a node has 2 children you
-* should swap with the predecessor and then remove.
+* Returns an iterator to the item with the smallest key not less than
+* key, or end() if every key is smaller. Same as lower_bound.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::remove(const Key& key)
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::ceiling(const Key& key) const
 {
-    // TODO
-		// If the tree is empty, do nothing
-    if (root_ == nullptr) {
-        return;
-    }
+    return lower_bound(key);
+}
 
-    // Find the node with the specified key
-    Node<Key, Value>* removeNode = internalFind(key);
+/**
+* Returns an iterator to the item whose key is closest to key, measuring
+* distance with KeyDistance (so only usable with arithmetic keys). Ties
+* go to the key that comes first in the tree's order. Returns end() only
+* if the tree is empty.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::nearest(const Key& key) const
+{
+    return nearest(key, KeyDistance<Key>());
+}
+
+/**
+* nearest with a caller-supplied distance: distance(a, b) takes two keys
+* and returns a value comparable with <, the same for either argument
+* order. Only the two neighbors of key are measured.
+*/
+template<class Key, class Value, class Compare>
+template<typename Distance>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::nearest(const Key& key, Distance distance) const
+{
+    // below sorts before key and above after it, in Compare's order
+    Node<Key, Value>* below = floorNode<Node<Key, Value> >(key);
+    if (below != NULL && !comp_(below->getKey(), key)) {
+        return iterator(below, this);
+    }
+    Node<Key, Value>* above = (below != NULL) ? successor(below) : getSmallestNode();
+    if (below == NULL) {
+        return iterator(above, this);
+    }
+    if (above == NULL) {
+        return iterator(below, this);
+    }
+    if (distance(above->getKey(), key) < distance(below->getKey(), key)) {
+        return iterator(above, this);
+    }
+    return iterator(below, this);
+}
+
+/**
+* Heterogeneous versions of find and operator[] for transparent comparators.
+* The lookup key is compared against stored keys directly.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(const K & k) const
+{
+    return iterator(findNode<Node<Key, Value> >(k), this);
+}
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+Value& BinarySearchTree<Key, Value, Compare>::operator[](const K& key)
+{
+    Node<Key, Value> *curr = findNode<Node<Key, Value> >(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+template<class Key, class Value, class Compare>
+template<typename K, typename C, typename>
+Value const & BinarySearchTree<Key, Value, Compare>::operator[](const K& key) const
+{
+    Node<Key, Value> *curr = findNode<Node<Key, Value> >(key);
+    if(curr == NULL) throw std::out_of_range("Invalid key");
+    return curr->getValue();
+}
+
+/**
+* An insert method to insert into a Binary Search Tree.
+* The tree will not remain balanced when inserting.
+* Recall: If key is already in the tree, you should 
+* overwrite the current value with the updated value.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::insert(const std::pair<const Key, Value> &keyValuePair)
+{
+    // TODO
+		emplace(keyValuePair.first, keyValuePair.second);
+}
+
+/**
+* Same as above, but moves the value out of keyValuePair.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::insert(std::pair<const Key, Value>&& keyValuePair)
+{
+    emplace(keyValuePair.first, std::move(keyValuePair.second));
+}
+
+/**
+* Inserts keyValuePair searching from hint rather than the root, and
+* returns an iterator to the entry. Passing the iterator returned by the
+* previous call makes runs of nearly ordered keys cheap.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::insert(iterator hint, const std::pair<const Key, Value>& keyValuePair)
+{
+    Node<Key, Value>* parent = NULL;
+    bool isLeft = false;
+    if (hintSlot(hint.current_, keyValuePair.first, parent, isLeft)) {
+        return iterator(attachLeaf(parent, isLeft, keyValuePair.first, keyValuePair.second), this);
+    }
+    Node<Key, Value>* start = fingerStart(fingerOf(hint), keyValuePair.first);
+    std::pair<Node<Key, Value>*, bool> result =
+        emplaceNodeFrom(start, keyValuePair.first, keyValuePair.second);
+    if (!result.second) {
+        result.first->getValue() = keyValuePair.second;
+    }
+    return iterator(result.first, this);
+}
+
+/**
+* Looks up key searching from finger rather than the root.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::find(iterator finger, const Key& key) const
+{
+    Node<Key, Value>* start = fingerStart(fingerOf(finger), key);
+    Node<Key, Value>* candidate = floorNodeFrom(start, key);
+    BST_STAT(stats_.comparisons += (candidate != NULL);)
+    if (candidate != NULL && !comp_(candidate->getKey(), key)) {
+        return iterator(candidate, this);
+    }
+    return end();
+}
+
+/**
+* Inserts key with the given value, or assigns value to the existing entry.
+* Returns an iterator to the entry and whether a new node was created.
+*/
+template<class Key, class Value, class Compare>
+template<typename V>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::emplace(const Key& key, V&& value)
+{
+    // emplaceNode only consumes value when it creates the node
+    std::pair<Node<Key, Value>*, bool> result =
+        emplaceNode(key, std::forward<V>(value));
+    if (!result.second) {
+        result.first->getValue() = std::forward<V>(value);
+    }
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+template<class Key, class Value, class Compare>
+template<typename V>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::emplace(Key&& key, V&& value)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        emplaceNode(std::move(key), std::forward<V>(value));
+    if (!result.second) {
+        result.first->getValue() = std::forward<V>(value);
+    }
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* Inserts key with a value constructed from args if key is not present.
+* An existing entry is left unchanged and args are not touched.
+*/
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::try_emplace(const Key& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        emplaceNode(key, std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+template<class Key, class Value, class Compare>
+template<typename... Args>
+std::pair<typename BinarySearchTree<Key, Value, Compare>::iterator, bool>
+BinarySearchTree<Key, Value, Compare>::try_emplace(Key&& key, Args&&... args)
+{
+    std::pair<Node<Key, Value>*, bool> result =
+        emplaceNode(std::move(key), std::forward<Args>(args)...);
+    return std::make_pair(iterator(result.first, this), result.second);
+}
+
+/**
+* Searches for key and, only if it is absent, has createLeaf() construct a
+* node in place from the forwarded key and value arguments, links it under
+* the parent found by the search and lets afterInsert() rebalance. Returns
+* the node holding key and whether it was created.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename... Args>
+std::pair<Node<Key, Value>*, bool>
+BinarySearchTree<Key, Value, Compare>::emplaceNode(K&& key, Args&&... valueArgs)
+{
+    return emplaceNodeFrom(root_, std::forward<K>(key), std::forward<Args>(valueArgs)...);
+}
+
+/**
+* emplaceNode with the search starting at start instead of the root. key
+* must belong in start's subtree, see fingerStart().
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename... Args>
+std::pair<Node<Key, Value>*, bool>
+BinarySearchTree<Key, Value, Compare>::emplaceNodeFrom(Node<Key, Value>* start, K&& key, Args&&... valueArgs)
+{
+    Node<Key, Value>* parent = NULL;
+    bool isLeft = false;
+    Node<Key, Value>* existing = findInsertPos(start, key, parent, isLeft);
+    if (existing != NULL) {
+        return std::make_pair(existing, false);
+    }
+    return std::make_pair(attachLeaf(parent, isLeft, std::forward<K>(key),
+                                     std::forward<Args>(valueArgs)...), true);
+}
+
+/**
+* Has createLeaf() build a node from key and valueArgs, links it in as
+* parent's left or right child (or as the root if parent is NULL) and
+* lets afterInsert() rebalance. The slot must be empty and in key order.
+*/
+template<class Key, class Value, class Compare>
+template<typename K, typename... Args>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::attachLeaf(
+    Node<Key, Value>* parent, bool isLeft, K&& key, Args&&... valueArgs)
+{
+    ForwardingItemMaker<Key, Value, K, Args...> maker(std::forward<K>(key),
+                                                      std::forward<Args>(valueArgs)...);
+    Node<Key, Value>* newNode = createLeaf(maker);
+
+    newNode->setParent(parent);
+    if (parent == NULL) {
+        root_ = newNode;
+        rightmost_ = newNode;
+    } else if (isLeft) {
+        parent->setLeft(newNode);
+    } else {
+        parent->setRight(newNode);
+        if (parent == rightmost_) {
+            rightmost_ = newNode;
+        }
+    }
+    afterInsert(newNode);
+    return newNode;
+}
+
+/**
+* Builds an unlinked node for emplaceNode. Trees with their own node type
+* override this to build one of those instead.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::createLeaf(ItemMaker<Key, Value>& maker)
+{
+    return createNode<Node<Key, Value> >(maker);
+}
+
+/**
+* Called on each node emplaceNode links in. The unbalanced tree has nothing
+* to fix up.
+*/
+template<class Key, class Value, class Compare>
+void BinarySearchTree<Key, Value, Compare>::afterInsert(Node<Key, Value>*)
+{
+}
+
+/**
+* Wraps a node in an iterator, for derived trees.
+*/
+template<class Key, class Value, class Compare>
+typename BinarySearchTree<Key, Value, Compare>::iterator
+BinarySearchTree<Key, Value, Compare>::iteratorAt(Node<Key, Value>* node) const
+{
+    return iterator(node, this);
+}
+
+
+/**
+* A remove method to remove a specific key from a Binary Search Tree.
+* Recall: The writeup specifies that if a node has 2 children you
+* should swap with the predecessor and then remove.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::remove(const Key& key)
+{
+    // TODO
+		// If the tree is empty, do nothing
+    if (root_ == nullptr) {
+        return;
+    }
+
+    // Find the node with the specified key
+    Node<Key, Value>* removeNode = internalFind(key);
 
     // If the node with the specified key doesn't exist, do nothing
     if (removeNode == nullptr) {
@@ -541,16 +1494,35 @@ void BinarySearchTree<Key, Value>::remove(const Key& key)
     }
 
     // Delete the node to be removed
-    delete removeNode;
+    destroyNode(removeNode);
 }
 
 
 
-template<class Key, class Value>
+template<class Key, class Value, class Compare>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare>::predecessor(Node<Key, Value>* current)
+{
+    // TODO
+		return predecessorOf(current);
+}
+
+template<class Key, class Value, class Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
+BinarySearchTree<Key, Value, Compare>::successor(Node<Key, Value>* current)
 {
     // TODO
+		return successorOf(current);
+}
+
+/**
+* Returns the in-order predecessor of current, or NULL if there is none.
+*/
+template<class Key, class Value, class Compare>
+template<typename NodeType>
+NodeType*
+BinarySearchTree<Key, Value, Compare>::predecessorOf(NodeType* current)
+{
 		// If the current node is null, return null
     if (current == nullptr) {
         return nullptr;
@@ -558,7 +1530,7 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
     
     // If the current node has a left subtree, find the rightmost node in that subtree
     if (current->getLeft() != nullptr) {
-        Node<Key, Value>* pred = current->getLeft();
+        NodeType* pred = current->getLeft();
 
         while (pred->getRight() != nullptr) {
             pred = pred->getRight();
@@ -569,8 +1541,8 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
 
     // If the current node doesn't have a left subtree, go up the tree until finding a node whose right child is the current node or until reaching the root
     else {
-        Node<Key, Value>* pred = current;
-        Node<Key, Value>* par = pred->getParent();
+        NodeType* pred = current;
+        NodeType* par = pred->getParent();
 
         while (par != nullptr && par->getRight() != pred) {
             pred = par;
@@ -581,11 +1553,14 @@ BinarySearchTree<Key, Value>::predecessor(Node<Key, Value>* current)
     }
 }
 
-template<class Key, class Value>
-Node<Key, Value>*
-BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
+/**
+* Returns the in-order successor of current, or NULL if there is none.
+*/
+template<class Key, class Value, class Compare>
+template<typename NodeType>
+NodeType*
+BinarySearchTree<Key, Value, Compare>::successorOf(NodeType* current)
 {
-    // TODO
 		// If the current node is null, return null
     if (current == nullptr) {
         return nullptr;
@@ -593,7 +1568,7 @@ BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
     
     // If the current node has a right subtree, find the leftmost node in that subtree
     if (current->getRight() != nullptr) {
-        Node<Key, Value>* succ = current->getRight();
+        NodeType* succ = current->getRight();
 
         while (succ->getLeft() != nullptr) {
             succ = succ->getLeft();
@@ -604,8 +1579,8 @@ BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
 
     // If the current node doesn't have a right subtree, go up the tree until finding a node whose left child is the current node or until reaching the root
     else {
-        Node<Key, Value>* succ = current;
-        Node<Key, Value>* par = succ->getParent();
+        NodeType* succ = current;
+        NodeType* par = succ->getParent();
 
         while (par != nullptr && par->getLeft() != succ) {
             succ = par;
@@ -616,37 +1591,526 @@ BinarySearchTree<Key, Value>::successor(Node<Key, Value>* current)
     }
 }
 
+/**
+* Calls visit(node) on every node of the subtree at root, children before
+* parents. The walk follows parent pointers instead of recursing, so it
+* runs in O(n) with O(1) extra memory however deep the tree is. visit may
+* destroy the node it is given.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename Visit>
+void BinarySearchTree<Key, Value, Compare>::forEachPostOrder(NodeType* root, Visit visit)
+{
+    if (root == NULL) {
+        return;
+    }
+
+    // How we arrived at current: from its parent, or back up from a child
+    enum { FROM_PARENT, FROM_LEFT, FROM_RIGHT } from = FROM_PARENT;
+    NodeType* current = root;
+    while (true) {
+        if (from == FROM_PARENT && current->getLeft() != NULL) {
+            current = current->getLeft();
+        }
+        else if (from != FROM_RIGHT && current->getRight() != NULL) {
+            current = current->getRight();
+            from = FROM_PARENT;
+        }
+        else {
+            // Both subtrees are done; work out where to go before visiting
+            if (current == root) {
+                visit(current);
+                return;
+            }
+            NodeType* parent = current->getParent();
+            from = (parent->getLeft() == current) ? FROM_LEFT : FROM_RIGHT;
+            visit(current);
+            current = parent;
+        }
+    }
+}
+
 /**
 * A method to remove all contents of the tree and
 * reset the values in the tree for use again.
+* Node memory goes back to the heap slab by slab; the tree is only
+* walked when the stored items have destructors that must run, or when
+* the slabs are shared with another tree (see AVLTree::split), which then
+* gets the nodes' blocks back for reuse.
 */
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clear()
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::clear()
 {
     // TODO
 
-		clearHelp(root_);
+		if (pool_.shared()) {
+				destroySubtree(root_);
+		}
+		else if (!std::is_trivially_destructible<std::pair<const Key, Value> >::value) {
+				clearHelp(root_);
+		}
+		pool_.release();
 		root_ = NULL;
+		rightmost_ = NULL;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::clearHelp(Node<Key, Value>* current)
+/**
+* Replaces the contents of the tree with the key/value pairs in [first, last),
+* building a perfectly height-balanced tree in O(n) without any per-key
+* descents. Input already ordered by Compare is used as is; otherwise it is
+* sorted first. If a key repeats, the last value wins, as with insert().
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename InputIt>
+void BinarySearchTree<Key, Value, Compare>::assign(InputIt first, InputIt last)
+{
+    std::vector<std::pair<Key, Value> > items;
+    collectSorted(first, last, items);
+    clear();
+    buildSorted(items);
+}
+
+/**
+* Links items into plain Nodes. Trees with their own node type override
+* this to build and annotate those instead.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::buildSorted(std::vector<std::pair<Key, Value> >& items)
+{
+    buildFromSorted<Node<Key, Value> >(items, IgnoreHeights());
+}
+
+/**
+* Copies [first, last) into items, sorted by key with duplicate keys merged
+* (the last value wins). Sorted input costs one O(n) check. Unsorted input
+* is sorted on up to threads threads.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename InputIt>
+void BinarySearchTree<Key, Value, Compare>::collectSorted(
+    InputIt first, InputIt last, std::vector<std::pair<Key, Value> >& items, unsigned threads) const
+{
+    items.assign(first, last);
+
+    bool sorted = true;
+    for (std::size_t i = 1; i < items.size() && sorted; ++i) {
+        sorted = !comp_(items[i].first, items[i - 1].first);
+    }
+    if (!sorted) {
+        sortParallel(items, threads);
+    }
+
+    // Merge runs of equal keys, keeping the value that came last
+    std::size_t out = 0;
+    for (std::size_t i = 0; i < items.size(); ++i) {
+        if (out > 0 && !comp_(items[out - 1].first, items[i].first)) {
+            items[out - 1].second = std::move(items[i].second);
+        }
+        else {
+            if (out != i) {
+                items[out] = std::move(items[i]);
+            }
+            ++out;
+        }
+    }
+    items.erase(items.begin() + out, items.end());
+}
+
+/**
+* Builds root_ from items, which must be sorted and duplicate-free, and
+* whose contents are moved into the new nodes. All nodes are created
+* first, so an exception leaves the tree empty with nothing leaked;
+* linking them is then pure pointer work.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename OnLinked>
+void BinarySearchTree<Key, Value, Compare>::buildFromSorted(
+    std::vector<std::pair<Key, Value> >& items, OnLinked onLinked)
+{
+    std::vector<NodeType*> nodes;
+    createSortedNodes(items, nodes);
+
+    int height = 0;
+    root_ = linkSubtree(nodes, 0, nodes.size(), height, onLinked);
+    rightmost_ = nodes.empty() ? NULL : nodes.back();
+    if (root_ != NULL) {
+        root_->setParent(NULL);
+    }
+}
+
+/**
+* Moves each of items into a new unlinked NodeType, in order. If any
+* allocation or constructor throws, the nodes made so far are destroyed
+* and nodes is left empty.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Compare>::createSortedNodes(
+    std::vector<std::pair<Key, Value> >& items, std::vector<NodeType*>& nodes)
+{
+    nodes.clear();
+    nodes.reserve(items.size());
+    try {
+        for (std::size_t i = 0; i < items.size(); ++i) {
+            nodes.push_back(createNode<NodeType>(std::piecewise_construct,
+                std::forward_as_tuple(std::move(items[i].first)),
+                std::forward_as_tuple(std::move(items[i].second))));
+        }
+    }
+    catch (...) {
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            destroyNode(nodes[i]);
+        }
+        nodes.clear();
+        throw;
+    }
+}
+
+/**
+* Builds the same tree as buildFromSorted, but with the node construction
+* and linking spread over up to threads threads (0 means one per core).
+* Small inputs are built on the calling thread. Each worker allocates from
+* a pool of its own, and the pools are merged into pool_ afterwards. If
+* any node fails to construct, every node is destroyed, the tree is left
+* empty and the first exception is rethrown.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename OnLinked>
+void BinarySearchTree<Key, Value, Compare>::buildFromSortedParallel(
+    std::vector<std::pair<Key, Value> >& items, OnLinked onLinked, unsigned threads)
+{
+    threads = threadCount(threads);
+    if (threads == 1 || items.size() < MIN_PARALLEL_ITEMS) {
+        buildFromSorted<NodeType>(items, onLinked);
+        return;
+    }
+
+    // The smallest depth giving at least one slice per thread
+    int depth = 0;
+    while ((std::size_t(1) << depth) < threads) {
+        ++depth;
+    }
+
+    std::vector<NodeType*> nodes(items.size(), NULL);
+    std::vector<std::size_t> slices;
+    std::vector<std::unique_ptr<NodePool> > pools;
+    std::vector<NodeType*> roots;
+    std::vector<int> heights;
+    try {
+        planSlices(items, nodes, 0, items.size(), depth, slices, pool_);
+        std::size_t count = slices.size() / 2;
+        for (std::size_t i = 0; i < count; ++i) {
+            pools.push_back(std::unique_ptr<NodePool>(new NodePool(pool_.blockSize())));
+        }
+        roots.resize(count, NULL);
+        heights.resize(count, 0);
+
+        runParallel(count, threads, [&](std::size_t i) {
+            std::size_t lo = slices[2 * i];
+            std::size_t hi = slices[2 * i + 1];
+            for (std::size_t j = lo; j < hi; ++j) {
+                nodes[j] = createNodeIn<NodeType>(*pools[i], std::piecewise_construct,
+                    std::forward_as_tuple(std::move(items[j].first)),
+                    std::forward_as_tuple(std::move(items[j].second)));
+            }
+            roots[i] = linkSubtree(nodes, lo, hi, heights[i], onLinked);
+        });
+    }
+    catch (...) {
+        for (std::size_t i = 0; i < pools.size(); ++i) {
+            pool_.absorb(*pools[i]);
+        }
+        for (std::size_t i = 0; i < nodes.size(); ++i) {
+            if (nodes[i] != NULL) {
+                destroyNode(nodes[i]);
+            }
+        }
+        throw;
+    }
+    for (std::size_t i = 0; i < pools.size(); ++i) {
+        pool_.absorb(*pools[i]);
+    }
+
+    std::size_t slice = 0;
+    int height = 0;
+    root_ = linkAboveSlices(nodes, 0, nodes.size(), depth, roots, heights, slice, height, onLinked);
+    rightmost_ = NULL;
+    if (root_ != NULL) {
+        root_->setParent(NULL);
+    }
+}
+
+/**
+* Walks the top depth levels of the linkSubtree recursion over [lo, hi),
+* creating the middle nodes from pool and appending the [lo, hi) bounds of
+* every slice below them to slices.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+void BinarySearchTree<Key, Value, Compare>::planSlices(
+    std::vector<std::pair<Key, Value> >& items, std::vector<NodeType*>& nodes,
+    std::size_t lo, std::size_t hi, int depth, std::vector<std::size_t>& slices, NodePool& pool)
+{
+    if (depth == 0 || lo == hi) {
+        slices.push_back(lo);
+        slices.push_back(hi);
+        return;
+    }
+    std::size_t mid = lo + (hi - lo) / 2;
+    nodes[mid] = createNodeIn<NodeType>(pool, std::piecewise_construct,
+        std::forward_as_tuple(std::move(items[mid].first)),
+        std::forward_as_tuple(std::move(items[mid].second)));
+    planSlices(items, nodes, lo, mid, depth - 1, slices, pool);
+    planSlices(items, nodes, mid + 1, hi, depth - 1, slices, pool);
+}
+
+/**
+* Links the nodes planSlices created on top of the slice roots, in the
+* same order planSlices visited them; slice counts the slices used so far.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename OnLinked>
+NodeType* BinarySearchTree<Key, Value, Compare>::linkAboveSlices(
+    std::vector<NodeType*>& nodes, std::size_t lo, std::size_t hi, int depth,
+    const std::vector<NodeType*>& roots, const std::vector<int>& heights,
+    std::size_t& slice, int& height, OnLinked onLinked)
+{
+    if (depth == 0 || lo == hi) {
+        height = heights[slice];
+        return roots[slice++];
+    }
+
+    std::size_t mid = lo + (hi - lo) / 2;
+    NodeType* node = nodes[mid];
+    int leftHeight = 0;
+    int rightHeight = 0;
+    NodeType* left = linkAboveSlices(nodes, lo, mid, depth - 1, roots, heights, slice, leftHeight, onLinked);
+    NodeType* right = linkAboveSlices(nodes, mid + 1, hi, depth - 1, roots, heights, slice, rightHeight, onLinked);
+
+    node->setLeft(left);
+    node->setRight(right);
+    if (left != NULL) {
+        left->setParent(node);
+    }
+    if (right != NULL) {
+        right->setParent(node);
+    }
+    onLinked(node, leftHeight, rightHeight);
+
+    height = std::max(leftHeight, rightHeight) + 1;
+    return node;
+}
+
+/**
+* Stable-sorts items by key on up to threads threads: equal slices are
+* sorted concurrently, then neighbouring runs are merged pairwise, each
+* round of merges running concurrently too.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::sortParallel(
+    std::vector<std::pair<Key, Value> >& items, unsigned threads) const
+{
+    const Compare& comp = comp_;
+    auto less = [&comp](const std::pair<Key, Value>& a, const std::pair<Key, Value>& b) {
+        return comp(a.first, b.first);
+    };
+    threads = threadCount(threads);
+    if (threads == 1 || items.size() < MIN_PARALLEL_ITEMS) {
+        std::stable_sort(items.begin(), items.end(), less);
+        return;
+    }
+
+    std::size_t n = items.size();
+    std::vector<std::size_t> bounds;
+    for (unsigned i = 0; i <= threads; ++i) {
+        bounds.push_back(n * i / threads);
+    }
+    runParallel(threads, threads, [&](std::size_t i) {
+        std::stable_sort(items.begin() + bounds[i], items.begin() + bounds[i + 1], less);
+    });
+
+    // Merge runs [bounds[i], bounds[i + width]) and [.., bounds[i + 2 * width])
+    for (std::size_t width = 1; width < threads; width *= 2) {
+        std::size_t merges = (threads + 2 * width - 1) / (2 * width);
+        runParallel(merges, threads, [&](std::size_t m) {
+            std::size_t lo = m * 2 * width;
+            std::size_t mid = std::min<std::size_t>(lo + width, threads);
+            std::size_t hi = std::min<std::size_t>(lo + 2 * width, threads);
+            std::inplace_merge(items.begin() + bounds[lo], items.begin() + bounds[mid],
+                               items.begin() + bounds[hi], less);
+        });
+    }
+}
+
+/**
+* Runs task(0) .. task(tasks - 1) on up to threads threads, the calling
+* thread included, and returns once all are done. If a thread cannot be
+* started its share runs on the calling thread. The first exception thrown
+* by a task is rethrown after every thread has finished.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename Task>
+void BinarySearchTree<Key, Value, Compare>::runParallel(std::size_t tasks, unsigned threads, Task task)
+{
+    std::size_t workers = std::min<std::size_t>(tasks, threads);
+    std::vector<std::exception_ptr> errors(workers);
+    auto work = [&](std::size_t w) {
+        try {
+            for (std::size_t i = w; i < tasks; i += workers) {
+                task(i);
+            }
+        }
+        catch (...) {
+            errors[w] = std::current_exception();
+        }
+    };
+
+    std::vector<std::thread> pool;
+    std::vector<std::size_t> inlineWork;
+    for (std::size_t w = 1; w < workers; ++w) {
+        try {
+            pool.push_back(std::thread(work, w));
+        }
+        catch (...) {
+            inlineWork.push_back(w);
+        }
+    }
+    if (workers > 0) {
+        work(0);
+    }
+    for (std::size_t i = 0; i < inlineWork.size(); ++i) {
+        work(inlineWork[i]);
+    }
+    for (std::size_t i = 0; i < pool.size(); ++i) {
+        pool[i].join();
+    }
+    for (std::size_t w = 0; w < workers; ++w) {
+        if (errors[w]) {
+            std::rethrow_exception(errors[w]);
+        }
+    }
+}
+
+/**
+* Resolves a requested thread count: 0 means one per core.
+*/
+template<typename Key, typename Value, typename Compare>
+unsigned BinarySearchTree<Key, Value, Compare>::threadCount(unsigned threads)
+{
+    if (threads == 0) {
+        threads = std::thread::hardware_concurrency();
+    }
+    return threads == 0 ? 1 : threads;
+}
+
+/**
+* Links nodes[lo, hi) into a subtree rooted at the middle element and
+* returns its root; height receives the subtree height. Splitting at the
+* middle keeps the two sides within one node of each other, so every
+* subtree is height-balanced.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename OnLinked>
+NodeType* BinarySearchTree<Key, Value, Compare>::linkSubtree(
+    std::vector<NodeType*>& nodes, std::size_t lo, std::size_t hi, int& height, OnLinked onLinked)
+{
+    if (lo == hi) {
+        height = 0;
+        return NULL;
+    }
+
+    std::size_t mid = lo + (hi - lo) / 2;
+    NodeType* node = nodes[mid];
+    int leftHeight = 0;
+    int rightHeight = 0;
+    NodeType* left = linkSubtree(nodes, lo, mid, leftHeight, onLinked);
+    NodeType* right = linkSubtree(nodes, mid + 1, hi, rightHeight, onLinked);
+
+    node->setLeft(left);
+    node->setRight(right);
+    if (left != NULL) {
+        left->setParent(node);
+    }
+    if (right != NULL) {
+        right->setParent(node);
+    }
+    onLinked(node, leftHeight, rightHeight);
+
+    height = std::max(leftHeight, rightHeight) + 1;
+    return node;
+}
+
+/**
+* Runs the destructor of every node in the subtree without freeing
+* their storage, which clear() releases in bulk afterwards.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::clearHelp(Node<Key, Value>* current)
 {
 		if (current == NULL) {
 			return;
 		}
 		
-		clearHelp(current->getLeft());
-		clearHelp(current->getRight());
-		delete current;
+		forEachPostOrder(current, [](Node<Key, Value>* node) { node->~Node(); });
+}
+
+/**
+* Allocates a node of the given type from the pool and constructs it from
+* args with no parent or children.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename... Args>
+NodeType* BinarySearchTree<Key, Value, Compare>::createNode(Args&&... args)
+{
+    return createNodeIn<NodeType>(pool_, std::forward<Args>(args)...);
+}
+
+/**
+* Same as createNode, but allocates from the given pool, which must end up
+* shared with or absorbed into pool_ before the node is destroyed.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename... Args>
+NodeType* BinarySearchTree<Key, Value, Compare>::createNodeIn(NodePool& pool, Args&&... args)
+{
+    void* mem = pool.allocate();
+    try {
+        return new (mem) NodeType(std::forward<Args>(args)..., NULL);
+    }
+    catch (...) {
+        pool.deallocate(mem);
+        throw;
+    }
+}
+
+/**
+* Destroys every node in a detached subtree and returns their storage to the pool.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::destroySubtree(Node<Key, Value>* root)
+{
+    forEachPostOrder(root, [this](Node<Key, Value>* node) { destroyNode(node); });
+}
+
+/**
+* Destroys a single node and returns its storage to the pool.
+*/
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::destroyNode(Node<Key, Value>* node)
+{
+    if (node == rightmost_) {
+        rightmost_ = NULL;
+    }
+    node->~Node();
+    pool_.deallocate(node);
 }
 
 /**
 * A helper function to find the smallest node in the tree.
 */
-template<typename Key, typename Value>
+template<typename Key, typename Value, typename Compare>
 Node<Key, Value>*
-BinarySearchTree<Key, Value>::getSmallestNode() const
+BinarySearchTree<Key, Value, Compare>::getSmallestNode() const
 {
     // TODO
 		// If the root is null, return null
@@ -671,106 +2135,475 @@ BinarySearchTree<Key, Value>::getSmallestNode() const
     }
 }
 
+/**
+* Returns the node with the largest key, or NULL if the tree is empty.
+*/
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>*
+BinarySearchTree<Key, Value, Compare>::getLargestNode() const
+{
+    Node<Key, Value>* largest = root_;
+    if (largest == NULL) {
+        return NULL;
+    }
+    while (largest->getRight() != NULL) {
+        largest = largest->getRight();
+    }
+    return largest;
+}
+
 /**
 * Helper function to find a node with given key, k and
 * return a pointer to it or NULL if no item with that key
 * exists
 */
-template<typename Key, typename Value>
-Node<Key, Value>* BinarySearchTree<Key, Value>::internalFind(const Key& key) const
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::internalFind(const Key& key) const
 {
     // TODO
-		// If the root is null, return null
-    if (root_ == nullptr) {
-        return nullptr;
+		return findNode<Node<Key, Value> >(key);
+}
+
+/**
+* internalFind for a tree whose nodes are all of type NodeType.
+* Makes one Compare call per level: the walk remembers the last node
+* whose key is not greater than the target, and a single extra call at
+* the bottom decides whether that node is a match.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename K>
+NodeType* BinarySearchTree<Key, Value, Compare>::findNode(const K& key) const
+{
+    NodeType* candidate = floorNode<NodeType>(key);
+    BST_STAT(stats_.comparisons += (candidate != NULL);)
+    if (candidate != NULL && !comp_(candidate->getKey(), key)) {
+        return candidate;
+    }
+    return NULL;
+}
+
+/**
+* Returns the node with the greatest key not greater than key, or NULL.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename K>
+NodeType* BinarySearchTree<Key, Value, Compare>::floorNode(const K& key) const
+{
+    return floorNodeFrom(static_cast<NodeType*>(root_), key);
+}
+
+/**
+* floorNode limited to the subtree at start. Returns NULL if every key
+* there is greater than key.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename K>
+NodeType* BinarySearchTree<Key, Value, Compare>::floorNodeFrom(NodeType* start, const K& key) const
+{
+    NodeType* candidate = NULL;
+    NodeType* temp = start;
+    BST_STAT(std::size_t depth = 0;)
+    while (temp != NULL) {
+        BST_STAT(++depth;)
+        if (comp_(key, temp->getKey())) {
+            temp = temp->getLeft();
+        } else {
+            candidate = temp;
+            temp = temp->getRight();
+        }
     }
+    BST_STAT(stats_.recordDescent(depth);)
+    return candidate;
+}
+
+/**
+* Returns the node with the smallest key not less than key (or, if upper,
+* greater than key), or NULL. One Compare call per level.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename K>
+NodeType* BinarySearchTree<Key, Value, Compare>::boundNode(const K& key, bool upper) const
+{
+    NodeType* candidate = NULL;
+    NodeType* temp = static_cast<NodeType*>(root_);
+    BST_STAT(std::size_t depth = 0;)
+    while (temp != NULL) {
+        BST_STAT(++depth;)
+        bool goLeft = upper ? comp_(key, temp->getKey()) : !comp_(temp->getKey(), key);
+        if (goLeft) {
+            candidate = temp;
+            temp = temp->getLeft();
+        } else {
+            temp = temp->getRight();
+        }
+    }
+    BST_STAT(stats_.recordDescent(depth);)
+    return candidate;
+}
 
-    // Start from the root and traverse the tree until finding the node with the specified key or reaching a null node
-    Node<Key, Value>* temp = root_;
-    while (temp != nullptr) {
-        if (key == temp->getKey()) {
-            return temp;
-        } else if (key < temp->getKey()) {
+/**
+* Finds where key belongs in the subtree at start with the same
+* single-comparison walk as findNode. key must belong in that subtree (it
+* always does at the root, see fingerStart() otherwise). Returns the node
+* holding key if there is one; otherwise returns NULL and sets
+* parent/isLeft to the attach point for a new node (parent is NULL for an
+* empty tree).
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType>
+NodeType* BinarySearchTree<Key, Value, Compare>::findInsertPos(
+    NodeType* start, const Key& key, NodeType*& parent, bool& isLeft) const
+{
+    NodeType* candidate = NULL;
+    NodeType* temp = start;
+    parent = NULL;
+    isLeft = false;
+    BST_STAT(std::size_t depth = 0;)
+    while (temp != NULL) {
+        BST_STAT(++depth;)
+        parent = temp;
+        isLeft = comp_(key, temp->getKey());
+        if (isLeft) {
             temp = temp->getLeft();
         } else {
+            candidate = temp;
             temp = temp->getRight();
         }
     }
+    BST_STAT(stats_.recordDescent(depth);)
+    BST_STAT(stats_.comparisons += (candidate != NULL);)
+
+    if (candidate != NULL && !comp_(candidate->getKey(), key)) {
+        return candidate;
+    }
+    return NULL;
+}
+
+/**
+* Returns the node a search for key should start from instead of the root:
+* the lowest ancestor of finger (or finger itself) whose subtree spans
+* key. A subtree's keys all lie between the nearest ancestors it hangs
+* to the right and to the left of, so the walk climbs while key is beyond
+* one of those bounds. The climb costs one comparison per bound passed,
+* which is O(log d) in a balanced tree for a key d entries from finger,
+* plus pointer steps up runs of same-side links. finger may be NULL only
+* if the tree is empty.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename K>
+NodeType* BinarySearchTree<Key, Value, Compare>::fingerStart(NodeType* finger, const K& key) const
+{
+    NodeType* current = finger;
+    if (current == NULL) {
+        return NULL;
+    }
+    BST_STAT(++stats_.comparisons;)
+    if (comp_(key, current->getKey())) {
+        while (true) {
+            // The lower bound is the parent above the run of left links
+            NodeType* up = current;
+            while (up->getParent() != NULL && up->getParent()->getLeft() == up) {
+                up = up->getParent();
+            }
+            NodeType* bound = up->getParent();
+            BST_STAT(stats_.comparisons += (bound != NULL);)
+            if (bound == NULL || comp_(bound->getKey(), key)) {
+                return current;
+            }
+            // key <= bound: bound's subtree spans key, and holds it if equal
+            current = bound;
+            BST_STAT(++stats_.comparisons;)
+            if (!comp_(key, current->getKey())) {
+                return current;
+            }
+        }
+    }
+    BST_STAT(++stats_.comparisons;)
+    if (comp_(current->getKey(), key)) {
+        while (true) {
+            // The upper bound is the parent above the run of right links
+            NodeType* up = current;
+            while (up->getParent() != NULL && up->getParent()->getRight() == up) {
+                up = up->getParent();
+            }
+            NodeType* bound = up->getParent();
+            BST_STAT(stats_.comparisons += (bound != NULL);)
+            if (bound == NULL || comp_(key, bound->getKey())) {
+                return current;
+            }
+            current = bound;
+            BST_STAT(++stats_.comparisons;)
+            if (!comp_(current->getKey(), key)) {
+                return current;
+            }
+        }
+    }
+    return current;
+}
+
+/**
+* The node an iterator points at, with end() standing for the largest
+* entry.
+*/
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::fingerOf(const iterator& hint) const
+{
+    if (hint.current_ != NULL) {
+        return hint.current_;
+    }
+    return (rightmost_ != NULL) ? rightmost_ : getLargestNode();
+}
+
+/**
+* Finds an empty slot for key without a search when it can: past the
+* largest entry, or, as with std::map's hinted insert, between hint (NULL
+* for end()) and its neighbor on key's side. The new node goes under
+* whichever of the two has that side free. Returns false if key is
+* present or lies elsewhere, leaving it to fingerStart. A key past the
+* largest costs one comparison; one next to the hint costs three plus a
+* step to the neighbor.
+*/
+template<typename Key, typename Value, typename Compare>
+bool BinarySearchTree<Key, Value, Compare>::hintSlot(
+    Node<Key, Value>* hint, const Key& key, Node<Key, Value>*& parent, bool& isLeft)
+{
+    Node<Key, Value>* last = largestNode();
+    if (last == NULL) {
+        return false;
+    }
+    BST_STAT(++stats_.comparisons;)
+    if (comp_(last->getKey(), key)) {
+        parent = last;
+        isLeft = false;
+        return true;
+    }
+    if (hint == NULL) {
+        return false;
+    }
+    BST_STAT(++stats_.comparisons;)
+    if (comp_(hint->getKey(), key)) {
+        // key is not past last, so hint has a successor
+        Node<Key, Value>* next = successor(hint);
+        BST_STAT(++stats_.comparisons;)
+        if (!comp_(key, next->getKey())) {
+            return false;
+        }
+        isLeft = (hint->getRight() != NULL);
+        parent = isLeft ? next : hint;
+        return true;
+    }
+    BST_STAT(++stats_.comparisons;)
+    if (comp_(key, hint->getKey())) {
+        Node<Key, Value>* prev = predecessor(hint);
+        BST_STAT(stats_.comparisons += (prev != NULL);)
+        if (prev != NULL && !comp_(prev->getKey(), key)) {
+            return false;
+        }
+        isLeft = (hint->getLeft() == NULL);
+        parent = isLeft ? hint : prev;
+        return true;
+    }
+    return false;
+}
 
-    // Return the last visited node (either the node with the specified key or the null node)
-    return temp;
+/**
+* The node with the largest key, looked up once and then kept in
+* rightmost_ until the tree changes under it.
+*/
+template<typename Key, typename Value, typename Compare>
+Node<Key, Value>* BinarySearchTree<Key, Value, Compare>::largestNode()
+{
+    if (rightmost_ == NULL) {
+        rightmost_ = getLargestNode();
+    }
+    return rightmost_;
 }
 
 /**
- * Return true iff the BST is balanced.
+ * Return true iff the BST is balanced and, in a tree that stores balance
+ * factors, every stored factor is right.
  */
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::isBalanced() const
+template<typename Key, typename Value, typename Compare>
+bool BinarySearchTree<Key, Value, Compare>::isBalanced() const
 {
     // TODO
 
-		return balanceHelp(root_);
+		BalanceReport report = balanceReport();
+		return report.balanced && report.balanceMismatches == 0;
 }
 
-template<typename Key, typename Value>
-bool BinarySearchTree<Key, Value>::balanceHelp(Node<Key, Value>* current) const
+/**
+ * Checks the balance of every node in one O(n) post-order pass, reporting
+ * the tree height and the first node whose subtrees differ in height by
+ * more than one. Trees that store balance factors override it to check
+ * those too.
+ */
+template<typename Key, typename Value, typename Compare>
+typename BinarySearchTree<Key, Value, Compare>::BalanceReport
+BinarySearchTree<Key, Value, Compare>::balanceReport() const
 {
-    // TODO
-		// If the current node is null, return true
-    if (current == nullptr) {
-        return true;
-    } else {
-        // Get the left and right children of the current node
-        Node<Key, Value>* leftNode = current->getLeft();
-        Node<Key, Value>* rightNode = current->getRight();
+    return makeBalanceReport<Node<Key, Value> >(NoStoredBalance());
+}
 
-        // Get the height of the left and right subtrees
-        int leftHeight = getHeight(leftNode);
-        int rightHeight = getHeight(rightNode);
+/**
+ * Returns a read-only copy of the tree in a contiguous, cache-friendly
+ * layout (see FrozenTree), built in O(n) from an in-order walk. Later
+ * changes to this tree do not affect it.
+ */
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare> BinarySearchTree<Key, Value, Compare>::freeze() const
+{
+    return FrozenTree<Key, Value, Compare>(begin(), end(), comp_);
+}
 
-        // Check if the difference in heights is greater than 1
-        if (leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1) {
-            return false;
+/**
+ * Returns a snapshot of the hot-path counters (see TreeStats). Without
+ * BST_STATS every counter is 0.
+ */
+template<typename Key, typename Value, typename Compare>
+TreeStats BinarySearchTree<Key, Value, Compare>::stats() const
+{
+#ifdef BST_STATS
+    return stats_;
+#else
+    return TreeStats();
+#endif
+}
+
+/**
+ * Sets every counter back to 0.
+ */
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::resetStats()
+{
+#ifdef BST_STATS
+    stats_.reset();
+#endif
+}
+
+/**
+ * Runs the balance pass over a tree of NodeType. checkStored(node, actual)
+ * says whether the node's stored balance (if it keeps one) matches the
+ * actual right-minus-left height difference.
+ */
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename CheckStored>
+typename BinarySearchTree<Key, Value, Compare>::BalanceReport
+BinarySearchTree<Key, Value, Compare>::makeBalanceReport(CheckStored checkStored) const
+{
+    BalanceReport report;
+    report.balanced = true;
+    report.nodes = 0;
+    report.firstUnbalanced = NULL;
+    report.balanceMismatches = 0;
+    report.firstMismatch = NULL;
+    report.height = balanceHelp(static_cast<NodeType*>(root_), report, checkStored);
+    return report;
+}
+
+/**
+ * Returns the height of the subtree at root, recording any violations
+ * in report. Each node's height is computed once, from its children's,
+ * which wait on an explicit stack rather than the call stack.
+ */
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename CheckStored>
+int BinarySearchTree<Key, Value, Compare>::balanceHelp(
+    NodeType* root, BalanceReport& report, CheckStored checkStored) const
+{
+    // Heights of finished subtrees whose parent is not finished yet
+    std::vector<int> heights;
+    forEachPostOrder(root, [&](NodeType* current) {
+        int rightHeight = 0;
+        int leftHeight = 0;
+        if (current->getRight() != NULL) {
+            rightHeight = heights.back();
+            heights.pop_back();
         }
+        if (current->getLeft() != NULL) {
+            leftHeight = heights.back();
+            heights.pop_back();
+        }
+        heights.push_back(checkNode(current, leftHeight, rightHeight, report, checkStored));
+    });
+    return heights.empty() ? 0 : heights.back();
+}
 
-        // Recursively check if the subtrees are balanced
-        // If all nodes are balanced, return true
-        return (balanceHelp(leftNode) && balanceHelp(rightNode));
+/**
+ * Records any violations at current, given its subtree heights, and
+ * returns its own height.
+ */
+template<typename Key, typename Value, typename Compare>
+template<typename NodeType, typename CheckStored>
+int BinarySearchTree<Key, Value, Compare>::checkNode(NodeType* current,
+    int leftHeight, int rightHeight, BalanceReport& report, CheckStored& checkStored)
+{
+    ++report.nodes;
+
+    // Check if the difference in heights is greater than 1
+    if (leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1) {
+        if (report.balanced) {
+            report.firstUnbalanced = current;
+        }
+        report.balanced = false;
+    }
+    if (!checkStored(current, rightHeight - leftHeight)) {
+        if (report.balanceMismatches == 0) {
+            report.firstMismatch = current;
+        }
+        ++report.balanceMismatches;
     }
+
+    return std::max(leftHeight, rightHeight) + 1;
 }
 
+/**
+ * Returns the height of the subtree at current. Walks the tree through
+ * parent pointers, so it uses O(1) extra memory however deep the tree is.
+ */
 template<typename Key, typename Value>
 int getHeight(Node<Key, Value>* current) {
-		int counter;
 		if (current == NULL) {
 				return 0;
 		}
-		else {
-				counter = 1;
-		}
-
-		Node<Key, Value>* leftNode = current->getLeft();
-		Node<Key, Value>* rightNode = current->getRight();
-
-		int leftHeight = getHeight(leftNode);
-		int rightHeight = getHeight(rightNode);
 
-		if (leftHeight >= rightHeight) {
-				counter += leftHeight;
+		Node<Key, Value>* root = current;
+		Node<Key, Value>* from = current->getParent();
+		int depth = 1;
+		int height = 1;
+		while (true) {
+				Node<Key, Value>* next;
+				if (from == current->getParent() && current->getLeft() != NULL) {
+						next = current->getLeft();
+				}
+				else if (from != current->getRight() && current->getRight() != NULL) {
+						next = current->getRight();
+				}
+				else if (current == root) {
+						return height;
+				}
+				else {
+						from = current;
+						current = current->getParent();
+						--depth;
+						continue;
+				}
+				from = current;
+				current = next;
+				++depth;
+				if (depth > height) {
+						height = depth;
+				}
 		}
-		else {
-				counter += rightHeight;
-		}
-		
-		return counter;
 }
 
-template<typename Key, typename Value>
-void BinarySearchTree<Key, Value>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
+template<typename Key, typename Value, typename Compare>
+void BinarySearchTree<Key, Value, Compare>::nodeSwap( Node<Key,Value>* n1, Node<Key,Value>* n2)
 {
     if((n1 == n2) || (n1 == NULL) || (n2 == NULL) ) {
         return;
     }
+    BST_STAT(++stats_.nodeSwaps;)
     Node<Key, Value>* n1p = n1->getParent();
     Node<Key, Value>* n1r = n1->getRight();
     Node<Key, Value>* n1lt = n1->getLeft();
@@ -0,0 +1,1032 @@
+#ifndef BTREE_H
+#define BTREE_H
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <type_traits>
+#include <utility>
+#include "node_pool.h"
+
+/**
+ * An ordered map stored as a B+-tree, with the same insert/remove/find/
+ * operator[]/iterator surface as BinarySearchTree so the two can be
+ * swapped and compared.
+ *
+ * A binary node holds one key per cache line, so a lookup costs about
+ * log2(n) cache misses. Here every node is sized to about NodeBytes
+ * bytes (256 by default, so four cache lines) and holds as many keys as
+ * fit: inner nodes hold only separator keys and child pointers, and the
+ * items live in the leaves, which are linked in key order for iteration.
+ * A lookup touches log_B(n) nodes for a fan-out of B.
+ *
+ * Within a node, arithmetic keys ordered by std::less are searched with a
+ * branchless count over the whole node, which the compiler vectorizes;
+ * other keys use a binary search.
+ *
+ * Leaves and inner nodes come from two NodePools, like the nodes of the
+ * binary trees. Items stay put in their leaf until that leaf is split,
+ * merged or rebalanced, so iterators are invalidated by any insert or
+ * remove.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key>, std::size_t NodeBytes = 256>
+class BTree
+{
+public:
+    BTree();
+    explicit BTree(const Compare& comp);
+    ~BTree();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    std::size_t size() const;
+
+protected:
+    struct Leaf;
+public:
+    /**
+    * A bidirectional iterator over the items in key order. Stepping moves
+    * along a leaf and then to the next leaf through its sibling link, O(1)
+    * per step. Decrementing end() moves to the largest item.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        std::pair<const Key, Value>& operator*() const;
+        std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class BTree<Key, Value, Compare, NodeBytes>;
+        iterator(Leaf* leaf, unsigned index, const BTree<Key, Value, Compare, NodeBytes>* tree);
+
+        Leaf* leaf_;      // NULL for end()
+        unsigned index_;
+        const BTree<Key, Value, Compare, NodeBytes>* tree_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+
+protected:
+    typedef std::pair<const Key, Value> Item;
+
+    // Slots per node, from NodeBytes less the node header; at least 3 so
+    // that a split always leaves both halves non-empty
+    static const std::size_t LEAF_FIT = (NodeBytes - 3 * sizeof(void*)) / sizeof(Item);
+    static const unsigned LEAF_SLOTS = LEAF_FIT < 3 ? 3 : static_cast<unsigned>(LEAF_FIT);
+    static const std::size_t INNER_FIT = (NodeBytes - 2 * sizeof(void*)) / (sizeof(Key) + sizeof(void*));
+    static const unsigned INNER_SLOTS = INNER_FIT < 3 ? 3 : static_cast<unsigned>(INNER_FIT);
+    // Fewest items/keys a non-root node may hold
+    static const unsigned LEAF_MIN = LEAF_SLOTS / 2;
+    static const unsigned INNER_MIN = INNER_SLOTS / 2;
+    // With at least two children per inner node this bounds any real tree
+    static const int MAX_HEIGHT = 64;
+
+    // Items are constructed in place in raw slots [0, count)
+    struct Leaf
+    {
+        unsigned count;
+        Leaf* prev;
+        Leaf* next;
+        typename std::aligned_storage<sizeof(Item), alignof(Item)>::type slots[LEAF_SLOTS];
+
+        Item& item(unsigned i) { return *reinterpret_cast<Item*>(&slots[i]); }
+        const Key& key(unsigned i) const { return reinterpret_cast<const Item*>(&slots[i])->first; }
+    };
+
+    // Child i holds the keys k with key(i - 1) <= k < key(i)
+    struct Inner
+    {
+        unsigned count;  // number of keys; there are count + 1 children
+        typename std::aligned_storage<sizeof(Key), alignof(Key)>::type slots[INNER_SLOTS];
+        void* children[INNER_SLOTS + 1];
+
+        Key& key(unsigned i) { return *reinterpret_cast<Key*>(&slots[i]); }
+        const Key& key(unsigned i) const { return *reinterpret_cast<const Key*>(&slots[i]); }
+    };
+
+    // How keys are searched within a node
+    struct ScanSearch { };
+    struct BinarySearch { };
+    typedef typename std::conditional<std::is_arithmetic<Key>::value &&
+                                      std::is_same<Compare, std::less<Key> >::value,
+                                      ScanSearch, BinarySearch>::type NodeSearch;
+
+    template<typename NodeType>
+    unsigned rankIn(const NodeType* node, const Key& key, bool upper) const;
+    template<typename NodeType>
+    unsigned rankIn(const NodeType* node, const Key& key, bool upper, ScanSearch) const;
+    template<typename NodeType>
+    unsigned rankIn(const NodeType* node, const Key& key, bool upper, BinarySearch) const;
+    Leaf* findLeaf(const Key& key, Inner** path, unsigned* indices) const;
+    iterator bound(const Key& key, bool upper) const;
+    Leaf* firstLeaf() const;
+    Leaf* lastLeaf() const;
+
+    // Node storage and slot shuffling
+    Leaf* createLeaf();
+    Inner* createInner();
+    void destroyLeaf(Leaf* leaf);
+    void destroyInner(Inner* inner);
+    void destroySubtree(void* node, int height);
+    static void moveItem(Leaf* from, unsigned i, Leaf* to, unsigned j);
+    static void moveKey(Inner* from, unsigned i, Inner* to, unsigned j);
+    static void insertItem(Leaf* leaf, unsigned pos, Item& item);
+    static void eraseItem(Leaf* leaf, unsigned pos);
+    static void insertKey(Inner* inner, unsigned pos, Key& key, void* right);
+    static void eraseKey(Inner* inner, unsigned pos);
+
+    // Structural changes
+    void splitLeaf(Leaf* leaf, unsigned pos, Item& item, Leaf* right);
+    void splitInner(Inner* inner, unsigned pos, Key& key, void* child, Inner* right, Key& up);
+    void fixLeaf(Leaf* leaf, Inner** path, unsigned* indices, int depth);
+    void fixInner(Inner* inner, Inner** path, unsigned* indices, int depth);
+
+private:
+    // Not copyable, like the node pools it owns
+    BTree(const BTree&);
+    BTree& operator=(const BTree&);
+
+protected:
+    void* root_;
+    int height_;        // levels, 1 when the root is a leaf, 0 when empty
+    std::size_t size_;
+    NodePool leafPool_;
+    NodePool innerPool_;
+    Compare comp_;
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the BTree::iterator class.
+  -----------------------------------------------------
+*/
+
+/**
+* Creates an iterator that compares equal to no valid position.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BTree<Key, Value, Compare, NodeBytes>::iterator::iterator() :
+    leaf_(NULL),
+    index_(0),
+    tree_(NULL)
+{
+}
+
+/**
+* Creates an iterator at slot index of leaf (NULL for end()).
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BTree<Key, Value, Compare, NodeBytes>::iterator::iterator(
+    Leaf* leaf, unsigned index, const BTree<Key, Value, Compare, NodeBytes>* tree) :
+    leaf_(leaf),
+    index_(index),
+    tree_(tree)
+{
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+std::pair<const Key, Value>& BTree<Key, Value, Compare, NodeBytes>::iterator::operator*() const
+{
+    return leaf_->item(index_);
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+std::pair<const Key, Value>* BTree<Key, Value, Compare, NodeBytes>::iterator::operator->() const
+{
+    return &(leaf_->item(index_));
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+bool BTree<Key, Value, Compare, NodeBytes>::iterator::operator==(const iterator& rhs) const
+{
+    return leaf_ == rhs.leaf_ && index_ == rhs.index_;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+bool BTree<Key, Value, Compare, NodeBytes>::iterator::operator!=(const iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Advances to the next item, moving on to the next leaf at the end of this one.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::iterator&
+BTree<Key, Value, Compare, NodeBytes>::iterator::operator++()
+{
+    if (++index_ == leaf_->count) {
+        leaf_ = leaf_->next;
+        index_ = 0;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::iterator
+BTree<Key, Value, Compare, NodeBytes>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Steps back to the previous item; from end() this is the largest item.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::iterator&
+BTree<Key, Value, Compare, NodeBytes>::iterator::operator--()
+{
+    if (leaf_ == NULL) {
+        leaf_ = tree_->lastLeaf();
+        index_ = leaf_->count - 1;
+    }
+    else if (index_ == 0) {
+        leaf_ = leaf_->prev;
+        index_ = leaf_->count - 1;
+    }
+    else {
+        --index_;
+    }
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::iterator
+BTree<Key, Value, Compare, NodeBytes>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the BTree::iterator class.
+  -----------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the BTree class.
+  -----------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BTree<Key, Value, Compare, NodeBytes>::BTree() :
+    root_(NULL),
+    height_(0),
+    size_(0),
+    leafPool_(sizeof(Leaf)),
+    innerPool_(sizeof(Inner)),
+    comp_()
+{
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BTree<Key, Value, Compare, NodeBytes>::BTree(const Compare& comp) :
+    root_(NULL),
+    height_(0),
+    size_(0),
+    leafPool_(sizeof(Leaf)),
+    innerPool_(sizeof(Inner)),
+    comp_(comp)
+{
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+BTree<Key, Value, Compare, NodeBytes>::~BTree()
+{
+    clear();
+}
+
+/**
+* Destroys every item and gives all nodes back to the pools.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::clear()
+{
+    if (!std::is_trivially_destructible<Item>::value || !std::is_trivially_destructible<Key>::value) {
+        destroySubtree(root_, height_);
+    }
+    leafPool_.release();
+    innerPool_.release();
+    root_ = NULL;
+    height_ = 0;
+    size_ = 0;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+bool BTree<Key, Value, Compare, NodeBytes>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+std::size_t BTree<Key, Value, Compare, NodeBytes>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::iterator
+BTree<Key, Value, Compare, NodeBytes>::begin() const
+{
+    return iterator(firstLeaf(), 0, this);
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::iterator
+BTree<Key, Value, Compare, NodeBytes>::end() const
+{
+    return iterator(NULL, 0, this);
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::iterator
+BTree<Key, Value, Compare, NodeBytes>::find(const Key& key) const
+{
+    Leaf* leaf = findLeaf(key, NULL, NULL);
+    if (leaf == NULL) {
+        return end();
+    }
+    unsigned pos = rankIn(leaf, key, false);
+    if (pos == leaf->count || comp_(key, leaf->key(pos))) {
+        return end();
+    }
+    return iterator(leaf, pos, this);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+Value& BTree<Key, Value, Compare, NodeBytes>::operator[](const Key& key)
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+Value const & BTree<Key, Value, Compare, NodeBytes>::operator[](const Key& key) const
+{
+    iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::iterator
+BTree<Key, Value, Compare, NodeBytes>::lower_bound(const Key& key) const
+{
+    return bound(key, false);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or end() if there is none.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::iterator
+BTree<Key, Value, Compare, NodeBytes>::upper_bound(const Key& key) const
+{
+    return bound(key, true);
+}
+
+/**
+* Inserts the key/value pair, or overwrites the value if the key is
+* already present. A full leaf is split in two and the separator is
+* pushed into the parent, splitting full parents in turn; the tree only
+* grows taller when the root splits. Every node a split will need is
+* allocated before anything is changed, so a failed allocation leaves
+* the tree as it was.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    if (root_ == NULL) {
+        Leaf* leaf = createLeaf();
+        try {
+            new (&leaf->slots[0]) Item(keyValuePair);
+        }
+        catch (...) {
+            destroyLeaf(leaf);
+            throw;
+        }
+        leaf->count = 1;
+        root_ = leaf;
+        height_ = 1;
+        size_ = 1;
+        return;
+    }
+
+    Inner* path[MAX_HEIGHT];
+    unsigned indices[MAX_HEIGHT];
+    Leaf* leaf = findLeaf(keyValuePair.first, path, indices);
+    unsigned pos = rankIn(leaf, keyValuePair.first, false);
+    if (pos < leaf->count && !comp_(keyValuePair.first, leaf->key(pos))) {
+        leaf->item(pos).second = keyValuePair.second;
+        return;
+    }
+
+    Item item(keyValuePair);
+    if (leaf->count < LEAF_SLOTS) {
+        insertItem(leaf, pos, item);
+        ++size_;
+        return;
+    }
+
+    // Full inner nodes directly above the leaf split too, and a new root is
+    // needed if every level splits
+    int splits = 0;
+    while (splits < height_ - 1 && path[height_ - 2 - splits]->count == INNER_SLOTS) {
+        ++splits;
+    }
+    bool newRoot = (splits == height_ - 1);
+    Leaf* rightLeaf = createLeaf();
+    Inner* spare[MAX_HEIGHT + 1];
+    int created = 0;
+    try {
+        while (created < splits + (newRoot ? 1 : 0)) {
+            spare[created] = createInner();
+            ++created;
+        }
+    }
+    catch (...) {
+        while (created > 0) {
+            destroyInner(spare[--created]);
+        }
+        destroyLeaf(rightLeaf);
+        throw;
+    }
+
+    splitLeaf(leaf, pos, item, rightLeaf);
+    ++size_;
+    Key up(rightLeaf->key(0));
+    void* right = rightLeaf;
+    for (int depth = height_ - 2, used = 0; depth >= 0; --depth) {
+        Inner* parent = path[depth];
+        if (parent->count < INNER_SLOTS) {
+            insertKey(parent, indices[depth], up, right);
+            return;
+        }
+        Inner* sibling = spare[used++];
+        Key next(std::move(up));
+        splitInner(parent, indices[depth], next, right, sibling, up);
+        right = sibling;
+    }
+
+    Inner* root = spare[created - 1];
+    new (&root->slots[0]) Key(std::move(up));
+    root->count = 1;
+    root->children[0] = root_;
+    root->children[1] = right;
+    root_ = root;
+    ++height_;
+}
+
+/**
+* Removes the item with the given key, if any. A leaf left less than half
+* full borrows an item from a sibling, or is merged into it when the
+* sibling has none to spare; merges can cascade up, and the tree shrinks
+* when the root is left with a single child.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::remove(const Key& key)
+{
+    if (root_ == NULL) {
+        return;
+    }
+    Inner* path[MAX_HEIGHT];
+    unsigned indices[MAX_HEIGHT];
+    Leaf* leaf = findLeaf(key, path, indices);
+    unsigned pos = rankIn(leaf, key, false);
+    if (pos == leaf->count || comp_(key, leaf->key(pos))) {
+        return;
+    }
+
+    eraseItem(leaf, pos);
+    --size_;
+    if (height_ == 1) {
+        if (leaf->count == 0) {
+            destroyLeaf(leaf);
+            root_ = NULL;
+            height_ = 0;
+        }
+        return;
+    }
+    if (leaf->count < LEAF_MIN) {
+        fixLeaf(leaf, path, indices, height_ - 2);
+    }
+}
+
+/**
+* Returns the number of keys in node that are less than key, or with
+* upper set, not greater than key. For a leaf that is where key is or
+* would go; for an inner node it is the child to descend into.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+template<typename NodeType>
+unsigned BTree<Key, Value, Compare, NodeBytes>::rankIn(const NodeType* node, const Key& key, bool upper) const
+{
+    return rankIn(node, key, upper, NodeSearch());
+}
+
+/**
+* Counts with no data-dependent branches over the whole node, so the
+* loop vectorizes; nodes are small enough that this beats a binary search.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+template<typename NodeType>
+unsigned BTree<Key, Value, Compare, NodeBytes>::rankIn(
+    const NodeType* node, const Key& key, bool upper, ScanSearch) const
+{
+    unsigned rank = 0;
+    unsigned count = node->count;
+    if (upper) {
+        for (unsigned i = 0; i < count; ++i) {
+            rank += !comp_(key, node->key(i));
+        }
+    }
+    else {
+        for (unsigned i = 0; i < count; ++i) {
+            rank += comp_(node->key(i), key);
+        }
+    }
+    return rank;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+template<typename NodeType>
+unsigned BTree<Key, Value, Compare, NodeBytes>::rankIn(
+    const NodeType* node, const Key& key, bool upper, BinarySearch) const
+{
+    unsigned lo = 0;
+    unsigned hi = node->count;
+    while (lo < hi) {
+        unsigned mid = lo + (hi - lo) / 2;
+        bool before = upper ? !comp_(key, node->key(mid)) : comp_(node->key(mid), key);
+        if (before) {
+            lo = mid + 1;
+        }
+        else {
+            hi = mid;
+        }
+    }
+    return lo;
+}
+
+/**
+* Descends to the leaf that holds or would hold key, or returns NULL if
+* the tree is empty. If path is given, path[d] and indices[d] receive the
+* inner node at depth d and the child taken from it.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::Leaf*
+BTree<Key, Value, Compare, NodeBytes>::findLeaf(const Key& key, Inner** path, unsigned* indices) const
+{
+    void* node = root_;
+    for (int depth = 0; depth < height_ - 1; ++depth) {
+        Inner* inner = static_cast<Inner*>(node);
+        unsigned index = rankIn(inner, key, true);
+        if (path != NULL) {
+            path[depth] = inner;
+            indices[depth] = index;
+        }
+        node = inner->children[index];
+    }
+    return static_cast<Leaf*>(node);
+}
+
+/**
+* Shared body of lower_bound and upper_bound. The answer is in the leaf
+* key leads to, or if every key there is smaller, first in the next leaf.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::iterator
+BTree<Key, Value, Compare, NodeBytes>::bound(const Key& key, bool upper) const
+{
+    Leaf* leaf = findLeaf(key, NULL, NULL);
+    if (leaf == NULL) {
+        return end();
+    }
+    unsigned pos = rankIn(leaf, key, upper);
+    if (pos == leaf->count) {
+        return iterator(leaf->next, 0, this);
+    }
+    return iterator(leaf, pos, this);
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::Leaf*
+BTree<Key, Value, Compare, NodeBytes>::firstLeaf() const
+{
+    void* node = root_;
+    for (int depth = 0; depth < height_ - 1; ++depth) {
+        node = static_cast<Inner*>(node)->children[0];
+    }
+    return static_cast<Leaf*>(node);
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::Leaf*
+BTree<Key, Value, Compare, NodeBytes>::lastLeaf() const
+{
+    void* node = root_;
+    for (int depth = 0; depth < height_ - 1; ++depth) {
+        Inner* inner = static_cast<Inner*>(node);
+        node = inner->children[inner->count];
+    }
+    return static_cast<Leaf*>(node);
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::Leaf*
+BTree<Key, Value, Compare, NodeBytes>::createLeaf()
+{
+    Leaf* leaf = static_cast<Leaf*>(leafPool_.allocate());
+    leaf->count = 0;
+    leaf->prev = NULL;
+    leaf->next = NULL;
+    return leaf;
+}
+
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+typename BTree<Key, Value, Compare, NodeBytes>::Inner*
+BTree<Key, Value, Compare, NodeBytes>::createInner()
+{
+    Inner* inner = static_cast<Inner*>(innerPool_.allocate());
+    inner->count = 0;
+    return inner;
+}
+
+/**
+* Gives an empty leaf back to its pool.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::destroyLeaf(Leaf* leaf)
+{
+    leafPool_.deallocate(leaf);
+}
+
+/**
+* Gives an inner node with no keys back to its pool.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::destroyInner(Inner* inner)
+{
+    innerPool_.deallocate(inner);
+}
+
+/**
+* Destroys the items and keys under node, which is height levels tall.
+* The node memory itself is left to the pools.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::destroySubtree(void* node, int height)
+{
+    if (node == NULL) {
+        return;
+    }
+    if (height == 1) {
+        Leaf* leaf = static_cast<Leaf*>(node);
+        for (unsigned i = 0; i < leaf->count; ++i) {
+            leaf->item(i).~Item();
+        }
+        return;
+    }
+    Inner* inner = static_cast<Inner*>(node);
+    for (unsigned i = 0; i <= inner->count; ++i) {
+        destroySubtree(inner->children[i], height - 1);
+    }
+    for (unsigned i = 0; i < inner->count; ++i) {
+        inner->key(i).~Key();
+    }
+}
+
+/**
+* Moves the item in slot i of from into the empty slot j of to.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::moveItem(Leaf* from, unsigned i, Leaf* to, unsigned j)
+{
+    new (&to->slots[j]) Item(std::move(from->item(i)));
+    from->item(i).~Item();
+}
+
+/**
+* Moves key i of from into the empty key slot j of to.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::moveKey(Inner* from, unsigned i, Inner* to, unsigned j)
+{
+    new (&to->slots[j]) Key(std::move(from->key(i)));
+    from->key(i).~Key();
+}
+
+/**
+* Moves item into slot pos of a leaf with room, shifting the rest right.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::insertItem(Leaf* leaf, unsigned pos, Item& item)
+{
+    for (unsigned i = leaf->count; i > pos; --i) {
+        moveItem(leaf, i - 1, leaf, i);
+    }
+    new (&leaf->slots[pos]) Item(std::move(item));
+    ++leaf->count;
+}
+
+/**
+* Destroys the item in slot pos and closes the gap.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::eraseItem(Leaf* leaf, unsigned pos)
+{
+    leaf->item(pos).~Item();
+    for (unsigned i = pos + 1; i < leaf->count; ++i) {
+        moveItem(leaf, i, leaf, i - 1);
+    }
+    --leaf->count;
+}
+
+/**
+* Moves key into key slot pos of an inner node with room, with right as
+* the child just after it.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::insertKey(Inner* inner, unsigned pos, Key& key, void* right)
+{
+    for (unsigned i = inner->count; i > pos; --i) {
+        moveKey(inner, i - 1, inner, i);
+        inner->children[i + 1] = inner->children[i];
+    }
+    new (&inner->slots[pos]) Key(std::move(key));
+    inner->children[pos + 1] = right;
+    ++inner->count;
+}
+
+/**
+* Destroys key pos of an inner node along with the child pointer after it
+* and closes the gap.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::eraseKey(Inner* inner, unsigned pos)
+{
+    inner->key(pos).~Key();
+    for (unsigned i = pos + 1; i < inner->count; ++i) {
+        moveKey(inner, i, inner, i - 1);
+        inner->children[i] = inner->children[i + 1];
+    }
+    --inner->count;
+}
+
+/**
+* Splits a full leaf around the new item, which belongs at pos: the upper
+* half moves to the empty leaf right, which is linked in after leaf.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::splitLeaf(Leaf* leaf, unsigned pos, Item& item, Leaf* right)
+{
+    const unsigned leftCount = (LEAF_SLOTS + 1) / 2;
+    unsigned from = (pos < leftCount) ? leftCount - 1 : leftCount;
+    for (unsigned i = from; i < LEAF_SLOTS; ++i) {
+        moveItem(leaf, i, right, i - from);
+    }
+    right->count = LEAF_SLOTS - from;
+    leaf->count = from;
+    if (pos < leftCount) {
+        insertItem(leaf, pos, item);
+    }
+    else {
+        insertItem(right, pos - leftCount, item);
+    }
+
+    right->prev = leaf;
+    right->next = leaf->next;
+    if (leaf->next != NULL) {
+        leaf->next->prev = right;
+    }
+    leaf->next = right;
+}
+
+/**
+* Splits a full inner node around a new key (with child after it) that
+* belongs at pos. The upper keys and children move to the empty node
+* right, and the middle key is moved into up for the parent.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::splitInner(Inner* inner, unsigned pos, Key& key, void* child,
+                                                       Inner* right, Key& up)
+{
+    const unsigned mid = INNER_SLOTS / 2;
+    if (pos == mid) {
+        // The new key is the middle one
+        for (unsigned i = mid; i < INNER_SLOTS; ++i) {
+            moveKey(inner, i, right, i - mid);
+            right->children[i - mid + 1] = inner->children[i + 1];
+        }
+        right->children[0] = child;
+        right->count = INNER_SLOTS - mid;
+        inner->count = mid;
+        up = std::move(key);
+        return;
+    }
+
+    unsigned upIndex = (pos < mid) ? mid - 1 : mid;
+    for (unsigned i = upIndex + 1; i < INNER_SLOTS; ++i) {
+        moveKey(inner, i, right, i - upIndex - 1);
+    }
+    for (unsigned i = upIndex + 1; i <= INNER_SLOTS; ++i) {
+        right->children[i - upIndex - 1] = inner->children[i];
+    }
+    right->count = INNER_SLOTS - upIndex - 1;
+    up = std::move(inner->key(upIndex));
+    inner->key(upIndex).~Key();
+    inner->count = upIndex;
+    if (pos < mid) {
+        insertKey(inner, pos, key, child);
+    }
+    else {
+        insertKey(right, pos - mid - 1, key, child);
+    }
+}
+
+/**
+* Restores the minimum fill of a non-root leaf that has dropped below
+* LEAF_MIN items. path[depth] is its parent.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::fixLeaf(Leaf* leaf, Inner** path, unsigned* indices, int depth)
+{
+    Inner* parent = path[depth];
+    unsigned index = indices[depth];
+    Leaf* left = (index > 0) ? static_cast<Leaf*>(parent->children[index - 1]) : NULL;
+    Leaf* right = (index < parent->count) ? static_cast<Leaf*>(parent->children[index + 1]) : NULL;
+
+    if (left != NULL && left->count > LEAF_MIN) {
+        for (unsigned i = leaf->count; i > 0; --i) {
+            moveItem(leaf, i - 1, leaf, i);
+        }
+        moveItem(left, left->count - 1, leaf, 0);
+        --left->count;
+        ++leaf->count;
+        parent->key(index - 1) = leaf->key(0);
+        return;
+    }
+    if (right != NULL && right->count > LEAF_MIN) {
+        moveItem(right, 0, leaf, leaf->count);
+        ++leaf->count;
+        for (unsigned i = 1; i < right->count; ++i) {
+            moveItem(right, i, right, i - 1);
+        }
+        --right->count;
+        parent->key(index) = right->key(0);
+        return;
+    }
+
+    // Neither sibling can spare an item: merge with one of them
+    Leaf* into = leaf;
+    Leaf* from = right;
+    unsigned sep = index;
+    if (left != NULL) {
+        into = left;
+        from = leaf;
+        sep = index - 1;
+    }
+    for (unsigned i = 0; i < from->count; ++i) {
+        moveItem(from, i, into, into->count + i);
+    }
+    into->count += from->count;
+    into->next = from->next;
+    if (from->next != NULL) {
+        from->next->prev = into;
+    }
+    destroyLeaf(from);
+    eraseKey(parent, sep);
+    fixInner(parent, path, indices, depth);
+}
+
+/**
+* Restores the minimum fill of the inner node at path[depth] after it lost
+* a key, by borrowing through the parent from a sibling or merging with
+* it. A root left with no keys is replaced by its only child.
+*/
+template<typename Key, typename Value, typename Compare, std::size_t NodeBytes>
+void BTree<Key, Value, Compare, NodeBytes>::fixInner(Inner* inner, Inner** path, unsigned* indices, int depth)
+{
+    if (depth == 0) {
+        if (inner->count == 0) {
+            root_ = inner->children[0];
+            destroyInner(inner);
+            --height_;
+        }
+        return;
+    }
+    if (inner->count >= INNER_MIN) {
+        return;
+    }
+
+    Inner* parent = path[depth - 1];
+    unsigned index = indices[depth - 1];
+    Inner* left = (index > 0) ? static_cast<Inner*>(parent->children[index - 1]) : NULL;
+    Inner* right = (index < parent->count) ? static_cast<Inner*>(parent->children[index + 1]) : NULL;
+
+    if (left != NULL && left->count > INNER_MIN) {
+        // Rotate right: the separator comes down, left's last key goes up
+        inner->children[inner->count + 1] = inner->children[inner->count];
+        for (unsigned i = inner->count; i > 0; --i) {
+            moveKey(inner, i - 1, inner, i);
+            inner->children[i] = inner->children[i - 1];
+        }
+        moveKey(parent, index - 1, inner, 0);
+        inner->children[0] = left->children[left->count];
+        ++inner->count;
+        moveKey(left, left->count - 1, parent, index - 1);
+        --left->count;
+        return;
+    }
+    if (right != NULL && right->count > INNER_MIN) {
+        // Rotate left: the separator comes down, right's first key goes up
+        moveKey(parent, index, inner, inner->count);
+        inner->children[inner->count + 1] = right->children[0];
+        ++inner->count;
+        moveKey(right, 0, parent, index);
+        right->children[0] = right->children[1];
+        for (unsigned i = 1; i < right->count; ++i) {
+            moveKey(right, i, right, i - 1);
+            right->children[i] = right->children[i + 1];
+        }
+        --right->count;
+        return;
+    }
+
+    // Merge: into gets the separator, then from's keys and children
+    Inner* into = inner;
+    Inner* from = right;
+    unsigned sep = index;
+    if (left != NULL) {
+        into = left;
+        from = inner;
+        sep = index - 1;
+    }
+    moveKey(parent, sep, into, into->count);
+    for (unsigned i = 0; i < from->count; ++i) {
+        moveKey(from, i, into, into->count + 1 + i);
+    }
+    for (unsigned i = 0; i <= from->count; ++i) {
+        into->children[into->count + 1 + i] = from->children[i];
+    }
+    into->count += from->count + 1;
+    destroyInner(from);
+
+    // The separator's slot was emptied by the move; close the gap
+    for (unsigned i = sep + 1; i < parent->count; ++i) {
+        moveKey(parent, i, parent, i - 1);
+        parent->children[i] = parent->children[i + 1];
+    }
+    --parent->count;
+    fixInner(parent, path, indices, depth - 1);
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the BTree class.
+  -----------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,738 @@
+#ifndef COMPACT_AVLBST_H
+#define COMPACT_AVLBST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <new>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include "avl_rebalance.h"
+#include "node_pool.h"
+
+/**
+* A node for CompactAVLTree. Unlike AVLNode it has no virtual functions,
+* so no vtable pointer, and the balance (-1, 0 or +1) is kept in the low
+* two bits of the parent pointer, which are always zero because nodes are
+* at least 4-byte aligned. For 8-byte keys and values that is 40 bytes
+* per node where an AVLNode takes 56 (64 once the pool pads it).
+*/
+template <typename Key, typename Value>
+class CompactAVLNode
+{
+public:
+    template<typename... KeyArgs, typename... ValueArgs>
+    CompactAVLNode(std::piecewise_construct_t, std::tuple<KeyArgs...>&& keyArgs,
+                   std::tuple<ValueArgs...>&& valueArgs, CompactAVLNode<Key, Value>* parent);
+
+    std::pair<const Key, Value>& getItem();
+    const Key& getKey() const;
+    Value& getValue();
+
+    CompactAVLNode<Key, Value>* getParent() const;
+    CompactAVLNode<Key, Value>* getLeft() const;
+    CompactAVLNode<Key, Value>* getRight() const;
+    int8_t getBalance() const;
+
+    void setParent(CompactAVLNode<Key, Value>* parent);
+    void setLeft(CompactAVLNode<Key, Value>* left);
+    void setRight(CompactAVLNode<Key, Value>* right);
+    void setBalance(int8_t balance);
+
+protected:
+    static const std::uintptr_t BALANCE_MASK = 3;
+
+    std::pair<const Key, Value> item_;
+    CompactAVLNode<Key, Value>* left_;
+    CompactAVLNode<Key, Value>* right_;
+    std::uintptr_t parentAndBalance_;  // parent pointer | (balance + 1)
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the CompactAVLNode class.
+  -----------------------------------------------------
+*/
+
+/**
+* A piecewise constructor building the key and value in place. New nodes
+* have balance 0.
+*/
+template<class Key, class Value>
+template<typename... KeyArgs, typename... ValueArgs>
+CompactAVLNode<Key, Value>::CompactAVLNode(std::piecewise_construct_t, std::tuple<KeyArgs...>&& keyArgs,
+                                           std::tuple<ValueArgs...>&& valueArgs,
+                                           CompactAVLNode<Key, Value>* parent) :
+    item_(std::piecewise_construct, std::move(keyArgs), std::move(valueArgs)),
+    left_(NULL),
+    right_(NULL),
+    parentAndBalance_(reinterpret_cast<std::uintptr_t>(parent) | 1)
+{
+    static_assert(alignof(CompactAVLNode<Key, Value>) > BALANCE_MASK,
+                  "CompactAVLNode needs two free low bits in its pointers");
+}
+
+template<class Key, class Value>
+std::pair<const Key, Value>& CompactAVLNode<Key, Value>::getItem()
+{
+    return item_;
+}
+
+template<class Key, class Value>
+const Key& CompactAVLNode<Key, Value>::getKey() const
+{
+    return item_.first;
+}
+
+template<class Key, class Value>
+Value& CompactAVLNode<Key, Value>::getValue()
+{
+    return item_.second;
+}
+
+/**
+* The parent, with the balance bits masked off.
+*/
+template<class Key, class Value>
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getParent() const
+{
+    return reinterpret_cast<CompactAVLNode<Key, Value>*>(parentAndBalance_ & ~BALANCE_MASK);
+}
+
+template<class Key, class Value>
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getLeft() const
+{
+    return left_;
+}
+
+template<class Key, class Value>
+CompactAVLNode<Key, Value>* CompactAVLNode<Key, Value>::getRight() const
+{
+    return right_;
+}
+
+/**
+* The height of the right subtree minus that of the left, -1 to +1.
+*/
+template<class Key, class Value>
+int8_t CompactAVLNode<Key, Value>::getBalance() const
+{
+    return static_cast<int8_t>(parentAndBalance_ & BALANCE_MASK) - 1;
+}
+
+/**
+* Sets the parent, keeping the balance.
+*/
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setParent(CompactAVLNode<Key, Value>* parent)
+{
+    parentAndBalance_ = reinterpret_cast<std::uintptr_t>(parent) | (parentAndBalance_ & BALANCE_MASK);
+}
+
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setLeft(CompactAVLNode<Key, Value>* left)
+{
+    left_ = left;
+}
+
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setRight(CompactAVLNode<Key, Value>* right)
+{
+    right_ = right;
+}
+
+/**
+* Sets the balance, which must be -1, 0 or +1, keeping the parent.
+*/
+template<class Key, class Value>
+void CompactAVLNode<Key, Value>::setBalance(int8_t balance)
+{
+    parentAndBalance_ = (parentAndBalance_ & ~BALANCE_MASK) | static_cast<std::uintptr_t>(balance + 1);
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the CompactAVLNode class.
+  ---------------------------------------------------
+*/
+
+
+/**
+* An AVL tree of CompactAVLNodes, for large maps where per-entry memory
+* matters more than the extras of AVLTree. It has the insert/remove/find/
+* operator[]/iterator surface of BinarySearchTree but is not part of its
+* hierarchy: that hierarchy destroys nodes through a virtual destructor,
+* which is what the compact node gives up. Since a balance of +-2 does not
+* fit in the node, the rebalancing code (AVLRebalancer, shared with
+* IndexedAVLTree) never stores one; it rotates as soon as a node would
+* reach it.
+*
+* Nodes come from a NodePool aligned to the node rather than to
+* std::max_align_t, so they are not padded to 16 bytes. Removing an entry
+* does not move any other entry, so iterators to other entries stay valid.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class CompactAVLTree
+{
+public:
+    typedef CompactAVLNode<Key, Value> NodeType;
+
+    CompactAVLTree();
+    explicit CompactAVLTree(const Compare& comp);
+    ~CompactAVLTree();
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    bool empty() const;
+    std::size_t size() const;
+    bool isBalanced() const;
+
+    /**
+    * A bidirectional iterator over the items in key order, stepping
+    * through parent pointers like BinarySearchTree::iterator.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key, Value>* pointer;
+        typedef std::pair<const Key, Value>& reference;
+
+        iterator();
+
+        std::pair<const Key, Value>& operator*() const;
+        std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class CompactAVLTree<Key, Value, Compare>;
+        iterator(NodeType* node, const CompactAVLTree<Key, Value, Compare>* tree);
+
+        NodeType* current_;  // NULL for end()
+        const CompactAVLTree<Key, Value, Compare>* tree_;
+    };
+
+    iterator begin() const;
+    iterator end() const;
+    iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+    iterator lower_bound(const Key& key) const;
+    iterator upper_bound(const Key& key) const;
+
+protected:
+    NodeType* findNode(const Key& key) const;
+    NodeType* boundNode(const Key& key, bool upper) const;
+    NodeType* smallestNode() const;
+    NodeType* largestNode() const;
+    static NodeType* successor(NodeType* node);
+    static NodeType* predecessor(NodeType* node);
+
+    // How AVLRebalancer follows and changes this tree's links
+    struct Links
+    {
+        typedef NodeType* Handle;
+        explicit Links(NodeType** root) : root(root) { }
+        static NodeType* none() { return NULL; }
+        NodeType* left(NodeType* node) const { return node->getLeft(); }
+        NodeType* right(NodeType* node) const { return node->getRight(); }
+        NodeType* parent(NodeType* node) const { return node->getParent(); }
+        int balance(NodeType* node) const { return node->getBalance(); }
+        void setLeft(NodeType* node, NodeType* child) const { node->setLeft(child); }
+        void setRight(NodeType* node, NodeType* child) const { node->setRight(child); }
+        void setParent(NodeType* node, NodeType* up) const { node->setParent(up); }
+        void setBalance(NodeType* node, int balance) const { node->setBalance(static_cast<int8_t>(balance)); }
+        void setRoot(NodeType* node) const { *root = node; }
+        NodeType** root;
+    };
+    AVLRebalancer<Links> rebalancer();
+    int checkHeight(NodeType* node, bool& balanced) const;
+
+    void destroyNode(NodeType* node);
+
+private:
+    // Not copyable, like the node pool it owns
+    CompactAVLTree(const CompactAVLTree&);
+    CompactAVLTree& operator=(const CompactAVLTree&);
+
+protected:
+    NodeType* root_;
+    std::size_t size_;
+    NodePool pool_;
+    Compare comp_;
+};
+
+/*
+  ------------------------------------------------------------
+  Begin implementations for the CompactAVLTree::iterator class.
+  ------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::iterator::iterator() :
+    current_(NULL),
+    tree_(NULL)
+{
+}
+
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::iterator::iterator(
+    NodeType* node, const CompactAVLTree<Key, Value, Compare>* tree) :
+    current_(node),
+    tree_(tree)
+{
+}
+
+template<typename Key, typename Value, typename Compare>
+std::pair<const Key, Value>& CompactAVLTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return current_->getItem();
+}
+
+template<typename Key, typename Value, typename Compare>
+std::pair<const Key, Value>* CompactAVLTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return &(current_->getItem());
+}
+
+template<typename Key, typename Value, typename Compare>
+bool CompactAVLTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool CompactAVLTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator&
+CompactAVLTree<Key, Value, Compare>::iterator::operator++()
+{
+    current_ = successor(current_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Steps back to the previous item; from end() this is the largest item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator&
+CompactAVLTree<Key, Value, Compare>::iterator::operator--()
+{
+    current_ = (current_ == NULL) ? tree_->largestNode() : predecessor(current_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+  ----------------------------------------------------------
+  End implementations for the CompactAVLTree::iterator class.
+  ----------------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the CompactAVLTree class.
+  ---------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::CompactAVLTree() :
+    root_(NULL),
+    size_(0),
+    pool_(sizeof(NodeType), alignof(NodeType)),
+    comp_()
+{
+}
+
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::CompactAVLTree(const Compare& comp) :
+    root_(NULL),
+    size_(0),
+    pool_(sizeof(NodeType), alignof(NodeType)),
+    comp_(comp)
+{
+}
+
+template<typename Key, typename Value, typename Compare>
+CompactAVLTree<Key, Value, Compare>::~CompactAVLTree()
+{
+    clear();
+}
+
+/**
+* Destroys every item and gives all nodes back to the pool. The tree is
+* only walked when the items have destructors that must run; the walk
+* follows parent pointers, so it needs no stack.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::clear()
+{
+    if (!std::is_trivially_destructible<std::pair<const Key, Value> >::value) {
+        NodeType* node = root_;
+        while (node != NULL) {
+            if (node->getLeft() != NULL) {
+                node = node->getLeft();
+            }
+            else if (node->getRight() != NULL) {
+                node = node->getRight();
+            }
+            else {
+                // A leaf: unhook it from its parent, then destroy it
+                NodeType* parent = node->getParent();
+                if (parent != NULL) {
+                    if (parent->getLeft() == node) {
+                        parent->setLeft(NULL);
+                    }
+                    else {
+                        parent->setRight(NULL);
+                    }
+                }
+                node->~NodeType();
+                node = parent;
+            }
+        }
+    }
+    pool_.release();
+    root_ = NULL;
+    size_ = 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool CompactAVLTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t CompactAVLTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::begin() const
+{
+    return iterator(smallestNode(), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::end() const
+{
+    return iterator(NULL, this);
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    return iterator(findNode(key), this);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value, typename Compare>
+Value& CompactAVLTree<Key, Value, Compare>::operator[](const Key& key)
+{
+    NodeType* node = findNode(key);
+    if(node == NULL) throw std::out_of_range("Invalid key");
+    return node->getValue();
+}
+template<typename Key, typename Value, typename Compare>
+Value const & CompactAVLTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    NodeType* node = findNode(key);
+    if(node == NULL) throw std::out_of_range("Invalid key");
+    return node->getValue();
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return iterator(boundNode(key, false), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or end() if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::iterator
+CompactAVLTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return iterator(boundNode(key, true), this);
+}
+
+/**
+* Returns the node holding key, or NULL. Like BinarySearchTree::findNode,
+* one Compare call per level plus one at the bottom.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::NodeType*
+CompactAVLTree<Key, Value, Compare>::findNode(const Key& key) const
+{
+    NodeType* candidate = NULL;
+    NodeType* node = root_;
+    while (node != NULL) {
+        if (comp_(key, node->getKey())) {
+            node = node->getLeft();
+        }
+        else {
+            candidate = node;
+            node = node->getRight();
+        }
+    }
+    if (candidate != NULL && !comp_(candidate->getKey(), key)) {
+        return candidate;
+    }
+    return NULL;
+}
+
+/**
+* Returns the node with the smallest key not less than key (or, if upper,
+* greater than key), or NULL.
+*/
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::NodeType*
+CompactAVLTree<Key, Value, Compare>::boundNode(const Key& key, bool upper) const
+{
+    NodeType* candidate = NULL;
+    NodeType* node = root_;
+    while (node != NULL) {
+        bool goLeft = upper ? comp_(key, node->getKey()) : !comp_(node->getKey(), key);
+        if (goLeft) {
+            candidate = node;
+            node = node->getLeft();
+        }
+        else {
+            node = node->getRight();
+        }
+    }
+    return candidate;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::NodeType*
+CompactAVLTree<Key, Value, Compare>::smallestNode() const
+{
+    NodeType* node = root_;
+    while (node != NULL && node->getLeft() != NULL) {
+        node = node->getLeft();
+    }
+    return node;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::NodeType*
+CompactAVLTree<Key, Value, Compare>::largestNode() const
+{
+    NodeType* node = root_;
+    while (node != NULL && node->getRight() != NULL) {
+        node = node->getRight();
+    }
+    return node;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::NodeType*
+CompactAVLTree<Key, Value, Compare>::successor(NodeType* node)
+{
+    if (node->getRight() != NULL) {
+        node = node->getRight();
+        while (node->getLeft() != NULL) {
+            node = node->getLeft();
+        }
+        return node;
+    }
+    NodeType* parent = node->getParent();
+    while (parent != NULL && parent->getRight() == node) {
+        node = parent;
+        parent = parent->getParent();
+    }
+    return parent;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename CompactAVLTree<Key, Value, Compare>::NodeType*
+CompactAVLTree<Key, Value, Compare>::predecessor(NodeType* node)
+{
+    if (node->getLeft() != NULL) {
+        node = node->getLeft();
+        while (node->getRight() != NULL) {
+            node = node->getRight();
+        }
+        return node;
+    }
+    NodeType* parent = node->getParent();
+    while (parent != NULL && parent->getLeft() == node) {
+        node = parent;
+        parent = parent->getParent();
+    }
+    return parent;
+}
+
+/**
+* Inserts keyValuePair, or overwrites the value if its key is present.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    NodeType* candidate = NULL;
+    NodeType* parent = NULL;
+    bool isLeft = false;
+    for (NodeType* node = root_; node != NULL; ) {
+        parent = node;
+        isLeft = comp_(keyValuePair.first, node->getKey());
+        if (isLeft) {
+            node = node->getLeft();
+        }
+        else {
+            candidate = node;
+            node = node->getRight();
+        }
+    }
+    if (candidate != NULL && !comp_(candidate->getKey(), keyValuePair.first)) {
+        candidate->getValue() = keyValuePair.second;
+        return;
+    }
+
+    void* block = pool_.allocate();
+    NodeType* node;
+    try {
+        node = new (block) NodeType(std::piecewise_construct, std::forward_as_tuple(keyValuePair.first),
+                                    std::forward_as_tuple(keyValuePair.second), parent);
+    }
+    catch (...) {
+        pool_.deallocate(block);
+        throw;
+    }
+    if (parent == NULL) {
+        root_ = node;
+    }
+    else if (isLeft) {
+        parent->setLeft(node);
+    }
+    else {
+        parent->setRight(node);
+    }
+    ++size_;
+    rebalancer().insertFix(node);
+}
+
+/**
+* Removes the entry with the given key, if there is one, and rebalances.
+* A node with two children first trades places with its predecessor, so
+* the node unlinked has at most one child.
+*/
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    NodeType* node = findNode(key);
+    if (node == NULL) {
+        return;
+    }
+    AVLRebalancer<Links> fix = rebalancer();
+    if (node->getLeft() != NULL && node->getRight() != NULL) {
+        fix.swapWithPredecessor(node, predecessor(node));
+    }
+
+    NodeType* child = (node->getLeft() != NULL) ? node->getLeft() : node->getRight();
+    NodeType* parent = node->getParent();
+    bool wasLeft = parent != NULL && parent->getLeft() == node;
+    fix.replaceChild(parent, node, child);
+    destroyNode(node);
+    --size_;
+    fix.removeFix(parent, wasLeft);
+}
+
+/**
+* Returns true iff no node's subtree heights differ by more than one and
+* every stored balance matches. O(n).
+*/
+template<typename Key, typename Value, typename Compare>
+bool CompactAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    bool balanced = true;
+    checkHeight(root_, balanced);
+    return balanced;
+}
+
+template<typename Key, typename Value, typename Compare>
+int CompactAVLTree<Key, Value, Compare>::checkHeight(NodeType* node, bool& balanced) const
+{
+    if (node == NULL) {
+        return 0;
+    }
+    int left = checkHeight(node->getLeft(), balanced);
+    int right = checkHeight(node->getRight(), balanced);
+    if (right - left != node->getBalance()) {
+        balanced = false;
+    }
+    return (left > right ? left : right) + 1;
+}
+
+template<typename Key, typename Value, typename Compare>
+AVLRebalancer<typename CompactAVLTree<Key, Value, Compare>::Links>
+CompactAVLTree<Key, Value, Compare>::rebalancer()
+{
+    return AVLRebalancer<Links>(Links(&root_));
+}
+
+template<typename Key, typename Value, typename Compare>
+void CompactAVLTree<Key, Value, Compare>::destroyNode(NodeType* node)
+{
+    node->~NodeType();
+    pool_.deallocate(node);
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the CompactAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
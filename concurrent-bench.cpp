@@ -0,0 +1,153 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include "avlbst.h"
+#include "concurrent_avlbst.h"
+
+using namespace std;
+
+// Throughput of ConcurrentAVLTree against an AVLTree behind one mutex,
+// from 1 to maxThreads threads, on a mix of lookups, inserts and removes.
+//
+// usage: concurrent-bench [maxThreads] [opsPerThread] [keyRange] [lookupPercent]
+
+struct Workload
+{
+    int opsPerThread;
+    int keyRange;
+    int lookupPercent;
+};
+
+// Cheap per-thread random numbers (xorshift), so the generator is not
+// what we end up measuring
+struct Rng
+{
+    explicit Rng(unsigned long seed) : state(seed * 2654435761UL + 1) { }
+    unsigned long next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+    unsigned long state;
+};
+
+class LockedAVLTree
+{
+public:
+    void insert(int key, int value)
+    {
+        lock_guard<mutex> lock(lock_);
+        tree_.insert(make_pair(key, value));
+    }
+    void remove(int key)
+    {
+        lock_guard<mutex> lock(lock_);
+        tree_.remove(key);
+    }
+    bool find(int key)
+    {
+        lock_guard<mutex> lock(lock_);
+        return tree_.find(key) != tree_.end();
+    }
+private:
+    mutex lock_;
+    AVLTree<int, int> tree_;
+};
+
+class SharedConcurrentAVLTree
+{
+public:
+    void insert(int key, int value) { tree_.insert(make_pair(key, value)); }
+    void remove(int key) { tree_.remove(key); }
+    bool find(int key) { return tree_.contains(key); }
+private:
+    ConcurrentAVLTree<int, int> tree_;
+};
+
+template<typename Tree>
+void worker(Tree& tree, const Workload& work, int id, long& hits)
+{
+    Rng rng(id + 1);
+    long found = 0;
+    for (int i = 0; i < work.opsPerThread; ++i) {
+        unsigned long r = rng.next();
+        int key = static_cast<int>((r >> 8) % work.keyRange);
+        int op = static_cast<int>(r % 100);
+        if (op < work.lookupPercent) {
+            found += tree.find(key);
+        }
+        else if ((op - work.lookupPercent) % 2 == 0) {
+            tree.insert(key, i);
+        }
+        else {
+            tree.remove(key);
+        }
+    }
+    hits = found;
+}
+
+// Returns millions of operations per second with the given thread count
+template<typename Tree>
+double run(int threads, const Workload& work)
+{
+    Tree tree;
+    // Start half full so lookups and removes have something to find
+    Rng fill(0);
+    for (int i = 0; i < work.keyRange / 2; ++i) {
+        tree.insert(static_cast<int>(fill.next() % work.keyRange), i);
+    }
+
+    vector<thread> pool;
+    vector<long> hits(threads, 0);
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int t = 0; t < threads; ++t) {
+        pool.push_back(thread(worker<Tree>, ref(tree), cref(work), t, ref(hits[t])));
+    }
+    for (int t = 0; t < threads; ++t) {
+        pool[t].join();
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    return static_cast<double>(threads) * work.opsPerThread / seconds / 1e6;
+}
+
+int main(int argc, char *argv[])
+{
+    int maxThreads = static_cast<int>(thread::hardware_concurrency());
+    if (maxThreads < 1) {
+        maxThreads = 1;
+    }
+    Workload work;
+    work.opsPerThread = 200000;
+    work.keyRange = 100000;
+    work.lookupPercent = 80;
+
+    if (argc > 1) maxThreads = atoi(argv[1]);
+    if (argc > 2) work.opsPerThread = atoi(argv[2]);
+    if (argc > 3) work.keyRange = atoi(argv[3]);
+    if (argc > 4) work.lookupPercent = atoi(argv[4]);
+
+    cout << "ops/thread " << work.opsPerThread << ", keys " << work.keyRange
+         << ", lookups " << work.lookupPercent << "%" << endl;
+    cout << setw(8) << "threads" << setw(24) << "mutex AVLTree Mops/s"
+         << setw(28) << "ConcurrentAVLTree Mops/s" << endl;
+    // Powers of two, then maxThreads itself
+    vector<int> counts;
+    for (int threads = 1; threads < maxThreads; threads *= 2) {
+        counts.push_back(threads);
+    }
+    counts.push_back(maxThreads);
+
+    for (size_t i = 0; i < counts.size(); ++i) {
+        double locked = run<LockedAVLTree>(counts[i], work);
+        double concurrent = run<SharedConcurrentAVLTree>(counts[i], work);
+        cout << setw(8) << counts[i] << fixed << setprecision(2)
+             << setw(24) << locked << setw(28) << concurrent << endl;
+    }
+    return 0;
+}
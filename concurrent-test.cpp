@@ -0,0 +1,348 @@
+#include <iostream>
+#include <cstdlib>
+#include <atomic>
+#include <map>
+#include <string>
+#include <thread>
+#include <vector>
+#include "concurrent_avlbst.h"
+#include "persistent_avlbst.h"
+
+using namespace std;
+
+// Checks ConcurrentAVLTree against std::map, first from one thread and
+// then from several at once, and that PersistentAVLTree snapshots stay
+// intact and old versions get freed while readers keep taking them.
+// Build it with -fsanitize=thread (make concurrent-test-tsan) to have
+// ThreadSanitizer watch the same run; tsan.supp names the reports that
+// are expected.
+//
+// usage: concurrent-test [threads] [opsPerThread] [seed]
+
+static atomic<int> failures(0);
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        cout << "FAILED: " << what << endl;
+        ++failures;
+    }
+}
+
+// Cheap per-thread random numbers (xorshift)
+struct Rng
+{
+    explicit Rng(unsigned long seed) : state(seed * 2654435761UL + 1) { }
+    unsigned long next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+    int below(int n) { return static_cast<int>(next() % n); }
+    unsigned long state;
+};
+
+typedef ConcurrentAVLTree<int, int> Tree;
+
+// True if tree holds exactly the items of ref, looking up every key
+// in [0, keyRange)
+static bool sameContents(const Tree& tree, const map<int, int>& ref, int keyRange)
+{
+    for (int key = 0; key < keyRange; ++key) {
+        int value = 0;
+        bool found = tree.find(key, value);
+        map<int, int>::const_iterator m = ref.find(key);
+        if (found != (m != ref.end()) || (found && value != m->second) || found != tree.contains(key)) {
+            return false;
+        }
+    }
+    return tree.size() == ref.size();
+}
+
+void testSingleThread(unsigned long seed, int ops)
+{
+    const int keyRange = 4000;
+    Rng rng(seed);
+    Tree tree;
+    map<int, int> ref;
+    bool ok = true;
+    for (int i = 0; i < ops && ok; ++i) {
+        int key = rng.below(keyRange);
+        int op = rng.below(10);
+        if (op < 4) {
+            tree.insert(make_pair(key, i));
+            ref[key] = i;
+        }
+        else if (op < 7) {
+            ok = tree.remove(key) == (ref.erase(key) == 1);
+        }
+        else {
+            int value = -1;
+            bool found = tree.find(key, value);
+            map<int, int>::const_iterator m = ref.find(key);
+            ok = found == (m != ref.end()) && (!found || value == m->second);
+        }
+        if (i % 20000 == 0) {
+            ok = ok && sameContents(tree, ref, keyRange) && tree.isBalanced();
+        }
+    }
+    check(ok, "single-threaded operations match std::map");
+    check(sameContents(tree, ref, keyRange), "single-threaded contents match std::map");
+    check(tree.isBalanced(), "single-threaded tree is balanced");
+}
+
+// Each writer owns the keys congruent to its index, so its own std::map
+// tells it exactly what every lookup of its keys must return, even while
+// the other writers reshape the tree around them. Readers meanwhile look
+// up keys from every stripe and check that values belong to the key.
+void testThreads(unsigned long seed, int threads, int ops)
+{
+    const int keyRange = 20000;
+    Tree tree;
+    vector<map<int, int> > refs(threads);
+    atomic<bool> writing(true);
+
+    vector<thread> writers;
+    for (int t = 0; t < threads; ++t) {
+        writers.push_back(thread([&, t]() {
+            Rng rng(seed + 101 * (t + 1));
+            map<int, int>& ref = refs[t];
+            bool ok = true;
+            for (int i = 0; i < ops && ok; ++i) {
+                int key = rng.below(keyRange / threads) * threads + t;
+                int op = rng.below(10);
+                if (op < 5) {
+                    // Values encode their key so readers can check them
+                    int value = key * 16 + (i & 15);
+                    tree.insert(make_pair(key, value));
+                    ref[key] = value;
+                }
+                else if (op < 8) {
+                    ok = tree.remove(key) == (ref.erase(key) == 1);
+                }
+                else {
+                    int value = -1;
+                    bool found = tree.find(key, value);
+                    map<int, int>::const_iterator m = ref.find(key);
+                    ok = found == (m != ref.end()) && (!found || value == m->second);
+                }
+            }
+            check(ok, "a writer's own keys read back as written");
+        }));
+    }
+
+    vector<thread> readers;
+    for (int t = 0; t < 2; ++t) {
+        readers.push_back(thread([&, t]() {
+            Rng rng(seed + 7 * (t + 1));
+            bool ok = true;
+            while (writing.load() && ok) {
+                int key = rng.below(keyRange);
+                int value = -1;
+                if (tree.find(key, value)) {
+                    ok = value / 16 == key;
+                }
+            }
+            check(ok, "readers only see values stored under their key");
+        }));
+    }
+
+    for (size_t t = 0; t < writers.size(); ++t) {
+        writers[t].join();
+    }
+    writing.store(false);
+    for (size_t t = 0; t < readers.size(); ++t) {
+        readers[t].join();
+    }
+
+    map<int, int> all;
+    for (int t = 0; t < threads; ++t) {
+        all.insert(refs[t].begin(), refs[t].end());
+    }
+    check(sameContents(tree, all, keyRange), "concurrent contents match std::map");
+    check(tree.isBalanced(), "concurrent tree is balanced");
+}
+
+// A value that counts how many copies are alive, so the test can tell
+// whether replaced versions are being freed
+struct Counted
+{
+    explicit Counted(int value = 0) : value(value) { ++live; }
+    Counted(const Counted& other) : value(other.value) { ++live; }
+    ~Counted() { --live; }
+    Counted& operator=(const Counted& other) { value = other.value; return *this; }
+
+    int value;
+    static atomic<long> live;
+};
+atomic<long> Counted::live(0);
+
+// One writer overwrites a small set of keys while readers take snapshots
+// nonstop, mostly dropping them right away so that some reader is nearly
+// always inside snapshot(). Every snapshot must be a consistent tree, and
+// the items the writer replaces must be freed as it goes rather than
+// pile up until the readers pause.
+void testSnapshots(unsigned long seed, int threads, int ops)
+{
+    const int keyRange = 256;
+    const long baseline = Counted::live.load();
+    long mostLive = 0;
+    {
+        PersistentAVLTree<int, Counted> tree;
+        atomic<bool> writing(true);
+        vector<thread> readers;
+        for (int t = 0; t < threads; ++t) {
+            readers.push_back(thread([&, t]() {
+                Rng rng(seed + 13 * (t + 1));
+                bool ok = true;
+                for (unsigned long round = 0; writing.load() && ok; ++round) {
+                    PersistentAVLTree<int, Counted>::Snapshot view = tree.snapshot();
+                    if (round % 64 != 0) {
+                        continue;
+                    }
+                    size_t count = 0;
+                    int last = -1;
+                    for (PersistentAVLTree<int, Counted>::Snapshot::const_iterator it = view.begin();
+                         it != view.end(); ++it, ++count) {
+                        ok = ok && it->first > last && it->second.value / 16 == it->first;
+                        last = it->first;
+                    }
+                    const Counted* value = view.find(rng.below(keyRange));
+                    ok = ok && count == view.size() && (value == NULL || value->value / 16 < keyRange);
+                }
+                check(ok, "snapshots stay sorted and consistent");
+            }));
+        }
+
+        Rng rng(seed);
+        for (int i = 0; i < ops; ++i) {
+            int key = rng.below(keyRange);
+            if (rng.below(8) == 0) {
+                tree.remove(key);
+            }
+            else {
+                tree.insert(make_pair(key, Counted(key * 16 + (i & 15))));
+            }
+            mostLive = max(mostLive, Counted::live.load() - baseline);
+        }
+        writing.store(false);
+        for (size_t t = 0; t < readers.size(); ++t) {
+            readers[t].join();
+        }
+    }
+    // Only the current version and the ones readers hold may be alive,
+    // each at most a full tree of items not shared with the others
+    check(mostLive <= 2 * keyRange * (threads + 1), "replaced versions are freed while readers keep reading");
+    check(Counted::live.load() == baseline, "every item is freed with the tree and its snapshots");
+}
+
+// Takes enough snapshots of one version that the reader count packed in
+// the tree's current pointer is folded into the version several times,
+// keeping some, and checks that the version is freed exactly when the
+// last one goes after the writer has replaced it.
+void testSnapshotCounts()
+{
+    typedef PersistentAVLTree<int, Counted>::Snapshot Snapshot;
+    const long baseline = Counted::live.load();
+    PersistentAVLTree<int, Counted> tree;
+    tree.insert(make_pair(1, Counted(16)));
+    vector<Snapshot> held;
+    for (int i = 0; i < 200000; ++i) {
+        Snapshot view = tree.snapshot();
+        if (i % 1000 == 0) {
+            held.push_back(view);
+        }
+    }
+    tree.insert(make_pair(1, Counted(17)));
+    check(held.front().find(1)->value == 16 && tree.snapshot().find(1)->value == 17 &&
+          Counted::live.load() == baseline + 2, "snapshots keep a replaced version");
+    held.pop_back();
+    check(Counted::live.load() == baseline + 2, "a replaced version lives while any snapshot does");
+    held.clear();
+    check(Counted::live.load() == baseline + 1, "a replaced version is freed with its last snapshot");
+}
+
+// Readers take snapshots nonstop, each version seeing several times the
+// 2^16 that the reader count packed in current_ can hold, while the
+// writer keeps publishing. The count must be folded into the version on
+// time however the readers interleave: the snapshots kept along the way
+// must stay intact, and every version must be freed exactly once.
+void testSnapshotFolds(int threads)
+{
+    typedef PersistentAVLTree<int, Counted>::Snapshot Snapshot;
+    const int versions = 6;
+    const long perVersion = 3L << 16;
+    const long baseline = Counted::live.load();
+    {
+        PersistentAVLTree<int, Counted> tree;
+        tree.insert(make_pair(1, Counted(16)));
+        atomic<long> taken(0);
+        atomic<bool> writing(true);
+        vector<thread> readers;
+        for (int t = 0; t < threads; ++t) {
+            readers.push_back(thread([&]() {
+                vector<Snapshot> held;
+                for (long round = 0; writing.load(); ++round) {
+                    Snapshot view = tree.snapshot();
+                    taken.fetch_add(1);
+                    if (round % 8192 == 0) {
+                        held.push_back(view);
+                    }
+                }
+                bool ok = true;
+                for (size_t i = 0; i < held.size(); ++i) {
+                    const Counted* value = held[i].find(1);
+                    ok = ok && held[i].size() == 1 && value != NULL && value->value / 16 == 1;
+                }
+                check(ok, "snapshots stay intact while the reader count is folded");
+            }));
+        }
+
+        for (int v = 1; v < versions; ++v) {
+            long target = taken.load() + perVersion;
+            while (taken.load() < target) {
+                this_thread::yield();
+            }
+            tree.insert(make_pair(1, Counted(16 + v)));
+        }
+        writing.store(false);
+        for (size_t t = 0; t < readers.size(); ++t) {
+            readers[t].join();
+        }
+        check(Counted::live.load() == baseline + 1, "versions past 2^16 snapshots are freed once released");
+    }
+    check(Counted::live.load() == baseline, "every item is freed after 2^16 snapshots per version");
+}
+
+int main(int argc, char *argv[])
+{
+    int threads = 4;
+    int ops = 200000;
+    unsigned long seed = 1;
+    if (argc > 1) {
+        threads = atoi(argv[1]);
+    }
+    if (argc > 2) {
+        ops = atoi(argv[2]);
+    }
+    if (argc > 3) {
+        seed = strtoul(argv[3], NULL, 10);
+    }
+    if (threads < 1 || ops < 1) {
+        cout << "usage: concurrent-test [threads] [opsPerThread] [seed]" << endl;
+        return 1;
+    }
+
+    testSingleThread(seed, ops);
+    testThreads(seed, threads, ops);
+    testSnapshotCounts();
+    testSnapshotFolds(threads);
+    testSnapshots(seed, threads, ops);
+
+    if (failures == 0) {
+        cout << "All concurrent checks passed" << endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,1269 @@
+#ifndef CONCURRENT_AVLBST_H
+#define CONCURRENT_AVLBST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <functional>
+#include <mutex>
+#include <utility>
+#include <vector>
+
+/**
+ * The links every ConcurrentAVLTree node has: a version, a lock and two
+ * children. The tree's root holder is just this part, so the real root
+ * always has a parent to lock and Key need not be default constructible.
+ *
+ * version_ tells optimistic readers whether the keys under a node may
+ * have moved away while they were looking: bit 0 is set once the node is
+ * unlinked, bit 1 while a rotation is shrinking the node's subtree, and
+ * the rest counts finished shrinks.
+ */
+template <class Key, class Value>
+class ConcurrentAVLNode;
+
+template <class Key, class Value>
+class ConcurrentAVLLinks
+{
+public:
+    ConcurrentAVLLinks();
+
+    ConcurrentAVLNode<Key, Value>* getLeft() const { return left_.load(); }
+    ConcurrentAVLNode<Key, Value>* getRight() const { return right_.load(); }
+    ConcurrentAVLNode<Key, Value>* getChild(int dir) const { return dir < 0 ? getLeft() : getRight(); }
+    void setLeft(ConcurrentAVLNode<Key, Value>* left) { left_.store(left); }
+    void setRight(ConcurrentAVLNode<Key, Value>* right) { right_.store(right); }
+    void setChild(int dir, ConcurrentAVLNode<Key, Value>* child);
+
+    unsigned long getVersion() const { return version_.load(); }
+    void setVersion(unsigned long version) { version_.store(version); }
+
+    std::mutex& getLock() { return lock_; }
+
+protected:
+    std::atomic<unsigned long> version_;
+    std::atomic<ConcurrentAVLNode<Key, Value>*> left_;
+    std::atomic<ConcurrentAVLNode<Key, Value>*> right_;
+    std::mutex lock_;
+};
+
+/**
+ * A ConcurrentAVLTree node. Every field a lock-free reader may look at is
+ * atomic. A NULL value marks a routing node: its key was removed while it
+ * still had two children, and it stays to guide searches until it loses
+ * one and can be unlinked.
+ */
+template <class Key, class Value>
+class ConcurrentAVLNode : public ConcurrentAVLLinks<Key, Value>
+{
+public:
+    ConcurrentAVLNode(const Key& key, const Value* value, ConcurrentAVLLinks<Key, Value>* parent);
+
+    const Key& getKey() const { return key_; }
+    const Value* getValue() const { return value_.load(); }
+    void setValue(const Value* value) { value_.store(value); }
+    const Value* exchangeValue(const Value* value) { return value_.exchange(value); }
+    int getHeight() const { return height_.load(); }
+    void setHeight(int height) { height_.store(height); }
+    ConcurrentAVLLinks<Key, Value>* getParent() const { return parent_.load(); }
+    void setParent(ConcurrentAVLLinks<Key, Value>* parent) { parent_.store(parent); }
+
+protected:
+    const Key key_;
+    std::atomic<const Value*> value_;
+    std::atomic<int> height_;
+    std::atomic<ConcurrentAVLLinks<Key, Value>*> parent_;
+};
+
+/**
+ * An ordered map that many threads can read and update at once.
+ *
+ * This follows the optimistic AVL tree of Bronson et al. ("A Practical
+ * Concurrent Binary Search Tree"). Lookups take no locks: they walk down
+ * hand over hand, reading a child and then checking that the parent's
+ * version has not changed, and retry from the parent if it has. Writers
+ * lock only the node they link a child into, or the parent and node they
+ * unlink; rebalancing walks back up and locks just the parent, node and
+ * child(ren) of each rotation. The rotations and the rules for when a
+ * node needs one are AVLTree's, done with relaxed heights.
+ *
+ * Values are kept in separately allocated, immutable boxes so a reader
+ * can copy one out while a writer swaps in another. Unlinked nodes and
+ * replaced boxes cannot be freed while some reader may still be looking
+ * at them, so they are retired into one of three buckets and freed two
+ * generations later, once every operation that could have seen them has
+ * finished (see tryAdvance).
+ */
+template <class Key, class Value, class Compare = std::less<Key> >
+class ConcurrentAVLTree
+{
+public:
+    typedef ConcurrentAVLNode<Key, Value> NodeType;
+    typedef ConcurrentAVLLinks<Key, Value> LinksType;
+
+    ConcurrentAVLTree();
+    explicit ConcurrentAVLTree(const Compare& comp);
+    ~ConcurrentAVLTree();
+
+    // All of these are safe to call from any number of threads at once
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    bool remove(const Key& key);
+    bool find(const Key& key, Value& value) const;
+    bool contains(const Key& key) const;
+
+    // Only meaningful while no other thread is using the tree
+    std::size_t size() const;
+    bool isBalanced() const;
+
+protected:
+    enum Result { RETRY, FOUND, NOT_FOUND };
+
+    // nodeCondition() results; anything else is a height to fix
+    static const int NOTHING_REQUIRED = -1;
+    static const int UNLINK_REQUIRED = -2;
+    static const int REBALANCE_REQUIRED = -3;
+
+    static const unsigned long UNLINKED = 1;
+    static const unsigned long SHRINKING = 2;
+
+    static bool isUnlinked(unsigned long version) { return (version & UNLINKED) != 0; }
+    static bool isShrinking(unsigned long version) { return (version & SHRINKING) != 0; }
+    static unsigned long beginShrink(unsigned long version) { return version | SHRINKING; }
+    static unsigned long endShrink(unsigned long version) { return (version | SHRINKING) + SHRINKING; }
+    static void waitUntilNotShrinking(NodeType* node);
+
+    int compareKeys(const Key& a, const Key& b) const;
+    static int heightOf(NodeType* node);
+
+    // Optimistic descents; each returns RETRY if node changed under it
+    Result attemptGet(const Key& key, LinksType* node, int dir, unsigned long nodeVersion, Value* value) const;
+    Result attemptPut(const Key& key, const Value* box, LinksType* node, int dir, unsigned long nodeVersion);
+    Result attemptInsertIntoEmpty(const Key& key, const Value* box, LinksType* node, int dir,
+                                  unsigned long nodeVersion);
+    Result attemptUpdate(NodeType* node, const Value* box);
+    Result attemptRemove(const Key& key, LinksType* node, int dir, unsigned long nodeVersion);
+    Result attemptRemoveNode(LinksType* parent, NodeType* node);
+    bool attemptUnlink_nl(LinksType* parent, NodeType* node);
+
+    // Rebalancing. The _nl helpers expect their nodes to be locked and
+    // return the next node that may need fixing, or NULL when done.
+    void fixHeightAndRebalance(LinksType* start);
+    int nodeCondition(NodeType* node) const;
+    LinksType* fixHeight_nl(LinksType* node);
+    LinksType* rebalance_nl(LinksType* parent, NodeType* node);
+    LinksType* rebalanceToRight_nl(LinksType* parent, NodeType* node, NodeType* left, int hR0);
+    LinksType* rebalanceToLeft_nl(LinksType* parent, NodeType* node, NodeType* right, int hL0);
+    LinksType* rotateRight_nl(LinksType* parent, NodeType* node, NodeType* left, int hR,
+                              int hLL, NodeType* leftRight, int hLR);
+    LinksType* rotateLeft_nl(LinksType* parent, NodeType* node, int hL, NodeType* right,
+                             NodeType* rightLeft, int hRL, int hRR);
+    LinksType* rotateRightOverLeft_nl(LinksType* parent, NodeType* node, NodeType* left, int hR,
+                                      int hLL, NodeType* leftRight, int hLRL);
+    LinksType* rotateLeftOverRight_nl(LinksType* parent, NodeType* node, int hL, NodeType* right,
+                                      NodeType* rightLeft, int hRR, int hRLR);
+
+    // Deferred reclamation
+    class OperationGuard
+    {
+    public:
+        explicit OperationGuard(const ConcurrentAVLTree& tree);
+        ~OperationGuard();
+    private:
+        std::atomic<long>& counter_;
+    };
+    static std::size_t threadSlot();
+    void retire(NodeType* node);
+    void retire(const Value* box);
+    void tryAdvance_nl();
+    void freeBucket_nl(std::size_t bucket);
+
+    static const std::size_t SLOTS = 16;
+    static const std::size_t RETIRE_BATCH = 128;
+
+    // One cache line per counter so threads in different slots do not
+    // fight over it
+    struct ActiveCounter
+    {
+        std::atomic<long> count;
+        char pad[64 - sizeof(std::atomic<long>)];
+    };
+
+    LinksType rootHolder_;  // the root is rootHolder_.getRight()
+    Compare comp_;
+
+    std::atomic<unsigned long> generation_;
+    mutable ActiveCounter active_[2][SLOTS];  // running operations, by generation parity
+    std::mutex retireLock_;
+    std::vector<NodeType*> retiredNodes_[3];  // by generation % 3
+    std::vector<const Value*> retiredValues_[3];
+    std::size_t retiredCount_;
+
+private:
+    ConcurrentAVLTree(const ConcurrentAVLTree&);
+    ConcurrentAVLTree& operator=(const ConcurrentAVLTree&);
+};
+
+/*
+  ---------------------------------------------------------
+  Begin implementations for the ConcurrentAVLNode classes.
+  ---------------------------------------------------------
+*/
+
+template<class Key, class Value>
+ConcurrentAVLLinks<Key, Value>::ConcurrentAVLLinks() :
+    version_(0),
+    left_(NULL),
+    right_(NULL),
+    lock_()
+{
+}
+
+/**
+* Sets the left child if dir is negative, otherwise the right.
+*/
+template<class Key, class Value>
+void ConcurrentAVLLinks<Key, Value>::setChild(int dir, ConcurrentAVLNode<Key, Value>* child)
+{
+    if (dir < 0) {
+        setLeft(child);
+    }
+    else {
+        setRight(child);
+    }
+}
+
+/**
+* A new leaf holding value, which the node does not own (the tree frees
+* value boxes through its retire lists).
+*/
+template<class Key, class Value>
+ConcurrentAVLNode<Key, Value>::ConcurrentAVLNode(const Key& key, const Value* value,
+    ConcurrentAVLLinks<Key, Value>* parent) :
+    ConcurrentAVLLinks<Key, Value>(),
+    key_(key),
+    value_(value),
+    height_(1),
+    parent_(parent)
+{
+}
+
+/*
+  -------------------------------------------------------
+  End implementations for the ConcurrentAVLNode classes.
+  -------------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the ConcurrentAVLTree class.
+  -----------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree() :
+    rootHolder_(),
+    comp_(),
+    generation_(0),
+    retireLock_(),
+    retiredCount_(0)
+{
+    for (std::size_t i = 0; i < SLOTS; ++i) {
+        active_[0][i].count.store(0);
+        active_[1][i].count.store(0);
+    }
+}
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::ConcurrentAVLTree(const Compare& comp) :
+    rootHolder_(),
+    comp_(comp),
+    generation_(0),
+    retireLock_(),
+    retiredCount_(0)
+{
+    for (std::size_t i = 0; i < SLOTS; ++i) {
+        active_[0][i].count.store(0);
+        active_[1][i].count.store(0);
+    }
+}
+
+/**
+* Frees every node and value, linked or retired. No other thread may be
+* using the tree.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::~ConcurrentAVLTree()
+{
+    for (std::size_t i = 0; i < 3; ++i) {
+        freeBucket_nl(i);
+    }
+    std::vector<NodeType*> pending;
+    if (rootHolder_.getRight() != NULL) {
+        pending.push_back(rootHolder_.getRight());
+    }
+    while (!pending.empty()) {
+        NodeType* node = pending.back();
+        pending.pop_back();
+        if (node->getLeft() != NULL) {
+            pending.push_back(node->getLeft());
+        }
+        if (node->getRight() != NULL) {
+            pending.push_back(node->getRight());
+        }
+        delete node->getValue();
+        delete node;
+    }
+}
+
+/**
+* Inserts the pair, overwriting the value if the key exists.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    OperationGuard guard(*this);
+    const Value* box = new Value(keyValuePair.second);
+    while (attemptPut(keyValuePair.first, box, &rootHolder_, 1, 0) == RETRY) {
+    }
+}
+
+/**
+* Removes key, returning whether it was present.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    OperationGuard guard(*this);
+    Result result;
+    while ((result = attemptRemove(key, &rootHolder_, 1, 0)) == RETRY) {
+    }
+    return result == FOUND;
+}
+
+/**
+* Copies the value stored under key into value and returns true, or
+* returns false if key is absent. Takes no locks.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::find(const Key& key, Value& value) const
+{
+    OperationGuard guard(*this);
+    Result result;
+    while ((result = attemptGet(key, const_cast<LinksType*>(&rootHolder_), 1, 0, &value)) == RETRY) {
+    }
+    return result == FOUND;
+}
+
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::contains(const Key& key) const
+{
+    OperationGuard guard(*this);
+    Result result;
+    while ((result = attemptGet(key, const_cast<LinksType*>(&rootHolder_), 1, 0, NULL)) == RETRY) {
+    }
+    return result == FOUND;
+}
+
+/**
+* Counts the keys present, skipping routing nodes. O(n).
+*/
+template<class Key, class Value, class Compare>
+std::size_t ConcurrentAVLTree<Key, Value, Compare>::size() const
+{
+    std::size_t count = 0;
+    std::vector<NodeType*> pending;
+    if (rootHolder_.getRight() != NULL) {
+        pending.push_back(rootHolder_.getRight());
+    }
+    while (!pending.empty()) {
+        NodeType* node = pending.back();
+        pending.pop_back();
+        if (node->getValue() != NULL) {
+            ++count;
+        }
+        if (node->getLeft() != NULL) {
+            pending.push_back(node->getLeft());
+        }
+        if (node->getRight() != NULL) {
+            pending.push_back(node->getRight());
+        }
+    }
+    return count;
+}
+
+/**
+* Checks that subtree heights differ by at most one everywhere and that
+* every stored height is exact, as they must be once all updates (and the
+* rebalancing they trigger) have finished.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    std::vector<NodeType*> pending;
+    if (rootHolder_.getRight() != NULL) {
+        pending.push_back(rootHolder_.getRight());
+    }
+    while (!pending.empty()) {
+        NodeType* node = pending.back();
+        pending.pop_back();
+        int leftHeight = heightOf(node->getLeft());
+        int rightHeight = heightOf(node->getRight());
+        if (leftHeight - rightHeight > 1 || rightHeight - leftHeight > 1 ||
+            node->getHeight() != 1 + std::max(leftHeight, rightHeight)) {
+            return false;
+        }
+        if (node->getLeft() != NULL) {
+            pending.push_back(node->getLeft());
+        }
+        if (node->getRight() != NULL) {
+            pending.push_back(node->getRight());
+        }
+    }
+    return true;
+}
+
+/**
+* Waits for the rotation shrinking node to finish. The rotating thread
+* holds node's lock, so after a short spin we just queue on it.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::waitUntilNotShrinking(NodeType* node)
+{
+    unsigned long version = node->getVersion();
+    if (!isShrinking(version)) {
+        return;
+    }
+    for (int i = 0; i < 100; ++i) {
+        if (node->getVersion() != version) {
+            return;
+        }
+    }
+    std::lock_guard<std::mutex> wait(node->getLock());
+}
+
+/**
+* Returns -1, 0 or 1 as a sorts before, with or after b.
+*/
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::compareKeys(const Key& a, const Key& b) const
+{
+    if (comp_(a, b)) {
+        return -1;
+    }
+    if (comp_(b, a)) {
+        return 1;
+    }
+    return 0;
+}
+
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::heightOf(NodeType* node)
+{
+    return (node == NULL) ? 0 : node->getHeight();
+}
+
+/**
+* Looks for key in node's dir subtree. nodeVersion is node's version when
+* we decided key must lie there; if it changes, keys may have moved out
+* and the caller retries from higher up.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Result
+ConcurrentAVLTree<Key, Value, Compare>::attemptGet(const Key& key, LinksType* node, int dir,
+    unsigned long nodeVersion, Value* value) const
+{
+    while (true) {
+        NodeType* child = node->getChild(dir);
+        if (node->getVersion() != nodeVersion) {
+            return RETRY;
+        }
+        if (child == NULL) {
+            return NOT_FOUND;
+        }
+
+        int nextDir = compareKeys(key, child->getKey());
+        if (nextDir == 0) {
+            const Value* box = child->getValue();
+            if (box == NULL) {
+                return NOT_FOUND;
+            }
+            if (value != NULL) {
+                *value = *box;
+            }
+            return FOUND;
+        }
+
+        unsigned long childVersion = child->getVersion();
+        if (isShrinking(childVersion)) {
+            waitUntilNotShrinking(child);
+        }
+        else if (!isUnlinked(childVersion) && child == node->getChild(dir)) {
+            // child was still node's child after we read its version
+            if (node->getVersion() != nodeVersion) {
+                return RETRY;
+            }
+            Result result = attemptGet(key, child, nextDir, childVersion, value);
+            if (result != RETRY) {
+                return result;
+            }
+        }
+    }
+}
+
+/**
+* Puts box under key somewhere in node's dir subtree.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Result
+ConcurrentAVLTree<Key, Value, Compare>::attemptPut(const Key& key, const Value* box,
+    LinksType* node, int dir, unsigned long nodeVersion)
+{
+    while (true) {
+        NodeType* child = node->getChild(dir);
+        if (node->getVersion() != nodeVersion) {
+            return RETRY;
+        }
+
+        Result result = RETRY;
+        if (child == NULL) {
+            result = attemptInsertIntoEmpty(key, box, node, dir, nodeVersion);
+        }
+        else {
+            int nextDir = compareKeys(key, child->getKey());
+            if (nextDir == 0) {
+                result = attemptUpdate(child, box);
+            }
+            else {
+                unsigned long childVersion = child->getVersion();
+                if (isShrinking(childVersion)) {
+                    waitUntilNotShrinking(child);
+                }
+                else if (!isUnlinked(childVersion) && child == node->getChild(dir)) {
+                    if (node->getVersion() != nodeVersion) {
+                        return RETRY;
+                    }
+                    result = attemptPut(key, box, child, nextDir, childVersion);
+                }
+            }
+        }
+        if (result != RETRY) {
+            return result;
+        }
+    }
+}
+
+/**
+* Links a new leaf as node's dir child, if that slot is still empty and
+* node has not changed.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Result
+ConcurrentAVLTree<Key, Value, Compare>::attemptInsertIntoEmpty(const Key& key, const Value* box,
+    LinksType* node, int dir, unsigned long nodeVersion)
+{
+    {
+        std::lock_guard<std::mutex> lock(node->getLock());
+        if (node->getVersion() != nodeVersion || node->getChild(dir) != NULL) {
+            return RETRY;
+        }
+        node->setChild(dir, new NodeType(key, box, node));
+    }
+    fixHeightAndRebalance(node);
+    return FOUND;
+}
+
+/**
+* Swaps box into a node already holding the key (or routing for it).
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Result
+ConcurrentAVLTree<Key, Value, Compare>::attemptUpdate(NodeType* node, const Value* box)
+{
+    const Value* old;
+    {
+        std::lock_guard<std::mutex> lock(node->getLock());
+        if (isUnlinked(node->getVersion())) {
+            return RETRY;
+        }
+        old = node->exchangeValue(box);
+    }
+    if (old != NULL) {
+        retire(old);
+    }
+    return FOUND;
+}
+
+/**
+* Removes key from node's dir subtree.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Result
+ConcurrentAVLTree<Key, Value, Compare>::attemptRemove(const Key& key, LinksType* node, int dir,
+    unsigned long nodeVersion)
+{
+    while (true) {
+        NodeType* child = node->getChild(dir);
+        if (node->getVersion() != nodeVersion) {
+            return RETRY;
+        }
+        if (child == NULL) {
+            return NOT_FOUND;
+        }
+
+        Result result = RETRY;
+        int nextDir = compareKeys(key, child->getKey());
+        if (nextDir == 0) {
+            result = attemptRemoveNode(node, child);
+        }
+        else {
+            unsigned long childVersion = child->getVersion();
+            if (isShrinking(childVersion)) {
+                waitUntilNotShrinking(child);
+            }
+            else if (!isUnlinked(childVersion) && child == node->getChild(dir)) {
+                if (node->getVersion() != nodeVersion) {
+                    return RETRY;
+                }
+                result = attemptRemove(key, child, nextDir, childVersion);
+            }
+        }
+        if (result != RETRY) {
+            return result;
+        }
+    }
+}
+
+/**
+* Removes node's key. A node with at most one child is unlinked under its
+* parent's lock; one with two children just becomes a routing node.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::Result
+ConcurrentAVLTree<Key, Value, Compare>::attemptRemoveNode(LinksType* parent, NodeType* node)
+{
+    if (node->getValue() == NULL) {
+        return NOT_FOUND;
+    }
+
+    const Value* old;
+    if (node->getLeft() == NULL || node->getRight() == NULL) {
+        {
+            std::lock_guard<std::mutex> parentLock(parent->getLock());
+            if (isUnlinked(parent->getVersion()) || node->getParent() != parent) {
+                return RETRY;
+            }
+            std::lock_guard<std::mutex> nodeLock(node->getLock());
+            old = node->getValue();
+            if (old == NULL) {
+                return NOT_FOUND;
+            }
+            if (!attemptUnlink_nl(parent, node)) {
+                return RETRY;
+            }
+        }
+        retire(old);
+        fixHeightAndRebalance(parent);
+        return FOUND;
+    }
+
+    bool unlinkable;
+    {
+        std::lock_guard<std::mutex> nodeLock(node->getLock());
+        if (isUnlinked(node->getVersion())) {
+            return RETRY;
+        }
+        old = node->exchangeValue(NULL);
+        if (old == NULL) {
+            return NOT_FOUND;
+        }
+        unlinkable = (node->getLeft() == NULL || node->getRight() == NULL);
+    }
+    retire(old);
+    if (unlinkable) {
+        // A child went away since we looked; unlink the routing node now
+        fixHeightAndRebalance(node);
+    }
+    return FOUND;
+}
+
+/**
+* Splices node (with at most one child) out from under parent. Both must
+* be locked. Fails if the tree changed since the caller looked.
+*/
+template<class Key, class Value, class Compare>
+bool ConcurrentAVLTree<Key, Value, Compare>::attemptUnlink_nl(LinksType* parent, NodeType* node)
+{
+    NodeType* parentLeft = parent->getLeft();
+    NodeType* parentRight = parent->getRight();
+    if (parentLeft != node && parentRight != node) {
+        return false;
+    }
+    NodeType* left = node->getLeft();
+    NodeType* right = node->getRight();
+    if (left != NULL && right != NULL) {
+        return false;
+    }
+
+    NodeType* splice = (left != NULL) ? left : right;
+    if (parentLeft == node) {
+        parent->setLeft(splice);
+    }
+    else {
+        parent->setRight(splice);
+    }
+    if (splice != NULL) {
+        splice->setParent(parent);
+    }
+    node->setVersion(UNLINKED);
+    node->setValue(NULL);
+    retire(node);
+    return true;
+}
+
+/**
+* Walks up from start fixing heights and rotating, like AVLTree's
+* insertFix/removeFix.
+*
+* A rotation can damage several nodes on the path (the nodes it moved
+* and their parent) but hands back only the deepest one, so rather than
+* stopping at the first node that needs nothing we keep checking up to
+* the root. Checking takes no locks.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::fixHeightAndRebalance(LinksType* start)
+{
+    LinksType* links = start;
+    while (links != NULL && links != &rootHolder_) {
+        NodeType* node = static_cast<NodeType*>(links);
+        if (isUnlinked(node->getVersion())) {
+            return;  // whoever unlinked it repairs from its old parent
+        }
+        int condition = nodeCondition(node);
+        if (condition == NOTHING_REQUIRED) {
+            links = node->getParent();
+            continue;
+        }
+
+        LinksType* next;
+        if (condition != UNLINK_REQUIRED && condition != REBALANCE_REQUIRED) {
+            std::lock_guard<std::mutex> nodeLock(node->getLock());
+            next = fixHeight_nl(node);
+        }
+        else {
+            LinksType* parent = node->getParent();
+            std::lock_guard<std::mutex> parentLock(parent->getLock());
+            if (isUnlinked(parent->getVersion()) || node->getParent() != parent) {
+                continue;  // node moved; look at it again
+            }
+            std::lock_guard<std::mutex> nodeLock(node->getLock());
+            next = rebalance_nl(parent, node);
+        }
+        links = (next != NULL) ? next : node->getParent();
+    }
+}
+
+/**
+* Says what node needs: unlinking (a routing node with a free child
+* slot), rotating, a new height, or nothing.
+*/
+template<class Key, class Value, class Compare>
+int ConcurrentAVLTree<Key, Value, Compare>::nodeCondition(NodeType* node) const
+{
+    NodeType* left = node->getLeft();
+    NodeType* right = node->getRight();
+    if ((left == NULL || right == NULL) && node->getValue() == NULL) {
+        return UNLINK_REQUIRED;
+    }
+
+    int height = node->getHeight();
+    int leftHeight = heightOf(left);
+    int rightHeight = heightOf(right);
+    int newHeight = 1 + std::max(leftHeight, rightHeight);
+    int balance = leftHeight - rightHeight;
+    if (balance < -1 || balance > 1) {
+        return REBALANCE_REQUIRED;
+    }
+    return (height != newHeight) ? newHeight : NOTHING_REQUIRED;
+}
+
+/**
+* Updates a locked node's height. Returns the parent if the height
+* changed, the node itself if it needs more than that, or NULL.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::LinksType*
+ConcurrentAVLTree<Key, Value, Compare>::fixHeight_nl(LinksType* links)
+{
+    if (links == &rootHolder_) {
+        return NULL;
+    }
+    NodeType* node = static_cast<NodeType*>(links);
+    int condition = nodeCondition(node);
+    switch (condition) {
+    case REBALANCE_REQUIRED:
+    case UNLINK_REQUIRED:
+        return node;
+    case NOTHING_REQUIRED:
+        return NULL;
+    default:
+        node->setHeight(condition);
+        return node->getParent();
+    }
+}
+
+/**
+* Unlinks, rotates or re-heights node, with parent and node locked.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::LinksType*
+ConcurrentAVLTree<Key, Value, Compare>::rebalance_nl(LinksType* parent, NodeType* node)
+{
+    NodeType* left = node->getLeft();
+    NodeType* right = node->getRight();
+    if ((left == NULL || right == NULL) && node->getValue() == NULL) {
+        if (attemptUnlink_nl(parent, node)) {
+            return fixHeight_nl(parent);
+        }
+        return node;
+    }
+
+    int height = node->getHeight();
+    int hL0 = heightOf(left);
+    int hR0 = heightOf(right);
+    int newHeight = 1 + std::max(hL0, hR0);
+    int balance = hL0 - hR0;
+
+    if (balance > 1) {
+        return rebalanceToRight_nl(parent, node, left, hR0);
+    }
+    if (balance < -1) {
+        return rebalanceToLeft_nl(parent, node, right, hL0);
+    }
+    if (newHeight != height) {
+        node->setHeight(newHeight);
+        return fixHeight_nl(parent);
+    }
+    return NULL;
+}
+
+/**
+* node is left-heavy: rotate right, or left-right if the left child leans
+* the other way (the zig-zag case of AVLTree::insertFix).
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::LinksType*
+ConcurrentAVLTree<Key, Value, Compare>::rebalanceToRight_nl(LinksType* parent, NodeType* node,
+    NodeType* left, int hR0)
+{
+    std::lock_guard<std::mutex> leftLock(left->getLock());
+    int hL = left->getHeight();
+    if (hL - hR0 <= 1) {
+        return node;  // changed since we looked; retry
+    }
+
+    NodeType* leftRight = left->getRight();
+    int hLL0 = heightOf(left->getLeft());
+    int hLR0 = heightOf(leftRight);
+    if (hLL0 >= hLR0) {
+        return rotateRight_nl(parent, node, left, hR0, hLL0, leftRight, hLR0);
+    }
+
+    {
+        std::lock_guard<std::mutex> leftRightLock(leftRight->getLock());
+        int hLR = leftRight->getHeight();
+        if (hLL0 >= hLR) {
+            return rotateRight_nl(parent, node, left, hR0, hLL0, leftRight, hLR);
+        }
+        int hLRL = heightOf(leftRight->getLeft());
+        int balance = hLL0 - hLRL;
+        if (balance >= -1 && balance <= 1) {
+            return rotateRightOverLeft_nl(parent, node, left, hR0, hLL0, leftRight, hLRL);
+        }
+        if (balance > 1) {
+            return leftRight;  // leftRight is itself unbalanced; fix it first
+        }
+    }
+    // The double rotation would leave left unbalanced; rotate it first
+    return rebalanceToLeft_nl(node, left, leftRight, hLL0);
+}
+
+/**
+* Mirror image of rebalanceToRight_nl.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::LinksType*
+ConcurrentAVLTree<Key, Value, Compare>::rebalanceToLeft_nl(LinksType* parent, NodeType* node,
+    NodeType* right, int hL0)
+{
+    std::lock_guard<std::mutex> rightLock(right->getLock());
+    int hR = right->getHeight();
+    if (hL0 - hR >= -1) {
+        return node;
+    }
+
+    NodeType* rightLeft = right->getLeft();
+    int hRL0 = heightOf(rightLeft);
+    int hRR0 = heightOf(right->getRight());
+    if (hRR0 >= hRL0) {
+        return rotateLeft_nl(parent, node, hL0, right, rightLeft, hRL0, hRR0);
+    }
+
+    {
+        std::lock_guard<std::mutex> rightLeftLock(rightLeft->getLock());
+        int hRL = rightLeft->getHeight();
+        if (hRR0 >= hRL) {
+            return rotateLeft_nl(parent, node, hL0, right, rightLeft, hRL, hRR0);
+        }
+        int hRLR = heightOf(rightLeft->getRight());
+        int balance = hRR0 - hRLR;
+        if (balance >= -1 && balance <= 1) {
+            return rotateLeftOverRight_nl(parent, node, hL0, right, rightLeft, hRR0, hRLR);
+        }
+        if (balance > 1) {
+            return rightLeft;
+        }
+    }
+    return rebalanceToRight_nl(node, right, rightLeft, hRR0);
+}
+
+/**
+* Rotates left up over node. node's subtree loses keys, so its version is
+* marked shrinking while the links change.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::LinksType*
+ConcurrentAVLTree<Key, Value, Compare>::rotateRight_nl(LinksType* parent, NodeType* node,
+    NodeType* left, int hR, int hLL, NodeType* leftRight, int hLR)
+{
+    unsigned long nodeVersion = node->getVersion();
+    NodeType* parentLeft = parent->getLeft();
+
+    node->setVersion(beginShrink(nodeVersion));
+
+    node->setLeft(leftRight);
+    if (leftRight != NULL) {
+        leftRight->setParent(node);
+    }
+    left->setRight(node);
+    node->setParent(left);
+    if (parentLeft == node) {
+        parent->setLeft(left);
+    }
+    else {
+        parent->setRight(left);
+    }
+    left->setParent(parent);
+
+    int newNodeHeight = 1 + std::max(hLR, hR);
+    node->setHeight(newNodeHeight);
+    left->setHeight(1 + std::max(hLL, newNodeHeight));
+
+    node->setVersion(endShrink(nodeVersion));
+
+    // Heights below were read without every lock; report what still
+    // looks off, nearest first
+    int nodeBalance = hLR - hR;
+    if (nodeBalance < -1 || nodeBalance > 1) {
+        return node;
+    }
+    if ((leftRight == NULL || hR == 0) && node->getValue() == NULL) {
+        return node;
+    }
+    int leftBalance = hLL - newNodeHeight;
+    if (leftBalance < -1 || leftBalance > 1) {
+        return left;
+    }
+    if (hLL == 0 && left->getValue() == NULL) {
+        return left;
+    }
+    return fixHeight_nl(parent);
+}
+
+/**
+* Mirror image of rotateRight_nl.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::LinksType*
+ConcurrentAVLTree<Key, Value, Compare>::rotateLeft_nl(LinksType* parent, NodeType* node,
+    int hL, NodeType* right, NodeType* rightLeft, int hRL, int hRR)
+{
+    unsigned long nodeVersion = node->getVersion();
+    NodeType* parentLeft = parent->getLeft();
+
+    node->setVersion(beginShrink(nodeVersion));
+
+    node->setRight(rightLeft);
+    if (rightLeft != NULL) {
+        rightLeft->setParent(node);
+    }
+    right->setLeft(node);
+    node->setParent(right);
+    if (parentLeft == node) {
+        parent->setLeft(right);
+    }
+    else {
+        parent->setRight(right);
+    }
+    right->setParent(parent);
+
+    int newNodeHeight = 1 + std::max(hL, hRL);
+    node->setHeight(newNodeHeight);
+    right->setHeight(1 + std::max(newNodeHeight, hRR));
+
+    node->setVersion(endShrink(nodeVersion));
+
+    int nodeBalance = hRL - hL;
+    if (nodeBalance < -1 || nodeBalance > 1) {
+        return node;
+    }
+    if ((rightLeft == NULL || hL == 0) && node->getValue() == NULL) {
+        return node;
+    }
+    int rightBalance = hRR - newNodeHeight;
+    if (rightBalance < -1 || rightBalance > 1) {
+        return right;
+    }
+    if (hRR == 0 && right->getValue() == NULL) {
+        return right;
+    }
+    return fixHeight_nl(parent);
+}
+
+/**
+* Double rotation: leftRight rises over both left and node, which both
+* lose keys.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::LinksType*
+ConcurrentAVLTree<Key, Value, Compare>::rotateRightOverLeft_nl(LinksType* parent, NodeType* node,
+    NodeType* left, int hR, int hLL, NodeType* leftRight, int hLRL)
+{
+    unsigned long nodeVersion = node->getVersion();
+    unsigned long leftVersion = left->getVersion();
+    NodeType* parentLeft = parent->getLeft();
+    NodeType* leftRightLeft = leftRight->getLeft();
+    NodeType* leftRightRight = leftRight->getRight();
+    int hLRR = heightOf(leftRightRight);
+
+    node->setVersion(beginShrink(nodeVersion));
+    left->setVersion(beginShrink(leftVersion));
+
+    node->setLeft(leftRightRight);
+    if (leftRightRight != NULL) {
+        leftRightRight->setParent(node);
+    }
+    left->setRight(leftRightLeft);
+    if (leftRightLeft != NULL) {
+        leftRightLeft->setParent(left);
+    }
+    leftRight->setLeft(left);
+    left->setParent(leftRight);
+    leftRight->setRight(node);
+    node->setParent(leftRight);
+    if (parentLeft == node) {
+        parent->setLeft(leftRight);
+    }
+    else {
+        parent->setRight(leftRight);
+    }
+    leftRight->setParent(parent);
+
+    int newNodeHeight = 1 + std::max(hLRR, hR);
+    node->setHeight(newNodeHeight);
+    int newLeftHeight = 1 + std::max(hLL, hLRL);
+    left->setHeight(newLeftHeight);
+    leftRight->setHeight(1 + std::max(newLeftHeight, newNodeHeight));
+
+    node->setVersion(endShrink(nodeVersion));
+    left->setVersion(endShrink(leftVersion));
+
+    // A routing left may have been left with one child; we hold both it
+    // and its new parent, so splice it out now
+    if ((hLL == 0 || leftRightLeft == NULL) && left->getValue() == NULL) {
+        attemptUnlink_nl(leftRight, left);
+        newLeftHeight = std::max(hLL, hLRL);
+        leftRight->setHeight(1 + std::max(newLeftHeight, newNodeHeight));
+    }
+
+    int nodeBalance = hLRR - hR;
+    if (nodeBalance < -1 || nodeBalance > 1) {
+        return node;
+    }
+    if ((leftRightRight == NULL || hR == 0) && node->getValue() == NULL) {
+        return node;
+    }
+    int topBalance = newLeftHeight - newNodeHeight;
+    if (topBalance < -1 || topBalance > 1) {
+        return leftRight;
+    }
+    return fixHeight_nl(parent);
+}
+
+/**
+* Mirror image of rotateRightOverLeft_nl.
+*/
+template<class Key, class Value, class Compare>
+typename ConcurrentAVLTree<Key, Value, Compare>::LinksType*
+ConcurrentAVLTree<Key, Value, Compare>::rotateLeftOverRight_nl(LinksType* parent, NodeType* node,
+    int hL, NodeType* right, NodeType* rightLeft, int hRR, int hRLR)
+{
+    unsigned long nodeVersion = node->getVersion();
+    unsigned long rightVersion = right->getVersion();
+    NodeType* parentLeft = parent->getLeft();
+    NodeType* rightLeftLeft = rightLeft->getLeft();
+    NodeType* rightLeftRight = rightLeft->getRight();
+    int hRLL = heightOf(rightLeftLeft);
+
+    node->setVersion(beginShrink(nodeVersion));
+    right->setVersion(beginShrink(rightVersion));
+
+    node->setRight(rightLeftLeft);
+    if (rightLeftLeft != NULL) {
+        rightLeftLeft->setParent(node);
+    }
+    right->setLeft(rightLeftRight);
+    if (rightLeftRight != NULL) {
+        rightLeftRight->setParent(right);
+    }
+    rightLeft->setRight(right);
+    right->setParent(rightLeft);
+    rightLeft->setLeft(node);
+    node->setParent(rightLeft);
+    if (parentLeft == node) {
+        parent->setLeft(rightLeft);
+    }
+    else {
+        parent->setRight(rightLeft);
+    }
+    rightLeft->setParent(parent);
+
+    int newNodeHeight = 1 + std::max(hL, hRLL);
+    node->setHeight(newNodeHeight);
+    int newRightHeight = 1 + std::max(hRLR, hRR);
+    right->setHeight(newRightHeight);
+    rightLeft->setHeight(1 + std::max(newNodeHeight, newRightHeight));
+
+    node->setVersion(endShrink(nodeVersion));
+    right->setVersion(endShrink(rightVersion));
+
+    if ((hRR == 0 || rightLeftRight == NULL) && right->getValue() == NULL) {
+        attemptUnlink_nl(rightLeft, right);
+        newRightHeight = std::max(hRLR, hRR);
+        rightLeft->setHeight(1 + std::max(newNodeHeight, newRightHeight));
+    }
+
+    int nodeBalance = hRLL - hL;
+    if (nodeBalance < -1 || nodeBalance > 1) {
+        return node;
+    }
+    if ((rightLeftLeft == NULL || hL == 0) && node->getValue() == NULL) {
+        return node;
+    }
+    int topBalance = newRightHeight - newNodeHeight;
+    if (topBalance < -1 || topBalance > 1) {
+        return rightLeft;
+    }
+    return fixHeight_nl(parent);
+}
+
+/**
+* Registers an operation with the current generation for its lifetime,
+* so nothing it might reach is freed under it.
+*/
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::OperationGuard::OperationGuard(const ConcurrentAVLTree& tree) :
+    counter_(tree.active_[tree.generation_.load() & 1][threadSlot()].count)
+{
+    counter_.fetch_add(1);
+}
+
+template<class Key, class Value, class Compare>
+ConcurrentAVLTree<Key, Value, Compare>::OperationGuard::~OperationGuard()
+{
+    counter_.fetch_sub(1);
+}
+
+/**
+* Spreads threads over the activity counters.
+*/
+template<class Key, class Value, class Compare>
+std::size_t ConcurrentAVLTree<Key, Value, Compare>::threadSlot()
+{
+    static std::atomic<std::size_t> nextSlot(0);
+    static thread_local std::size_t slot = nextSlot.fetch_add(1) % SLOTS;
+    return slot;
+}
+
+/**
+* Queues an unlinked node to be freed once no operation can reach it.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::retire(NodeType* node)
+{
+    std::lock_guard<std::mutex> lock(retireLock_);
+    retiredNodes_[generation_.load() % 3].push_back(node);
+    if (++retiredCount_ >= RETIRE_BATCH) {
+        tryAdvance_nl();
+    }
+}
+
+/**
+* Queues a replaced value box the same way.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::retire(const Value* box)
+{
+    std::lock_guard<std::mutex> lock(retireLock_);
+    retiredValues_[generation_.load() % 3].push_back(box);
+    if (++retiredCount_ >= RETIRE_BATCH) {
+        tryAdvance_nl();
+    }
+}
+
+/**
+* Moves from generation g to g + 1 if every operation that registered in
+* g - 1 has finished, and frees what was retired during g - 1.
+*
+* Anything in that bucket was unlinked before generation g began. An
+* operation that could still hold it must have started before then, so
+* it registered in g - 1 or earlier; the ones from g - 2 and before were
+* already waited out when g - 1 ended (same counter parity as g or
+* checked then), and those from g - 1 are checked here. Never blocks: if
+* some are still running we try again on a later retire.
+*/
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::tryAdvance_nl()
+{
+    unsigned long generation = generation_.load();
+    std::size_t previous = (generation + 1) & 1;
+    for (std::size_t i = 0; i < SLOTS; ++i) {
+        if (active_[previous][i].count.load() != 0) {
+            return;
+        }
+    }
+    freeBucket_nl((generation + 2) % 3);
+    generation_.store(generation + 1);
+    retiredCount_ = retiredNodes_[0].size() + retiredNodes_[1].size() + retiredNodes_[2].size() +
+                    retiredValues_[0].size() + retiredValues_[1].size() + retiredValues_[2].size();
+}
+
+template<class Key, class Value, class Compare>
+void ConcurrentAVLTree<Key, Value, Compare>::freeBucket_nl(std::size_t bucket)
+{
+    for (std::size_t i = 0; i < retiredNodes_[bucket].size(); ++i) {
+        delete retiredNodes_[bucket][i];
+    }
+    retiredNodes_[bucket].clear();
+    for (std::size_t i = 0; i < retiredValues_[bucket].size(); ++i) {
+        delete retiredValues_[bucket][i];
+    }
+    retiredValues_[bucket].clear();
+}
+
+/*
+  ---------------------------------------------------
+  End implementations for the ConcurrentAVLTree class.
+  ---------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,492 @@
+#ifndef FROZEN_BST_H
+#define FROZEN_BST_H
+
+#include <cstddef>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * A read-only ordered map laid out for fast lookups, built once from a
+ * sorted range (see BinarySearchTree::freeze()).
+ *
+ * The items sit in one contiguous array in Eytzinger (BFS) order: the root
+ * first, then its two children, then the four grandchildren and so on, so
+ * item k (counting from 1) has its children at 2k and 2k + 1. The keys are
+ * also copied into a separate array in the same order, so a descent only
+ * reads keys, and the first levels of the tree share a few cache lines
+ * instead of costing a miss per level like scattered nodes do.
+ *
+ * Searches are branchless: each level computes the next index from the
+ * comparison result instead of branching on it, and the keys four levels
+ * down are prefetched while the current level is compared. Iteration walks
+ * the implicit tree in order with the same successor rule as the node
+ * based trees, O(1) amortized per step.
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class FrozenTree
+{
+public:
+    explicit FrozenTree(const Compare& comp = Compare());
+    template<typename InputIt>
+    FrozenTree(InputIt first, InputIt last, const Compare& comp = Compare());
+
+    /**
+    * A bidirectional iterator over the items in key order. Items cannot be
+    * modified through it. Decrementing end() moves to the largest item.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const std::pair<const Key, Value>* pointer;
+        typedef const std::pair<const Key, Value>& reference;
+
+        const_iterator();
+
+        const std::pair<const Key, Value>& operator*() const;
+        const std::pair<const Key, Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class FrozenTree<Key, Value, Compare>;
+        const_iterator(std::size_t index, const FrozenTree<Key, Value, Compare>* tree);
+
+        std::size_t index_;  // 1-based Eytzinger index, 0 for end()
+        const FrozenTree<Key, Value, Compare>* tree_;
+    };
+    typedef const_iterator iterator;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator find(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+    std::size_t size() const;
+    bool empty() const;
+
+    // Heterogeneous lookup, only available when Compare is transparent
+    template<typename K, typename C = Compare, typename = typename C::is_transparent>
+    const_iterator find(const K& key) const;
+
+protected:
+    template<typename K>
+    std::size_t lowerBoundIndex(const K& key) const;
+    template<typename K>
+    std::size_t upperBoundIndex(const K& key) const;
+    template<typename K>
+    std::size_t findIndex(const K& key) const;
+    static std::size_t stripRightTurns(std::size_t index);
+    static std::size_t nextIndex(std::size_t index, std::size_t n);
+    static std::size_t prevIndex(std::size_t index, std::size_t n);
+    void prefetch(std::size_t index) const;
+
+    // Both in Eytzinger order; slot k - 1 holds item k
+    std::vector<Key> keys_;
+    std::vector<std::pair<const Key, Value> > items_;
+    Compare comp_;
+};
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the FrozenTree::const_iterator class.
+  -----------------------------------------------------
+*/
+
+/**
+* Creates an iterator that compares equal to no valid position.
+*/
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare>::const_iterator::const_iterator() :
+    index_(0),
+    tree_(NULL)
+{
+}
+
+/**
+* Creates an iterator at the given Eytzinger index of tree.
+*/
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare>::const_iterator::const_iterator(
+    std::size_t index, const FrozenTree<Key, Value, Compare>* tree) :
+    index_(index),
+    tree_(tree)
+{
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key, Value>&
+FrozenTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return tree_->items_[index_ - 1];
+}
+
+template<typename Key, typename Value, typename Compare>
+const std::pair<const Key, Value>*
+FrozenTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return &(tree_->items_[index_ - 1]);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return index_ == rhs.index_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return index_ != rhs.index_;
+}
+
+/**
+* Advances to the next item in key order.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator&
+FrozenTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    index_ = nextIndex(index_, tree_->size());
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/**
+* Steps back to the previous item in key order; from end() this is the
+* largest item.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator&
+FrozenTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    index_ = prevIndex(index_, tree_->size());
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the FrozenTree::const_iterator class.
+  -----------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the FrozenTree class.
+  -----------------------------------------------------
+*/
+
+/**
+* Creates an empty tree.
+*/
+template<typename Key, typename Value, typename Compare>
+FrozenTree<Key, Value, Compare>::FrozenTree(const Compare& comp) :
+    keys_(),
+    items_(),
+    comp_(comp)
+{
+}
+
+/**
+* Builds the tree from [first, last), which must already be sorted by comp
+* with no repeated keys, as a BinarySearchTree's items are. The items are
+* copied in key order into the slots an in-order walk of the implicit tree
+* visits, in O(n).
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename InputIt>
+FrozenTree<Key, Value, Compare>::FrozenTree(InputIt first, InputIt last, const Compare& comp) :
+    keys_(),
+    items_(),
+    comp_(comp)
+{
+    std::vector<std::pair<Key, Value> > sorted(first, last);
+    std::size_t n = sorted.size();
+    if (n == 0) {
+        return;
+    }
+
+    // rank[k - 1] is the sorted position of Eytzinger slot k
+    std::vector<std::size_t> rank(n);
+    std::size_t index = 1;
+    while (2 * index <= n) {
+        index *= 2;
+    }
+    for (std::size_t r = 0; r < n; ++r) {
+        rank[index - 1] = r;
+        index = nextIndex(index, n);
+    }
+
+    keys_.reserve(n);
+    items_.reserve(n);
+    for (std::size_t k = 0; k < n; ++k) {
+        keys_.push_back(sorted[rank[k]].first);
+    }
+    for (std::size_t k = 0; k < n; ++k) {
+        items_.push_back(std::pair<const Key, Value>(std::move(sorted[rank[k]].first),
+                                                     std::move(sorted[rank[k]].second)));
+    }
+}
+
+/**
+* Returns an iterator to the smallest item, the leftmost slot of the
+* implicit tree.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::begin() const
+{
+    if (items_.empty()) {
+        return end();
+    }
+    std::size_t index = 1;
+    while (2 * index <= items_.size()) {
+        index *= 2;
+    }
+    return const_iterator(index, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(0, this);
+}
+
+/**
+* Returns an iterator to the item with the given key, or end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::find(const Key& key) const
+{
+    return const_iterator(findIndex(key), this);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value, typename Compare>
+Value const & FrozenTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    std::size_t index = findIndex(key);
+    if(index == 0) throw std::out_of_range("Invalid key");
+    return items_[index - 1].second;
+}
+
+/**
+* Returns an iterator to the first item whose key is not less than key,
+* or end() if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return const_iterator(lowerBoundIndex(key), this);
+}
+
+/**
+* Returns an iterator to the first item whose key is greater than key,
+* or end() if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return const_iterator(upperBoundIndex(key), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenTree<Key, Value, Compare>::size() const
+{
+    return items_.size();
+}
+
+template<typename Key, typename Value, typename Compare>
+bool FrozenTree<Key, Value, Compare>::empty() const
+{
+    return items_.empty();
+}
+
+/**
+* Heterogeneous find for transparent comparators.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K, typename C, typename>
+typename FrozenTree<Key, Value, Compare>::const_iterator
+FrozenTree<Key, Value, Compare>::find(const K& key) const
+{
+    return const_iterator(findIndex(key), this);
+}
+
+/**
+* Returns the slot of the first key not less than key, or 0. The descent
+* goes right (2k + 1) exactly when the key at k is less than key; the
+* answer is the last slot where it went left, which is found by dropping
+* the trailing right turns and the left turn before them from the index.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+std::size_t FrozenTree<Key, Value, Compare>::lowerBoundIndex(const K& key) const
+{
+    const std::size_t n = keys_.size();
+    const Key* keys = keys_.data();
+    std::size_t index = 1;
+    while (index <= n) {
+        prefetch(index);
+        index = 2 * index + static_cast<std::size_t>(comp_(keys[index - 1], key));
+    }
+    return stripRightTurns(index);
+}
+
+/**
+* Returns the slot of the first key greater than key, or 0.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+std::size_t FrozenTree<Key, Value, Compare>::upperBoundIndex(const K& key) const
+{
+    const std::size_t n = keys_.size();
+    const Key* keys = keys_.data();
+    std::size_t index = 1;
+    while (index <= n) {
+        prefetch(index);
+        index = 2 * index + static_cast<std::size_t>(!comp_(key, keys[index - 1]));
+    }
+    return stripRightTurns(index);
+}
+
+/**
+* Returns the slot holding key, or 0 if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+template<typename K>
+std::size_t FrozenTree<Key, Value, Compare>::findIndex(const K& key) const
+{
+    std::size_t index = lowerBoundIndex(key);
+    if (index != 0 && comp_(key, keys_[index - 1])) {
+        return 0;
+    }
+    return index;
+}
+
+/**
+* Climbs from index past every step taken as a right child, then one more
+* step: the result is the nearest ancestor index sits to the left of, or
+* 0 if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenTree<Key, Value, Compare>::stripRightTurns(std::size_t index)
+{
+#if defined(__GNUC__)
+    return index >> (__builtin_ctzll(~static_cast<unsigned long long>(index)) + 1);
+#else
+    while (index & 1) {
+        index >>= 1;
+    }
+    return index >> 1;
+#endif
+}
+
+/**
+* Returns the slot after index in a tree of n items, in key order, or 0
+* past the largest: the leftmost slot of the right subtree if there is
+* one, else the nearest ancestor index is left of.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenTree<Key, Value, Compare>::nextIndex(std::size_t index, std::size_t n)
+{
+    if (2 * index + 1 <= n) {
+        index = 2 * index + 1;
+        while (2 * index <= n) {
+            index *= 2;
+        }
+        return index;
+    }
+    return stripRightTurns(index);
+}
+
+/**
+* Returns the slot before index in a tree of n items, in key order, or 0
+* before the smallest; from 0 (end()) it returns the largest.
+*/
+template<typename Key, typename Value, typename Compare>
+std::size_t FrozenTree<Key, Value, Compare>::prevIndex(std::size_t index, std::size_t n)
+{
+    if (index == 0) {
+        if (n == 0) {
+            return 0;
+        }
+        index = 1;
+        while (2 * index + 1 <= n) {
+            index = 2 * index + 1;
+        }
+        return index;
+    }
+    if (2 * index <= n) {
+        index = 2 * index;
+        while (2 * index + 1 <= n) {
+            index = 2 * index + 1;
+        }
+        return index;
+    }
+    while ((index & 1) == 0) {
+        index >>= 1;
+    }
+    return index >> 1;
+}
+
+/**
+* Asks for the keys four levels below index, the 16 slots starting at
+* 16 * index, which sit next to each other in keys_. By the time the
+* descent gets there they are usually in cache.
+*/
+template<typename Key, typename Value, typename Compare>
+void FrozenTree<Key, Value, Compare>::prefetch(std::size_t index) const
+{
+#if defined(__GNUC__)
+    if (16 * index <= keys_.size()) {
+        __builtin_prefetch(keys_.data() + 16 * index - 1);
+    }
+#else
+    (void)index;
+#endif
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the FrozenTree class.
+  -----------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,842 @@
+#ifndef INDEXED_AVLBST_H
+#define INDEXED_AVLBST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "avl_rebalance.h"
+
+/**
+* An AVL tree whose nodes live in parallel arrays and refer to each other
+* by 32-bit index instead of by pointer, for maps of up to 2^32 - 1
+* entries.
+*
+* Node i's key is keys_[i], its value values_[i], its children
+* links_[2i] and links_[2i + 1], and its parent and balance sit in
+* parents_ and balances_. A search only reads keys_ and links_: both
+* links of a node share a cache line, the values are never touched on
+* the way down, and a link costs 4 bytes instead of 8. For 8-byte keys
+* and values a node takes 29 bytes in all, with no per-node allocation
+* header or padding. Removed slots are kept on a free list (chained
+* through parents_) and reused.
+*
+* Key and Value must be default constructible and assignable: a removed
+* entry's slot is reset to Key()/Value() so it releases what it held. The
+* arrays grow like std::vector, so references to values may be
+* invalidated by insert (iterators are not, being indices). Iterating
+* yields pairs of references, std::pair<const Key&, Value&>, since a key
+* and its value are not stored side by side.
+*/
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class IndexedAVLTree
+{
+public:
+    IndexedAVLTree();
+    explicit IndexedAVLTree(const Compare& comp);
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    void reserve(std::size_t entries);
+    bool empty() const;
+    std::size_t size() const;
+    bool isBalanced() const;
+
+    class const_iterator;
+
+    /**
+    * A bidirectional iterator over the entries in key order. It holds a
+    * node index, so it stays valid when the arrays grow; only removing
+    * its own entry invalidates it. Decrementing end() moves to the
+    * largest entry.
+    */
+    class iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key&, Value&> reference;
+
+        // What operator-> returns: holds the pair of references so that
+        // it->first and it->second work
+        class pointer
+        {
+        public:
+            explicit pointer(const reference& item) : item_(item) { }
+            const reference* operator->() const { return &item_; }
+        private:
+            reference item_;
+        };
+
+        iterator();
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const iterator& rhs) const;
+        bool operator!=(const iterator& rhs) const;
+
+        iterator& operator++();
+        iterator operator++(int);
+        iterator& operator--();
+        iterator operator--(int);
+
+    protected:
+        friend class IndexedAVLTree<Key, Value, Compare>;
+        friend class const_iterator;
+        iterator(std::uint32_t node, IndexedAVLTree<Key, Value, Compare>* tree);
+
+        std::uint32_t current_;  // NIL for end()
+        IndexedAVLTree<Key, Value, Compare>* tree_;
+    };
+
+    /**
+    * The read-only version of iterator, yielding
+    * std::pair<const Key&, const Value&>. An iterator converts to it.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef std::pair<const Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef std::pair<const Key&, const Value&> reference;
+
+        class pointer
+        {
+        public:
+            explicit pointer(const reference& item) : item_(item) { }
+            const reference* operator->() const { return &item_; }
+        private:
+            reference item_;
+        };
+
+        const_iterator();
+        const_iterator(const iterator& it);
+
+        reference operator*() const;
+        pointer operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class IndexedAVLTree<Key, Value, Compare>;
+        const_iterator(std::uint32_t node, const IndexedAVLTree<Key, Value, Compare>* tree);
+
+        std::uint32_t current_;  // NIL for end()
+        const IndexedAVLTree<Key, Value, Compare>* tree_;
+    };
+
+    iterator begin();
+    iterator end();
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator cbegin() const;
+    const_iterator cend() const;
+    iterator find(const Key& key);
+    const_iterator find(const Key& key) const;
+    Value& operator[](const Key& key);
+    Value const & operator[](const Key& key) const;
+    iterator lower_bound(const Key& key);
+    iterator upper_bound(const Key& key);
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+
+protected:
+    typedef std::uint32_t Index;
+    static const Index NIL = 0xFFFFFFFFu;
+    static const Index LEFT = 0;
+    static const Index RIGHT = 1;
+
+    // Link accessors
+    Index left(Index node) const { return links_[2 * static_cast<std::size_t>(node) + LEFT]; }
+    Index right(Index node) const { return links_[2 * static_cast<std::size_t>(node) + RIGHT]; }
+    Index parent(Index node) const { return parents_[node]; }
+    int8_t balance(Index node) const { return balances_[node]; }
+    void setLeft(Index node, Index child) { links_[2 * static_cast<std::size_t>(node) + LEFT] = child; }
+    void setRight(Index node, Index child) { links_[2 * static_cast<std::size_t>(node) + RIGHT] = child; }
+    void setParent(Index node, Index up) { parents_[node] = up; }
+    void setBalance(Index node, int balance) { balances_[node] = static_cast<int8_t>(balance); }
+
+    Index findNode(const Key& key) const;
+    Index boundNode(const Key& key, bool upper) const;
+    Index smallestNode() const;
+    Index largestNode() const;
+    Index successor(Index node) const;
+    Index predecessor(Index node) const;
+
+    Index createNode(const Key& key, const Value& value, Index up);
+    void destroyNode(Index node);
+
+    // How AVLRebalancer, shared with CompactAVLTree, follows and changes
+    // the links held in this tree's arrays
+    struct Links
+    {
+        typedef Index Handle;
+        explicit Links(IndexedAVLTree<Key, Value, Compare>* tree) : tree(tree) { }
+        static Index none() { return NIL; }
+        Index left(Index node) const { return tree->left(node); }
+        Index right(Index node) const { return tree->right(node); }
+        Index parent(Index node) const { return tree->parent(node); }
+        int balance(Index node) const { return tree->balance(node); }
+        void setLeft(Index node, Index child) const { tree->setLeft(node, child); }
+        void setRight(Index node, Index child) const { tree->setRight(node, child); }
+        void setParent(Index node, Index up) const { tree->setParent(node, up); }
+        void setBalance(Index node, int balance) const { tree->setBalance(node, balance); }
+        void setRoot(Index node) const { tree->root_ = node; }
+        IndexedAVLTree<Key, Value, Compare>* tree;
+    };
+    AVLRebalancer<Links> rebalancer();
+    int checkHeight(Index node, bool& balanced) const;
+
+protected:
+    std::vector<Key> keys_;
+    std::vector<Index> links_;     // left and right child of node i at 2i and 2i + 1
+    std::vector<Value> values_;
+    std::vector<Index> parents_;   // for free slots, the next free slot
+    std::vector<int8_t> balances_;
+    Index root_;
+    Index free_;                   // first free slot, or NIL
+    std::size_t size_;
+    Compare comp_;
+};
+
+/*
+  ------------------------------------------------------------
+  Begin implementations for the IndexedAVLTree::iterator class.
+  ------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+IndexedAVLTree<Key, Value, Compare>::iterator::iterator() :
+    current_(NIL),
+    tree_(NULL)
+{
+}
+
+template<typename Key, typename Value, typename Compare>
+IndexedAVLTree<Key, Value, Compare>::iterator::iterator(
+    std::uint32_t node, IndexedAVLTree<Key, Value, Compare>* tree) :
+    current_(node),
+    tree_(tree)
+{
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::iterator::reference
+IndexedAVLTree<Key, Value, Compare>::iterator::operator*() const
+{
+    return reference(tree_->keys_[current_], tree_->values_[current_]);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::iterator::pointer
+IndexedAVLTree<Key, Value, Compare>::iterator::operator->() const
+{
+    return pointer(**this);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool IndexedAVLTree<Key, Value, Compare>::iterator::operator==(const iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool IndexedAVLTree<Key, Value, Compare>::iterator::operator!=(const iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::iterator&
+IndexedAVLTree<Key, Value, Compare>::iterator::operator++()
+{
+    current_ = tree_->successor(current_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::iterator
+IndexedAVLTree<Key, Value, Compare>::iterator::operator++(int)
+{
+    iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::iterator&
+IndexedAVLTree<Key, Value, Compare>::iterator::operator--()
+{
+    current_ = (current_ == NIL) ? tree_->largestNode() : tree_->predecessor(current_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::iterator
+IndexedAVLTree<Key, Value, Compare>::iterator::operator--(int)
+{
+    iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+  ----------------------------------------------------------
+  End implementations for the IndexedAVLTree::iterator class.
+  ----------------------------------------------------------
+*/
+
+/*
+  ----------------------------------------------------------------
+  Begin implementations for the IndexedAVLTree::const_iterator class.
+  ----------------------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+IndexedAVLTree<Key, Value, Compare>::const_iterator::const_iterator() :
+    current_(NIL),
+    tree_(NULL)
+{
+}
+
+template<typename Key, typename Value, typename Compare>
+IndexedAVLTree<Key, Value, Compare>::const_iterator::const_iterator(const iterator& it) :
+    current_(it.current_),
+    tree_(it.tree_)
+{
+}
+
+template<typename Key, typename Value, typename Compare>
+IndexedAVLTree<Key, Value, Compare>::const_iterator::const_iterator(
+    std::uint32_t node, const IndexedAVLTree<Key, Value, Compare>* tree) :
+    current_(node),
+    tree_(tree)
+{
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::const_iterator::reference
+IndexedAVLTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return reference(tree_->keys_[current_], tree_->values_[current_]);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::const_iterator::pointer
+IndexedAVLTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return pointer(**this);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool IndexedAVLTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return current_ == rhs.current_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool IndexedAVLTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return current_ != rhs.current_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::const_iterator&
+IndexedAVLTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    current_ = tree_->successor(current_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::const_iterator
+IndexedAVLTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::const_iterator&
+IndexedAVLTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    current_ = (current_ == NIL) ? tree_->largestNode() : tree_->predecessor(current_);
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::const_iterator
+IndexedAVLTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --(*this);
+    return old;
+}
+
+/*
+  --------------------------------------------------------------
+  End implementations for the IndexedAVLTree::const_iterator class.
+  --------------------------------------------------------------
+*/
+
+/*
+  ---------------------------------------------------
+  Begin implementations for the IndexedAVLTree class.
+  ---------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+IndexedAVLTree<Key, Value, Compare>::IndexedAVLTree() :
+    root_(NIL),
+    free_(NIL),
+    size_(0),
+    comp_()
+{
+}
+
+template<typename Key, typename Value, typename Compare>
+IndexedAVLTree<Key, Value, Compare>::IndexedAVLTree(const Compare& comp) :
+    root_(NIL),
+    free_(NIL),
+    size_(0),
+    comp_(comp)
+{
+}
+
+/**
+* Removes every entry and gives the arrays' memory back.
+*/
+template<typename Key, typename Value, typename Compare>
+void IndexedAVLTree<Key, Value, Compare>::clear()
+{
+    std::vector<Key>().swap(keys_);
+    std::vector<Index>().swap(links_);
+    std::vector<Value>().swap(values_);
+    std::vector<Index>().swap(parents_);
+    std::vector<int8_t>().swap(balances_);
+    root_ = NIL;
+    free_ = NIL;
+    size_ = 0;
+}
+
+/**
+* Makes room for entries nodes up front, so that loading a known number
+* of entries neither copies the arrays nor leaves spare capacity.
+*/
+template<typename Key, typename Value, typename Compare>
+void IndexedAVLTree<Key, Value, Compare>::reserve(std::size_t entries)
+{
+    if (entries >= NIL) {
+        throw std::length_error("IndexedAVLTree holds at most 2^32 - 1 entries");
+    }
+    keys_.reserve(entries);
+    links_.reserve(2 * entries);
+    values_.reserve(entries);
+    parents_.reserve(entries);
+    balances_.reserve(entries);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool IndexedAVLTree<Key, Value, Compare>::empty() const
+{
+    return size_ == 0;
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t IndexedAVLTree<Key, Value, Compare>::size() const
+{
+    return size_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::iterator
+IndexedAVLTree<Key, Value, Compare>::begin()
+{
+    return iterator(smallestNode(), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::iterator
+IndexedAVLTree<Key, Value, Compare>::end()
+{
+    return iterator(NIL, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::const_iterator
+IndexedAVLTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(smallestNode(), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::const_iterator
+IndexedAVLTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(NIL, this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::const_iterator
+IndexedAVLTree<Key, Value, Compare>::cbegin() const
+{
+    return begin();
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::const_iterator
+IndexedAVLTree<Key, Value, Compare>::cend() const
+{
+    return end();
+}
+
+/**
+* Returns an iterator to the entry with the given key, or end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::iterator
+IndexedAVLTree<Key, Value, Compare>::find(const Key& key)
+{
+    return iterator(findNode(key), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::const_iterator
+IndexedAVLTree<Key, Value, Compare>::find(const Key& key) const
+{
+    return const_iterator(findNode(key), this);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value, typename Compare>
+Value& IndexedAVLTree<Key, Value, Compare>::operator[](const Key& key)
+{
+    Index node = findNode(key);
+    if(node == NIL) throw std::out_of_range("Invalid key");
+    return values_[node];
+}
+template<typename Key, typename Value, typename Compare>
+Value const & IndexedAVLTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    Index node = findNode(key);
+    if(node == NIL) throw std::out_of_range("Invalid key");
+    return values_[node];
+}
+
+/**
+* Returns an iterator to the first entry whose key is not less than key,
+* or end() if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::iterator
+IndexedAVLTree<Key, Value, Compare>::lower_bound(const Key& key)
+{
+    return iterator(boundNode(key, false), this);
+}
+
+/**
+* Returns an iterator to the first entry whose key is greater than key,
+* or end() if there is none.
+*/
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::iterator
+IndexedAVLTree<Key, Value, Compare>::upper_bound(const Key& key)
+{
+    return iterator(boundNode(key, true), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::const_iterator
+IndexedAVLTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return const_iterator(boundNode(key, false), this);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::const_iterator
+IndexedAVLTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return const_iterator(boundNode(key, true), this);
+}
+
+/**
+* Returns the node holding key, or NIL. One Compare call per level plus
+* one at the bottom; each level picks the next link by indexing with the
+* comparison result rather than branching on it.
+*/
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::Index
+IndexedAVLTree<Key, Value, Compare>::findNode(const Key& key) const
+{
+    Index candidate = NIL;
+    Index node = root_;
+    while (node != NIL) {
+        bool goRight = !comp_(key, keys_[node]);
+        candidate = goRight ? node : candidate;
+        node = links_[2 * static_cast<std::size_t>(node) + goRight];
+    }
+    if (candidate != NIL && !comp_(keys_[candidate], key)) {
+        return candidate;
+    }
+    return NIL;
+}
+
+/**
+* Returns the node with the smallest key not less than key (or, if upper,
+* greater than key), or NIL.
+*/
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::Index
+IndexedAVLTree<Key, Value, Compare>::boundNode(const Key& key, bool upper) const
+{
+    Index candidate = NIL;
+    Index node = root_;
+    while (node != NIL) {
+        bool goLeft = upper ? comp_(key, keys_[node]) : !comp_(keys_[node], key);
+        candidate = goLeft ? node : candidate;
+        node = links_[2 * static_cast<std::size_t>(node) + !goLeft];
+    }
+    return candidate;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::Index
+IndexedAVLTree<Key, Value, Compare>::smallestNode() const
+{
+    Index node = root_;
+    while (node != NIL && left(node) != NIL) {
+        node = left(node);
+    }
+    return node;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::Index
+IndexedAVLTree<Key, Value, Compare>::largestNode() const
+{
+    Index node = root_;
+    while (node != NIL && right(node) != NIL) {
+        node = right(node);
+    }
+    return node;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::Index
+IndexedAVLTree<Key, Value, Compare>::successor(Index node) const
+{
+    if (right(node) != NIL) {
+        node = right(node);
+        while (left(node) != NIL) {
+            node = left(node);
+        }
+        return node;
+    }
+    Index up = parent(node);
+    while (up != NIL && right(up) == node) {
+        node = up;
+        up = parent(up);
+    }
+    return up;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::Index
+IndexedAVLTree<Key, Value, Compare>::predecessor(Index node) const
+{
+    if (left(node) != NIL) {
+        node = left(node);
+        while (right(node) != NIL) {
+            node = right(node);
+        }
+        return node;
+    }
+    Index up = parent(node);
+    while (up != NIL && left(up) == node) {
+        node = up;
+        up = parent(up);
+    }
+    return up;
+}
+
+/**
+* Inserts keyValuePair, or overwrites the value if its key is present.
+*/
+template<typename Key, typename Value, typename Compare>
+void IndexedAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Index candidate = NIL;
+    Index up = NIL;
+    bool isLeft = false;
+    for (Index node = root_; node != NIL; ) {
+        up = node;
+        isLeft = comp_(keyValuePair.first, keys_[node]);
+        if (isLeft) {
+            node = left(node);
+        }
+        else {
+            candidate = node;
+            node = right(node);
+        }
+    }
+    if (candidate != NIL && !comp_(keys_[candidate], keyValuePair.first)) {
+        values_[candidate] = keyValuePair.second;
+        return;
+    }
+
+    Index node = createNode(keyValuePair.first, keyValuePair.second, up);
+    if (up == NIL) {
+        root_ = node;
+    }
+    else if (isLeft) {
+        setLeft(up, node);
+    }
+    else {
+        setRight(up, node);
+    }
+    ++size_;
+    rebalancer().insertFix(node);
+}
+
+/**
+* Removes the entry with the given key, if there is one, and rebalances.
+*/
+template<typename Key, typename Value, typename Compare>
+void IndexedAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    Index node = findNode(key);
+    if (node == NIL) {
+        return;
+    }
+    AVLRebalancer<Links> fix = rebalancer();
+    if (left(node) != NIL && right(node) != NIL) {
+        fix.swapWithPredecessor(node, predecessor(node));
+    }
+
+    Index child = (left(node) != NIL) ? left(node) : right(node);
+    Index up = parent(node);
+    bool wasLeft = up != NIL && left(up) == node;
+    fix.replaceChild(up, node, child);
+    destroyNode(node);
+    --size_;
+    fix.removeFix(up, wasLeft);
+}
+
+/**
+* Returns true iff no node's subtree heights differ by more than one and
+* every stored balance matches. O(n).
+*/
+template<typename Key, typename Value, typename Compare>
+bool IndexedAVLTree<Key, Value, Compare>::isBalanced() const
+{
+    bool balanced = true;
+    checkHeight(root_, balanced);
+    return balanced;
+}
+
+template<typename Key, typename Value, typename Compare>
+int IndexedAVLTree<Key, Value, Compare>::checkHeight(Index node, bool& balanced) const
+{
+    if (node == NIL) {
+        return 0;
+    }
+    int leftHeight = checkHeight(left(node), balanced);
+    int rightHeight = checkHeight(right(node), balanced);
+    if (rightHeight - leftHeight != balance(node)) {
+        balanced = false;
+    }
+    return (leftHeight > rightHeight ? leftHeight : rightHeight) + 1;
+}
+
+/**
+* Stores a new leaf in a free slot, or at the end of the arrays. If
+* copying the key or value throws, the tree is unchanged.
+*/
+template<typename Key, typename Value, typename Compare>
+typename IndexedAVLTree<Key, Value, Compare>::Index
+IndexedAVLTree<Key, Value, Compare>::createNode(const Key& key, const Value& value, Index up)
+{
+    Index node = free_;
+    if (node != NIL) {
+        keys_[node] = key;
+        values_[node] = value;
+        free_ = parents_[node];
+    }
+    else {
+        if (keys_.size() >= NIL) {
+            throw std::length_error("IndexedAVLTree holds at most 2^32 - 1 entries");
+        }
+        node = static_cast<Index>(keys_.size());
+        // Grow every array first, so the pushes below cannot fail halfway
+        std::size_t count = keys_.size() + 1;
+        if (count > keys_.capacity()) {
+            std::size_t capacity = 2 * keys_.capacity();
+            if (capacity < count) {
+                capacity = count;
+            }
+            reserve(capacity < NIL ? capacity : NIL - 1);
+        }
+        keys_.push_back(key);
+        try {
+            values_.push_back(value);
+        }
+        catch (...) {
+            keys_.pop_back();
+            throw;
+        }
+        // (push_back takes a reference, which NIL cannot be bound to)
+        Index none = NIL;
+        links_.push_back(none);
+        links_.push_back(none);
+        parents_.push_back(none);
+        balances_.push_back(0);
+    }
+    setLeft(node, NIL);
+    setRight(node, NIL);
+    setParent(node, up);
+    setBalance(node, 0);
+    return node;
+}
+
+/**
+* Resets a removed node's key and value and puts its slot on the free list.
+*/
+template<typename Key, typename Value, typename Compare>
+void IndexedAVLTree<Key, Value, Compare>::destroyNode(Index node)
+{
+    keys_[node] = Key();
+    values_[node] = Value();
+    parents_[node] = free_;
+    free_ = node;
+}
+
+template<typename Key, typename Value, typename Compare>
+AVLRebalancer<typename IndexedAVLTree<Key, Value, Compare>::Links>
+IndexedAVLTree<Key, Value, Compare>::rebalancer()
+{
+    return AVLRebalancer<Links>(Links(this));
+}
+
+/*
+  -------------------------------------------------
+  End implementations for the IndexedAVLTree class.
+  -------------------------------------------------
+*/
+
+#endif
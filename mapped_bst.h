@@ -0,0 +1,440 @@
+#ifndef MAPPED_BST_H
+#define MAPPED_BST_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <vector>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "bst.h"
+
+/**
+ * An on-disk tree format that is queried in place through mmap.
+ *
+ * writeMappedTree() stores a BinarySearchTree (or AVLTree) of trivially
+ * copyable keys and values as a fixed header followed by one record per
+ * item. Records are in key order, so a range scan reads the file front to
+ * back. There are no child links: a record's position is its only
+ * address, so the file means the same thing wherever it is mapped, and
+ * lookups binary search the records in O(log n) whatever shape the tree
+ * had in memory.
+ *
+ * MappedTree maps such a file read-only and answers find, lower_bound,
+ * upper_bound and in-order iteration straight from the mapped pages, so
+ * opening one costs a header check no matter how large the tree is. Pages
+ * are read in by the kernel as lookups touch them. Nothing in a record is
+ * used as an index, so a damaged file can give wrong answers but never
+ * makes a lookup read outside the mapping.
+ *
+ * Files are only meant to be read by builds with the same key and value
+ * layout and byte order; the header records both and MappedTree refuses
+ * files that do not match.
+ */
+
+/**
+* The first 64 bytes of a mapped tree file.
+*/
+struct MappedTreeHeader
+{
+    char magic[8];           // "BSTMAP" and two zero bytes
+    std::uint32_t version;
+    std::uint32_t byteOrder; // BYTE_ORDER_MARK as written by the writer
+    std::uint64_t keySize;
+    std::uint64_t valueSize;
+    std::uint64_t recordSize;
+    std::uint64_t recordAlign;
+    std::uint64_t count;     // number of records
+    std::uint64_t reserved;  // zero; pads the header to 64 bytes
+
+    static const std::uint32_t VERSION = 2;
+    static const std::uint32_t BYTE_ORDER_MARK = 0x01020304;
+};
+
+/**
+* One item of a mapped tree. The item fields are named like std::pair's
+* so iterators read the same as those of the in-memory trees.
+*/
+template <typename Key, typename Value>
+struct MappedTreeRecord
+{
+    Key first;
+    Value second;
+};
+
+template <typename Key, typename Value, typename Compare>
+void writeMappedTree(const BinarySearchTree<Key, Value, Compare>& tree, const std::string& path);
+
+/**
+ * A read-only view of a tree file written by writeMappedTree().
+ */
+template <typename Key, typename Value, typename Compare = std::less<Key> >
+class MappedTree
+{
+public:
+    typedef MappedTreeRecord<Key, Value> Record;
+
+    explicit MappedTree(const std::string& path, const Compare& comp = Compare());
+    ~MappedTree();
+
+    /**
+    * A bidirectional iterator over the records in key order. Since the
+    * records are stored in key order, stepping is just moving along the
+    * array. Decrementing end() moves to the largest item.
+    */
+    class const_iterator
+    {
+    public:
+        typedef std::bidirectional_iterator_tag iterator_category;
+        typedef MappedTreeRecord<Key, Value> value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const MappedTreeRecord<Key, Value>* pointer;
+        typedef const MappedTreeRecord<Key, Value>& reference;
+
+        const_iterator();
+
+        const MappedTreeRecord<Key, Value>& operator*() const;
+        const MappedTreeRecord<Key, Value>* operator->() const;
+
+        bool operator==(const const_iterator& rhs) const;
+        bool operator!=(const const_iterator& rhs) const;
+
+        const_iterator& operator++();
+        const_iterator operator++(int);
+        const_iterator& operator--();
+        const_iterator operator--(int);
+
+    protected:
+        friend class MappedTree<Key, Value, Compare>;
+        explicit const_iterator(const MappedTreeRecord<Key, Value>* record);
+
+        const MappedTreeRecord<Key, Value>* record_;
+    };
+    typedef const_iterator iterator;
+
+    const_iterator begin() const;
+    const_iterator end() const;
+    const_iterator find(const Key& key) const;
+    Value const & operator[](const Key& key) const;
+    const_iterator lower_bound(const Key& key) const;
+    const_iterator upper_bound(const Key& key) const;
+    std::size_t size() const;
+    bool empty() const;
+
+protected:
+    std::uint64_t boundIndex(const Key& key, bool upper) const;
+
+private:
+    // Not copyable: the mapping is unmapped by the destructor
+    MappedTree(const MappedTree&);
+    MappedTree& operator=(const MappedTree&);
+
+protected:
+    void* base_;            // start of the mapping
+    std::size_t length_;    // length of the mapping in bytes
+    const Record* records_;
+    std::uint64_t count_;
+    Compare comp_;
+};
+
+/**
+* Writes tree to path in the mapped tree format. The file is first written
+* under a temporary name and renamed into place, so a reader never maps a
+* half-written file. Throws std::runtime_error if the file cannot be
+* written.
+*/
+template <typename Key, typename Value, typename Compare>
+void writeMappedTree(const BinarySearchTree<Key, Value, Compare>& tree, const std::string& path)
+{
+    static_assert(std::is_trivially_copyable<Key>::value && std::is_trivially_copyable<Value>::value,
+                  "mapped trees need trivially copyable keys and values");
+    typedef MappedTreeRecord<Key, Value> Record;
+
+    std::vector<Record> records;
+    for (typename BinarySearchTree<Key, Value, Compare>::iterator it = tree.begin(); it != tree.end(); ++it) {
+        Record record;
+        std::memset(&record, 0, sizeof(record));
+        record.first = it->first;
+        record.second = it->second;
+        records.push_back(record);
+    }
+
+    MappedTreeHeader header;
+    std::memset(&header, 0, sizeof(header));
+    std::memcpy(header.magic, "BSTMAP", 6);
+    header.version = MappedTreeHeader::VERSION;
+    header.byteOrder = MappedTreeHeader::BYTE_ORDER_MARK;
+    header.keySize = sizeof(Key);
+    header.valueSize = sizeof(Value);
+    header.recordSize = sizeof(Record);
+    header.recordAlign = alignof(Record);
+    header.count = records.size();
+
+    std::string temp = path + ".tmp";
+    {
+        std::ofstream out(temp.c_str(), std::ios::binary | std::ios::trunc);
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        if (!records.empty()) {
+            out.write(reinterpret_cast<const char*>(&records[0]),
+                      static_cast<std::streamsize>(records.size() * sizeof(Record)));
+        }
+        out.flush();
+        if (!out) {
+            std::remove(temp.c_str());
+            throw std::runtime_error("cannot write mapped tree " + temp);
+        }
+    }
+    if (std::rename(temp.c_str(), path.c_str()) != 0) {
+        std::remove(temp.c_str());
+        throw std::runtime_error("cannot rename mapped tree to " + path);
+    }
+}
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the MappedTree::const_iterator class.
+  -----------------------------------------------------
+*/
+
+template<typename Key, typename Value, typename Compare>
+MappedTree<Key, Value, Compare>::const_iterator::const_iterator() :
+    record_(NULL)
+{
+}
+
+template<typename Key, typename Value, typename Compare>
+MappedTree<Key, Value, Compare>::const_iterator::const_iterator(const MappedTreeRecord<Key, Value>* record) :
+    record_(record)
+{
+}
+
+template<typename Key, typename Value, typename Compare>
+const MappedTreeRecord<Key, Value>& MappedTree<Key, Value, Compare>::const_iterator::operator*() const
+{
+    return *record_;
+}
+
+template<typename Key, typename Value, typename Compare>
+const MappedTreeRecord<Key, Value>* MappedTree<Key, Value, Compare>::const_iterator::operator->() const
+{
+    return record_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MappedTree<Key, Value, Compare>::const_iterator::operator==(const const_iterator& rhs) const
+{
+    return record_ == rhs.record_;
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MappedTree<Key, Value, Compare>::const_iterator::operator!=(const const_iterator& rhs) const
+{
+    return record_ != rhs.record_;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator&
+MappedTree<Key, Value, Compare>::const_iterator::operator++()
+{
+    ++record_;
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator
+MappedTree<Key, Value, Compare>::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++record_;
+    return old;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator&
+MappedTree<Key, Value, Compare>::const_iterator::operator--()
+{
+    --record_;
+    return *this;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator
+MappedTree<Key, Value, Compare>::const_iterator::operator--(int)
+{
+    const_iterator old(*this);
+    --record_;
+    return old;
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the MappedTree::const_iterator class.
+  -----------------------------------------------------
+*/
+
+/*
+  -----------------------------------------------------
+  Begin implementations for the MappedTree class.
+  -----------------------------------------------------
+*/
+
+/**
+* Maps the tree file at path read-only. Throws std::runtime_error if the
+* file cannot be mapped or was not written by writeMappedTree() for this
+* key/value layout.
+*/
+template<typename Key, typename Value, typename Compare>
+MappedTree<Key, Value, Compare>::MappedTree(const std::string& path, const Compare& comp) :
+    base_(NULL),
+    length_(0),
+    records_(NULL),
+    count_(0),
+    comp_(comp)
+{
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        throw std::runtime_error("cannot open mapped tree " + path);
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || static_cast<std::size_t>(info.st_size) < sizeof(MappedTreeHeader)) {
+        ::close(fd);
+        throw std::runtime_error("not a mapped tree: " + path);
+    }
+    length_ = static_cast<std::size_t>(info.st_size);
+    void* base = ::mmap(NULL, length_, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (base == MAP_FAILED) {
+        throw std::runtime_error("cannot map " + path);
+    }
+    base_ = base;
+
+    const MappedTreeHeader* header = static_cast<const MappedTreeHeader*>(base_);
+    bool valid = std::memcmp(header->magic, "BSTMAP\0\0", 8) == 0 &&
+                 header->version == MappedTreeHeader::VERSION &&
+                 header->byteOrder == MappedTreeHeader::BYTE_ORDER_MARK &&
+                 header->keySize == sizeof(Key) &&
+                 header->valueSize == sizeof(Value) &&
+                 header->recordSize == sizeof(Record) &&
+                 header->recordAlign == alignof(Record) &&
+                 header->count <= (length_ - sizeof(MappedTreeHeader)) / sizeof(Record);
+    if (!valid) {
+        ::munmap(base_, length_);
+        throw std::runtime_error("not a mapped tree for these key/value types: " + path);
+    }
+    records_ = reinterpret_cast<const Record*>(static_cast<const char*>(base_) + sizeof(MappedTreeHeader));
+    count_ = header->count;
+}
+
+template<typename Key, typename Value, typename Compare>
+MappedTree<Key, Value, Compare>::~MappedTree()
+{
+    ::munmap(base_, length_);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator
+MappedTree<Key, Value, Compare>::begin() const
+{
+    return const_iterator(records_);
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator
+MappedTree<Key, Value, Compare>::end() const
+{
+    return const_iterator(records_ + count_);
+}
+
+/**
+* Returns an iterator to the record with the given key, or end().
+*/
+template<typename Key, typename Value, typename Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator
+MappedTree<Key, Value, Compare>::find(const Key& key) const
+{
+    std::uint64_t index = boundIndex(key, false);
+    if (index == count_ || comp_(key, records_[index].first)) {
+        return end();
+    }
+    return const_iterator(records_ + index);
+}
+
+/**
+ * @precondition The key exists in the map
+ * Returns the value associated with the key
+ */
+template<typename Key, typename Value, typename Compare>
+Value const & MappedTree<Key, Value, Compare>::operator[](const Key& key) const
+{
+    const_iterator it = find(key);
+    if(it == end()) throw std::out_of_range("Invalid key");
+    return it->second;
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator
+MappedTree<Key, Value, Compare>::lower_bound(const Key& key) const
+{
+    return const_iterator(records_ + boundIndex(key, false));
+}
+
+template<typename Key, typename Value, typename Compare>
+typename MappedTree<Key, Value, Compare>::const_iterator
+MappedTree<Key, Value, Compare>::upper_bound(const Key& key) const
+{
+    return const_iterator(records_ + boundIndex(key, true));
+}
+
+template<typename Key, typename Value, typename Compare>
+std::size_t MappedTree<Key, Value, Compare>::size() const
+{
+    return static_cast<std::size_t>(count_);
+}
+
+template<typename Key, typename Value, typename Compare>
+bool MappedTree<Key, Value, Compare>::empty() const
+{
+    return count_ == 0;
+}
+
+/**
+* Binary searches the records for the index of the first one whose key is
+* not less than key (with upper, greater than key), or count_ if there is
+* none. At most log2(n) + 1 Compare calls.
+*/
+template<typename Key, typename Value, typename Compare>
+std::uint64_t MappedTree<Key, Value, Compare>::boundIndex(const Key& key, bool upper) const
+{
+    std::uint64_t first = 0;
+    std::uint64_t length = count_;
+    while (length > 0) {
+        std::uint64_t half = length / 2;
+        const Key& probe = records_[first + half].first;
+        bool goRight = upper ? !comp_(key, probe) : comp_(probe, key);
+        if (goRight) {
+            first += half + 1;
+            length -= half + 1;
+        }
+        else {
+            length = half;
+        }
+    }
+    return first;
+}
+
+/*
+  -----------------------------------------------------
+  End implementations for the MappedTree class.
+  -----------------------------------------------------
+*/
+
+#endif
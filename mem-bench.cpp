@@ -0,0 +1,145 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <cstdlib>
+#include <cstdint>
+#include <chrono>
+#include <map>
+#include <unistd.h>
+#include <sys/wait.h>
+#include "avlbst.h"
+#include "compact_avlbst.h"
+#include "indexed_avlbst.h"
+
+using namespace std;
+
+// Memory per entry of AVLTree against CompactAVLTree and IndexedAVLTree
+// (and std::map for reference) holding uint64_t -> uint64_t, plus the insert and lookup
+// times. Each tree is built in its own child process and measured by how
+// much its resident set grows, so one tree's freed memory cannot hide the
+// next one's, and running out of memory only loses that tree's line.
+//
+// usage: mem-bench [entries]    (default 100000000)
+
+struct AvlOps
+{
+    typedef AVLTree<uint64_t, uint64_t> Tree;
+    static const char* name() { return "AVLTree"; }
+    static size_t nodeBytes() { return sizeof(AVLNode<uint64_t, uint64_t>); }
+    static void insert(Tree& t, uint64_t k) { t.insert(make_pair(k, k)); }
+    static bool find(const Tree& t, uint64_t k) { return t.find(k) != t.end(); }
+};
+
+struct CompactOps
+{
+    typedef CompactAVLTree<uint64_t, uint64_t> Tree;
+    static const char* name() { return "CompactAVLTree"; }
+    static size_t nodeBytes() { return sizeof(CompactAVLNode<uint64_t, uint64_t>); }
+    static void insert(Tree& t, uint64_t k) { t.insert(make_pair(k, k)); }
+    static bool find(const Tree& t, uint64_t k) { return t.find(k) != t.end(); }
+};
+
+struct IndexedOps
+{
+    typedef IndexedAVLTree<uint64_t, uint64_t> Tree;
+    static const char* name() { return "IndexedAVLTree"; }
+    // Key, value, two links, parent and balance, spread over five arrays
+    static size_t nodeBytes() { return 2 * sizeof(uint64_t) + 3 * sizeof(uint32_t) + 1; }
+    static void insert(Tree& t, uint64_t k) { t.insert(make_pair(k, k)); }
+    static bool find(Tree& t, uint64_t k) { return t.find(k) != t.end(); }
+};
+
+struct MapOps
+{
+    typedef map<uint64_t, uint64_t> Tree;
+    static const char* name() { return "std::map"; }
+    static size_t nodeBytes() { return 0; }
+    static void insert(Tree& t, uint64_t k) { t[k] = k; }
+    static bool find(const Tree& t, uint64_t k) { return t.find(k) != t.end(); }
+};
+
+// Distinct keys in scattered order: multiplying by an odd constant is a
+// bijection on 64-bit integers
+static uint64_t keyAt(uint64_t i)
+{
+    return i * 0x9E3779B97F4A7C15ULL;
+}
+
+static size_t residentBytes()
+{
+    ifstream statm("/proc/self/statm");
+    size_t pages = 0;
+    size_t resident = 0;
+    statm >> pages >> resident;
+    return resident * static_cast<size_t>(sysconf(_SC_PAGESIZE));
+}
+
+template<typename Ops>
+void measure(size_t entries)
+{
+    typedef chrono::steady_clock Clock;
+    size_t before = residentBytes();
+    typename Ops::Tree* tree = new typename Ops::Tree;
+
+    Clock::time_point start = Clock::now();
+    for (size_t i = 0; i < entries; ++i) {
+        Ops::insert(*tree, keyAt(i));
+    }
+    double insertNs = chrono::duration<double, nano>(Clock::now() - start).count() / entries;
+    size_t after = residentBytes();
+
+    size_t lookups = entries < 1000000 ? entries : 1000000;
+    size_t found = 0;
+    start = Clock::now();
+    for (size_t i = 0; i < lookups; ++i) {
+        found += Ops::find(*tree, keyAt((i * 7919) % entries));
+    }
+    double findNs = chrono::duration<double, nano>(Clock::now() - start).count() / lookups;
+
+    cout << setw(16) << Ops::name() << setw(12);
+    if (Ops::nodeBytes() > 0) {
+        cout << Ops::nodeBytes();
+    }
+    else {
+        cout << "-";
+    }
+    cout << fixed << setprecision(1) << setw(14) << static_cast<double>(after - before) / entries
+         << setw(12) << insertNs << setw(12) << findNs
+         << (found == lookups ? "" : "  (lookups missed!)") << endl;
+    // The process exits right away, so the tree is not torn down
+}
+
+template<typename Ops>
+void runChild(size_t entries)
+{
+    cout.flush();
+    pid_t pid = fork();
+    if (pid == 0) {
+        measure<Ops>(entries);
+        cout.flush();
+        _exit(0);
+    }
+    int status = 0;
+    if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        cout << setw(16) << Ops::name() << "  failed (out of memory?)" << endl;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    size_t entries = 100000000;
+    if (argc > 1) entries = strtoul(argv[1], NULL, 10);
+    if (entries == 0) {
+        cerr << "usage: mem-bench [entries]" << endl;
+        return 1;
+    }
+
+    cout << "entries " << entries << ", uint64_t keys and values" << endl;
+    cout << setw(16) << "tree" << setw(12) << "node bytes" << setw(14) << "bytes/entry"
+         << setw(12) << "insert ns" << setw(12) << "find ns" << endl;
+    runChild<AvlOps>(entries);
+    runChild<CompactOps>(entries);
+    runChild<IndexedOps>(entries);
+    runChild<MapOps>(entries);
+    return 0;
+}
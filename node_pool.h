@@ -0,0 +1,458 @@
+#ifndef NODE_POOL_H
+#define NODE_POOL_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <thread>
+#include <utility>
+
+/**
+ * A slab allocator for fixed-size tree nodes.
+ *
+ * Each tree owns one pool. Memory is requested from the global heap in
+ * slabs that hold many nodes at once; nodes handed back by deallocate()
+ * are kept on an intrusive free list and reused by the next allocate().
+ * release() gives every slab back to the heap in one pass over the slab
+ * list, so tearing down a tree no longer costs one free() per node.
+ *
+ * The pool only manages raw storage. Constructing and destroying the
+ * objects placed in it is up to the owner (see BinarySearchTree).
+ *
+ * The slabs, the free list and the unused tail of the newest slab live in
+ * a reference-counted arena, so that nodes can move between trees without
+ * being copied: when AVLTree::split hands part of a tree to another tree,
+ * that tree's pool joins the arena with shareWith(), and AVLTree::join
+ * takes the other pool's arena over with absorb(). Pools sharing an arena
+ * allocate from and free into the same free list, so a block freed by
+ * either tree can be reused by the other, and the arena is freed once no
+ * pool refers to it. A shared arena is guarded by a spinlock, so pools
+ * that share one may be used from different threads; a pool alone in its
+ * arena never touches the lock.
+ */
+class NodePool
+{
+public:
+    explicit NodePool(std::size_t blockSize, std::size_t alignment = alignof(std::max_align_t));
+    ~NodePool();
+
+    void* allocate();
+    void deallocate(void* block);
+    void release();
+    void shareWith(NodePool& other);
+    void absorb(NodePool& other);
+
+    bool shared() const;
+    std::size_t blockSize() const;
+
+private:
+    // Not copyable: sharing slabs between trees goes through shareWith().
+    NodePool(const NodePool&);
+    NodePool& operator=(const NodePool&);
+
+    // Free blocks are linked through their own first word.
+    struct FreeBlock
+    {
+        FreeBlock* next;
+    };
+
+    // Every slab starts with this header; the blocks follow it.
+    union SlabHeader
+    {
+        SlabHeader* next;
+        std::max_align_t align;
+    };
+
+    // The storage behind one or more pools. When absorb() merges an arena
+    // into another, its slabs and free blocks move over and forward points
+    // at the arena that took them; the pools still holding it follow
+    // forward on their next call.
+    struct Arena
+    {
+        std::atomic<long> refs;       // pools holding it, plus arenas forwarding to it
+        std::atomic<Arena*> forward;  // set once merged into another arena
+        std::atomic_flag busy;        // spinlock, only taken while refs > 1
+        SlabHeader* slabs;
+        FreeBlock* freeList;
+        FreeBlock* freeTail;
+        char* bump;     // next never-used block in the newest slab
+        char* bumpEnd;  // end of the newest slab
+        std::size_t nextSlabBlocks;
+    };
+
+    // Holds this pool's (current) arena for one call, locked if shared
+    class ArenaLock
+    {
+    public:
+        explicit ArenaLock(NodePool& pool);
+        ~ArenaLock();
+        Arena* arena;
+    private:
+        bool locked_;
+    };
+
+    Arena* currentArena();
+    void grow(Arena* arena);
+    void pushFree(Arena* arena, char* first, char* last);
+    static Arena* newArena();
+    static void unref(Arena* arena);
+    static void lock(Arena* arena);
+    static void unlock(Arena* arena);
+
+    static const std::size_t MIN_SLAB_BLOCKS = 32;
+    static const std::size_t MAX_SLAB_BLOCKS = 4096;
+
+    std::size_t blockSize_;
+    Arena* arena_;  // NULL until the first allocate()
+};
+
+/*
+  --------------------------------------------
+  Begin implementations for the NodePool class.
+  --------------------------------------------
+*/
+
+/**
+* Creates an empty pool handing out blocks of at least blockSize bytes,
+* each aligned to alignment (a power of two no larger than
+* alignof(std::max_align_t)). Nodes with smaller alignment can ask for it
+* to avoid padding every block to 16 bytes. No memory is requested until
+* the first allocate().
+*/
+inline NodePool::NodePool(std::size_t blockSize, std::size_t alignment) :
+    blockSize_(blockSize),
+    arena_(NULL)
+{
+    std::size_t align = alignment < alignof(FreeBlock) ? alignof(FreeBlock) : alignment;
+    if (blockSize_ < sizeof(FreeBlock)) {
+        blockSize_ = sizeof(FreeBlock);
+    }
+    blockSize_ = (blockSize_ + align - 1) / align * align;
+}
+
+/**
+* Gives every slab no other pool shares back to the heap. Objects still
+* living in the pool are not destroyed.
+*/
+inline NodePool::~NodePool()
+{
+    release();
+}
+
+/**
+* Returns storage for one block, preferring recycled blocks over fresh ones.
+*/
+inline void* NodePool::allocate()
+{
+    ArenaLock held(*this);
+    Arena* arena = held.arena;
+    if (arena->freeList != NULL) {
+        FreeBlock* block = arena->freeList;
+        arena->freeList = block->next;
+        if (arena->freeList == NULL) {
+            arena->freeTail = NULL;
+        }
+        return block;
+    }
+    if (arena->bump == arena->bumpEnd) {
+        grow(arena);
+    }
+    void* block = arena->bump;
+    arena->bump += blockSize_;
+    return block;
+}
+
+/**
+* Puts a block back on the free list so the next allocate() (by this pool
+* or any pool sharing its arena) can reuse it.
+*/
+inline void NodePool::deallocate(void* block)
+{
+    if (block == NULL) {
+        return;
+    }
+    ArenaLock held(*this);
+    Arena* arena = held.arena;
+    FreeBlock* freed = static_cast<FreeBlock*>(block);
+    freed->next = arena->freeList;
+    arena->freeList = freed;
+    if (arena->freeTail == NULL) {
+        arena->freeTail = freed;
+    }
+}
+
+/**
+* Drops this pool's reference on its arena, freeing the arena's slabs if
+* no other pool shares it. All blocks handed out by this pool become
+* invalid unless another pool still shares them.
+*/
+inline void NodePool::release()
+{
+    if (arena_ != NULL) {
+        unref(arena_);
+        arena_ = NULL;
+    }
+}
+
+/**
+* Makes other share this pool's arena, so that nodes moved from this
+* pool's owner to other's owner stay valid until both pools are released,
+* and blocks either one frees can be reused by both. Anything other held
+* before is merged in first, as by absorb(). Both pools must have the
+* same block size.
+*/
+inline void NodePool::shareWith(NodePool& other)
+{
+    if (&other == this) {
+        return;
+    }
+    absorb(other);
+    if (arena_ == NULL) {
+        arena_ = newArena();
+    }
+    Arena* arena = currentArena();
+    arena->refs.fetch_add(1, std::memory_order_relaxed);
+    other.arena_ = arena;
+}
+
+/**
+* Takes over all of other's blocks, leaving other empty. Used when every
+* node of other's owner moves into this pool's owner. If the two pools are
+* in different arenas, other's slabs and free blocks move into this one,
+* and of the two arenas' unused slab tails the shorter one is put on the
+* free list, so no memory is stranded. Both pools must have the same block
+* size.
+*/
+inline void NodePool::absorb(NodePool& other)
+{
+    if (&other == this || other.arena_ == NULL) {
+        return;
+    }
+    if (arena_ == NULL) {
+        arena_ = other.arena_;
+        other.arena_ = NULL;
+        return;
+    }
+    for (;;) {
+        Arena* mine = currentArena();
+        Arena* theirs = other.currentArena();
+        if (mine == theirs) {
+            break;
+        }
+        // Another thread may be merging either arena too; lock both in
+        // address order and retry if one of them has just moved on
+        Arena* first = mine < theirs ? mine : theirs;
+        Arena* second = mine < theirs ? theirs : mine;
+        lock(first);
+        lock(second);
+        if (mine->forward.load(std::memory_order_relaxed) == NULL &&
+            theirs->forward.load(std::memory_order_relaxed) == NULL) {
+            if (theirs->slabs != NULL) {
+                SlabHeader* last = theirs->slabs;
+                while (last->next != NULL) {
+                    last = last->next;
+                }
+                last->next = mine->slabs;
+                mine->slabs = theirs->slabs;
+            }
+            if (theirs->freeList != NULL) {
+                theirs->freeTail->next = mine->freeList;
+                if (mine->freeList == NULL) {
+                    mine->freeTail = theirs->freeTail;
+                }
+                mine->freeList = theirs->freeList;
+            }
+            // Keep allocating from the longer unused tail
+            if (theirs->bumpEnd - theirs->bump > mine->bumpEnd - mine->bump) {
+                std::swap(mine->bump, theirs->bump);
+                std::swap(mine->bumpEnd, theirs->bumpEnd);
+            }
+            pushFree(mine, theirs->bump, theirs->bumpEnd);
+            if (theirs->nextSlabBlocks > mine->nextSlabBlocks) {
+                mine->nextSlabBlocks = theirs->nextSlabBlocks;
+            }
+            theirs->slabs = NULL;
+            theirs->freeList = NULL;
+            theirs->freeTail = NULL;
+            theirs->bump = NULL;
+            theirs->bumpEnd = NULL;
+            mine->refs.fetch_add(1, std::memory_order_relaxed);
+            theirs->forward.store(mine, std::memory_order_release);
+            unlock(second);
+            unlock(first);
+            break;
+        }
+        unlock(second);
+        unlock(first);
+    }
+    other.release();
+}
+
+/**
+* Returns true if another pool shares this pool's arena, in which case the
+* owner must hand its blocks back one by one with deallocate() before
+* release() for them to be reused.
+*/
+inline bool NodePool::shared() const
+{
+    return arena_ != NULL && (arena_->refs.load(std::memory_order_acquire) > 1 ||
+                              arena_->forward.load(std::memory_order_acquire) != NULL);
+}
+
+/**
+* Returns the (alignment-padded) size of each block.
+*/
+inline std::size_t NodePool::blockSize() const
+{
+    return blockSize_;
+}
+
+/**
+* Returns the arena this pool allocates from, creating it on first use.
+* If the pool's arena was merged into another, the pool moves its
+* reference over to the one that took the blocks.
+*/
+inline NodePool::Arena* NodePool::currentArena()
+{
+    if (arena_ == NULL) {
+        arena_ = newArena();
+        return arena_;
+    }
+    Arena* next = arena_->forward.load(std::memory_order_acquire);
+    while (next != NULL) {
+        // Our reference on arena_ keeps next alive until we hold our own
+        next->refs.fetch_add(1, std::memory_order_relaxed);
+        unref(arena_);
+        arena_ = next;
+        next = arena_->forward.load(std::memory_order_acquire);
+    }
+    return arena_;
+}
+
+/**
+* Requests a new slab from the heap for arena, which the caller holds.
+* Slabs double in size up to MAX_SLAB_BLOCKS so small trees stay small and
+* large trees make few calls.
+*/
+inline void NodePool::grow(Arena* arena)
+{
+    std::size_t bytes = sizeof(SlabHeader) + arena->nextSlabBlocks * blockSize_;
+    SlabHeader* slab = static_cast<SlabHeader*>(std::malloc(bytes));
+    if (slab == NULL) {
+        throw std::bad_alloc();
+    }
+    slab->next = arena->slabs;
+    arena->slabs = slab;
+
+    arena->bump = reinterpret_cast<char*>(slab + 1);
+    arena->bumpEnd = arena->bump + arena->nextSlabBlocks * blockSize_;
+
+    if (arena->nextSlabBlocks < MAX_SLAB_BLOCKS) {
+        arena->nextSlabBlocks *= 2;
+    }
+}
+
+/**
+* Puts the blocks in [first, last) on arena's free list.
+*/
+inline void NodePool::pushFree(Arena* arena, char* first, char* last)
+{
+    for (; first != last; first += blockSize_) {
+        FreeBlock* freed = reinterpret_cast<FreeBlock*>(first);
+        freed->next = arena->freeList;
+        arena->freeList = freed;
+        if (arena->freeTail == NULL) {
+            arena->freeTail = freed;
+        }
+    }
+}
+
+/**
+* Returns a new, empty arena with one reference.
+*/
+inline NodePool::Arena* NodePool::newArena()
+{
+    Arena* arena = new Arena;
+    arena->refs.store(1, std::memory_order_relaxed);
+    arena->forward.store(NULL, std::memory_order_relaxed);
+    arena->busy.clear();
+    arena->slabs = NULL;
+    arena->freeList = NULL;
+    arena->freeTail = NULL;
+    arena->bump = NULL;
+    arena->bumpEnd = NULL;
+    arena->nextSlabBlocks = MIN_SLAB_BLOCKS;
+    return arena;
+}
+
+/**
+* Drops one reference on arena. The last one frees its slabs and drops the
+* arena's own reference on the arena it forwards to, if any.
+*/
+inline void NodePool::unref(Arena* arena)
+{
+    while (arena != NULL && arena->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        while (arena->slabs != NULL) {
+            SlabHeader* next = arena->slabs->next;
+            std::free(arena->slabs);
+            arena->slabs = next;
+        }
+        Arena* next = arena->forward.load(std::memory_order_relaxed);
+        delete arena;
+        arena = next;
+    }
+}
+
+inline void NodePool::lock(Arena* arena)
+{
+    while (arena->busy.test_and_set(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+}
+
+inline void NodePool::unlock(Arena* arena)
+{
+    arena->busy.clear(std::memory_order_release);
+}
+
+/**
+* Finds pool's arena and locks it if another pool may be using it at the
+* same time. An arena with a single reference can only be reached through
+* this pool (the references of other pools and of forwarding arenas are
+* all counted), so it is used without locking. A shared arena is locked,
+* and if it turns out to have been merged away meanwhile the lock is let
+* go and the pool follows it to its new arena.
+*/
+inline NodePool::ArenaLock::ArenaLock(NodePool& pool) :
+    arena(NULL),
+    locked_(false)
+{
+    for (;;) {
+        arena = pool.currentArena();
+        if (arena->refs.load(std::memory_order_acquire) == 1) {
+            return;
+        }
+        lock(arena);
+        if (arena->forward.load(std::memory_order_relaxed) == NULL) {
+            locked_ = true;
+            return;
+        }
+        unlock(arena);
+    }
+}
+
+inline NodePool::ArenaLock::~ArenaLock()
+{
+    if (locked_) {
+        unlock(arena);
+    }
+}
+
+/*
+  ------------------------------------------
+  End implementations for the NodePool class.
+  ------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,817 @@
+#ifndef PERSISTENT_AVLBST_H
+#define PERSISTENT_AVLBST_H
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <iterator>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+/**
+ * A node of a PersistentAVLTree. Nodes never change once built: a write
+ * copies the nodes on the path it touches and shares every other subtree
+ * with the previous version, so a node can have several parents and has
+ * no parent pointer. refs_ counts the versions and nodes pointing at it.
+ */
+template <class Key, class Value>
+class PersistentAVLNode
+{
+public:
+    PersistentAVLNode(const std::pair<const Key, Value>& item,
+                      PersistentAVLNode<Key, Value>* left, PersistentAVLNode<Key, Value>* right);
+
+    const std::pair<const Key, Value>& getItem() const { return item_; }
+    const Key& getKey() const { return item_.first; }
+    const Value& getValue() const { return item_.second; }
+    PersistentAVLNode<Key, Value>* getLeft() const { return left_; }
+    PersistentAVLNode<Key, Value>* getRight() const { return right_; }
+    int getHeight() const { return height_; }
+
+    void retain();
+    void release();
+
+protected:
+    const std::pair<const Key, Value> item_;
+    PersistentAVLNode<Key, Value>* const left_;
+    PersistentAVLNode<Key, Value>* const right_;
+    const int height_;
+    std::atomic<long> refs_;
+};
+
+/**
+ * An AVL tree that keeps old versions alive for readers.
+ *
+ * AVLTree rotates nodes in place and links them with parent pointers, so
+ * a reader walking it while a writer rebalances can see a torn tree. This
+ * tree never mutates a published node: insert and remove build a new
+ * root by copying the O(log n) nodes on the search path (rebalancing the
+ * copies) and share the rest with the old version, then publish the new
+ * version with one atomic exchange.
+ *
+ * Readers call snapshot(), which pins the current version with a single
+ * atomic add, without taking a lock or waiting on the writer, and read
+ * the returned Snapshot for as long as they like; it never changes. A
+ * single writer thread may call insert/remove/clear at a time.
+ *
+ * Versions and nodes are reference counted, the current version with a
+ * split count: snapshot() adds one to a reader count packed next to the
+ * pointer in current_, so loading the version and pinning it are the
+ * same step and no reader ever holds a version it has not counted. When
+ * the writer replaces the version, the exchange hands it that count,
+ * which it moves onto the version's own count before dropping the
+ * tree's reference. The last Snapshot to let go of a replaced version
+ * frees it then and there, however busy the readers are. Nodes may thus
+ * be freed from reader threads, which is why they come from the global
+ * heap rather than a per-tree NodePool. Packing assumes user-space
+ * addresses fit in 48 bits, as they do on x86-64 and AArch64, and that
+ * fewer than 2^15 threads are inside snapshot() at once.
+ */
+template <class Key, class Value, class Compare = std::less<Key> >
+class PersistentAVLTree
+{
+public:
+    typedef PersistentAVLNode<Key, Value> NodeType;
+
+protected:
+    // One published version: a root plus the number of items under it.
+    // While a version is current, refs holds CURRENT_BIAS for the tree
+    // plus the Snapshot copies made of it, minus the Snapshots released,
+    // and the snapshots taken are counted in current_ instead.
+    struct Version
+    {
+        std::atomic<std::int64_t> refs;
+        NodeType* root;
+        std::size_t size;
+    };
+
+public:
+    /**
+    * An immutable view of the tree as it was when taken. Copies share
+    * the version; it stays valid even after the tree is destroyed.
+    */
+    class Snapshot
+    {
+    public:
+        class const_iterator;
+
+        Snapshot();
+        Snapshot(const Snapshot& other);
+        Snapshot& operator=(const Snapshot& other);
+        ~Snapshot();
+
+        const Value* find(const Key& key) const;
+        bool contains(const Key& key) const;
+        std::size_t size() const;
+        bool empty() const;
+
+        const_iterator begin() const;
+        const_iterator end() const;
+
+        /**
+        * Walks a snapshot in key order. Nodes have no parent pointers, so
+        * the path back up is kept on an explicit stack of O(log n) nodes;
+        * each step is O(1) amortized.
+        */
+        class const_iterator
+        {
+        public:
+            typedef std::forward_iterator_tag iterator_category;
+            typedef std::pair<const Key, Value> value_type;
+            typedef std::ptrdiff_t difference_type;
+            typedef const std::pair<const Key, Value>* pointer;
+            typedef const std::pair<const Key, Value>& reference;
+
+            const_iterator();
+
+            const std::pair<const Key, Value>& operator*() const;
+            const std::pair<const Key, Value>* operator->() const;
+
+            bool operator==(const const_iterator& rhs) const;
+            bool operator!=(const const_iterator& rhs) const;
+
+            const_iterator& operator++();
+            const_iterator operator++(int);
+
+        protected:
+            friend class Snapshot;
+            explicit const_iterator(NodeType* root);
+            void pushLeftPath(NodeType* node);
+
+            std::vector<NodeType*> path_;  // current node on top, then its pending ancestors
+        };
+
+    protected:
+        friend class PersistentAVLTree<Key, Value, Compare>;
+        Snapshot(Version* version, const Compare& comp);
+
+        Version* version_;
+        Compare comp_;
+    };
+
+    PersistentAVLTree();
+    explicit PersistentAVLTree(const Compare& comp);
+    ~PersistentAVLTree();
+
+    // Reader side: safe to call from any number of threads at once
+    Snapshot snapshot() const;
+
+    // Writer side: one thread at a time
+    void insert(const std::pair<const Key, Value>& keyValuePair);
+    void remove(const Key& key);
+    void clear();
+    std::size_t size() const;
+    bool empty() const;
+
+protected:
+    // Path-copying helpers. Each takes ownership of the references it is
+    // passed and returns a new reference to the subtree it builds.
+    NodeType* insertAt(NodeType* node, const std::pair<const Key, Value>& item, bool& added);
+    NodeType* removeAt(NodeType* node, const Key& key, bool& removed);
+    static NodeType* removeSmallest(NodeType* node);
+    static NodeType* balanced(const std::pair<const Key, Value>& item, NodeType* left, NodeType* right);
+    static NodeType* retain(NodeType* node);
+    static int heightOf(NodeType* node);
+
+    void publish(NodeType* root, std::size_t size);
+    void foldReaders(std::uint64_t word) const;
+    static void retireVersion(std::uint64_t word);
+    static Version* newVersion(NodeType* root, std::size_t size);
+    static void releaseVersion(Version* version);
+
+    // current_ holds the Version pointer in its low 48 bits and the
+    // number of snapshots taken of it in the top 16
+    static const int READER_SHIFT = 48;
+    static const std::uint64_t ONE_READER = static_cast<std::uint64_t>(1) << READER_SHIFT;
+    static const std::uint64_t POINTER_MASK = ONE_READER - 1;
+    static const std::uint64_t FOLD_READERS = 1 << 15;  // move the count into refs from here on
+    static const std::int64_t CURRENT_BIAS = static_cast<std::int64_t>(1) << 40;
+
+    static Version* versionOf(std::uint64_t word);
+    static std::uint64_t readersOf(std::uint64_t word);
+
+    mutable std::atomic<std::uint64_t> current_;
+    Compare comp_;
+
+private:
+    // Not copyable: copies would share current_ and the version refcounts
+    PersistentAVLTree(const PersistentAVLTree&);
+    PersistentAVLTree& operator=(const PersistentAVLTree&);
+};
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the PersistentAVLNode class.
+  ----------------------------------------------------
+*/
+
+/**
+* Builds a node over two subtrees, taking over the caller's references to
+* them. The new node starts with one reference, owned by the caller.
+*/
+template<class Key, class Value>
+PersistentAVLNode<Key, Value>::PersistentAVLNode(const std::pair<const Key, Value>& item,
+    PersistentAVLNode<Key, Value>* left, PersistentAVLNode<Key, Value>* right) :
+    item_(item),
+    left_(left),
+    right_(right),
+    height_(1 + std::max(left == NULL ? 0 : left->getHeight(),
+                         right == NULL ? 0 : right->getHeight())),
+    refs_(1)
+{
+}
+
+/**
+* Takes another reference on the node.
+*/
+template<class Key, class Value>
+void PersistentAVLNode<Key, Value>::retain()
+{
+    refs_.fetch_add(1, std::memory_order_relaxed);
+}
+
+/**
+* Drops a reference, freeing the node (and dropping its references on its
+* children) if it was the last. Freeing recurses only along AVL heights.
+*/
+template<class Key, class Value>
+void PersistentAVLNode<Key, Value>::release()
+{
+    if (refs_.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (left_ != NULL) {
+            left_->release();
+        }
+        if (right_ != NULL) {
+            right_->release();
+        }
+        delete this;
+    }
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the PersistentAVLNode class.
+  --------------------------------------------------
+*/
+
+/*
+  ------------------------------------------------------------------
+  Begin implementations for the PersistentAVLTree::Snapshot classes.
+  ------------------------------------------------------------------
+*/
+
+/**
+* An empty snapshot not tied to any tree.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot() :
+    version_(NULL),
+    comp_()
+{
+}
+
+/**
+* Wraps a version the caller has already taken a reference on.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot(Version* version, const Compare& comp) :
+    version_(version),
+    comp_(comp)
+{
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::Snapshot(const Snapshot& other) :
+    version_(other.version_),
+    comp_(other.comp_)
+{
+    if (version_ != NULL) {
+        version_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot&
+PersistentAVLTree<Key, Value, Compare>::Snapshot::operator=(const Snapshot& other)
+{
+    if (other.version_ != NULL) {
+        other.version_->refs.fetch_add(1, std::memory_order_relaxed);
+    }
+    if (version_ != NULL) {
+        releaseVersion(version_);
+    }
+    version_ = other.version_;
+    comp_ = other.comp_;
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::~Snapshot()
+{
+    if (version_ != NULL) {
+        releaseVersion(version_);
+    }
+}
+
+/**
+* Returns the value stored under key in this snapshot, or NULL.
+*/
+template<class Key, class Value, class Compare>
+const Value* PersistentAVLTree<Key, Value, Compare>::Snapshot::find(const Key& key) const
+{
+    NodeType* node = (version_ == NULL) ? NULL : version_->root;
+    while (node != NULL) {
+        if (comp_(key, node->getKey())) {
+            node = node->getLeft();
+        }
+        else if (comp_(node->getKey(), key)) {
+            node = node->getRight();
+        }
+        else {
+            return &node->getValue();
+        }
+    }
+    return NULL;
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::Snapshot::contains(const Key& key) const
+{
+    return find(key) != NULL;
+}
+
+template<class Key, class Value, class Compare>
+std::size_t PersistentAVLTree<Key, Value, Compare>::Snapshot::size() const
+{
+    return (version_ == NULL) ? 0 : version_->size;
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::Snapshot::empty() const
+{
+    return size() == 0;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot::const_iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::begin() const
+{
+    return const_iterator((version_ == NULL) ? NULL : version_->root);
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot::const_iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::end() const
+{
+    return const_iterator();
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::const_iterator::const_iterator() :
+    path_()
+{
+}
+
+/**
+* Starts at the smallest item under root.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::Snapshot::const_iterator::const_iterator(NodeType* root) :
+    path_()
+{
+    pushLeftPath(root);
+}
+
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::Snapshot::const_iterator::pushLeftPath(NodeType* node)
+{
+    while (node != NULL) {
+        path_.push_back(node);
+        node = node->getLeft();
+    }
+}
+
+template<class Key, class Value, class Compare>
+const std::pair<const Key, Value>&
+PersistentAVLTree<Key, Value, Compare>::Snapshot::const_iterator::operator*() const
+{
+    return path_.back()->getItem();
+}
+
+template<class Key, class Value, class Compare>
+const std::pair<const Key, Value>*
+PersistentAVLTree<Key, Value, Compare>::Snapshot::const_iterator::operator->() const
+{
+    return &path_.back()->getItem();
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::Snapshot::const_iterator::operator==(
+    const const_iterator& rhs) const
+{
+    if (path_.empty() || rhs.path_.empty()) {
+        return path_.empty() == rhs.path_.empty();
+    }
+    return path_.back() == rhs.path_.back();
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::Snapshot::const_iterator::operator!=(
+    const const_iterator& rhs) const
+{
+    return !(*this == rhs);
+}
+
+/**
+* Moves to the next item in key order.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot::const_iterator&
+PersistentAVLTree<Key, Value, Compare>::Snapshot::const_iterator::operator++()
+{
+    NodeType* done = path_.back();
+    path_.pop_back();
+    pushLeftPath(done->getRight());
+    return *this;
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot::const_iterator
+PersistentAVLTree<Key, Value, Compare>::Snapshot::const_iterator::operator++(int)
+{
+    const_iterator old(*this);
+    ++(*this);
+    return old;
+}
+
+/*
+  ----------------------------------------------------------------
+  End implementations for the PersistentAVLTree::Snapshot classes.
+  ----------------------------------------------------------------
+*/
+
+/*
+  ----------------------------------------------------
+  Begin implementations for the PersistentAVLTree class.
+  ----------------------------------------------------
+*/
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree() :
+    current_(reinterpret_cast<std::uintptr_t>(newVersion(NULL, 0))),
+    comp_()
+{
+}
+
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::PersistentAVLTree(const Compare& comp) :
+    current_(reinterpret_cast<std::uintptr_t>(newVersion(NULL, 0))),
+    comp_(comp)
+{
+}
+
+/**
+* Drops the tree's references. Snapshots still held by readers keep their
+* versions alive. No snapshot() call may be in progress.
+*/
+template<class Key, class Value, class Compare>
+PersistentAVLTree<Key, Value, Compare>::~PersistentAVLTree()
+{
+    retireVersion(current_.load(std::memory_order_acquire));
+}
+
+/**
+* Returns a snapshot of the latest published version. Wait-free: one
+* atomic add loads the version and counts the reader, never blocked by
+* the writer. Every reader that finds FOLD_READERS or more counted also
+* moves the count into the version's refs before returning, so the count
+* only goes past FOLD_READERS by the number of snapshot() calls in
+* progress at once and the 16 bits never fill up.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Snapshot
+PersistentAVLTree<Key, Value, Compare>::snapshot() const
+{
+    std::uint64_t word = current_.fetch_add(ONE_READER, std::memory_order_acquire) + ONE_READER;
+    if (readersOf(word) >= FOLD_READERS) {
+        foldReaders(word);
+    }
+    return Snapshot(versionOf(word), comp_);
+}
+
+/**
+* Inserts the pair, overwriting the value if the key exists, and
+* publishes the result as a new version. Copies O(log n) nodes.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::insert(const std::pair<const Key, Value>& keyValuePair)
+{
+    Version* version = versionOf(current_.load(std::memory_order_relaxed));
+    bool added = false;
+    NodeType* root = insertAt(version->root, keyValuePair, added);
+    publish(root, version->size + (added ? 1 : 0));
+}
+
+/**
+* Removes key, if present, and publishes the result as a new version.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::remove(const Key& key)
+{
+    Version* version = versionOf(current_.load(std::memory_order_relaxed));
+    bool removed = false;
+    NodeType* root = removeAt(version->root, key, removed);
+    if (!removed) {
+        if (root != NULL) {
+            root->release();
+        }
+        return;
+    }
+    publish(root, version->size - 1);
+}
+
+/**
+* Publishes an empty version. Snapshots taken earlier keep their items.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::clear()
+{
+    publish(NULL, 0);
+}
+
+template<class Key, class Value, class Compare>
+std::size_t PersistentAVLTree<Key, Value, Compare>::size() const
+{
+    return versionOf(current_.load(std::memory_order_relaxed))->size;
+}
+
+template<class Key, class Value, class Compare>
+bool PersistentAVLTree<Key, Value, Compare>::empty() const
+{
+    return size() == 0;
+}
+
+/**
+* Returns a new subtree equal to node's with item inserted. Only the
+* nodes on the search path are copied.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::insertAt(NodeType* node,
+    const std::pair<const Key, Value>& item, bool& added)
+{
+    if (node == NULL) {
+        added = true;
+        return new NodeType(item, NULL, NULL);
+    }
+    if (comp_(item.first, node->getKey())) {
+        NodeType* left = insertAt(node->getLeft(), item, added);
+        return balanced(node->getItem(), left, retain(node->getRight()));
+    }
+    if (comp_(node->getKey(), item.first)) {
+        NodeType* right = insertAt(node->getRight(), item, added);
+        return balanced(node->getItem(), retain(node->getLeft()), right);
+    }
+    return new NodeType(item, retain(node->getLeft()), retain(node->getRight()));
+}
+
+/**
+* Returns a new subtree equal to node's without key. If key is missing,
+* removed stays false and the result is node itself.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::removeAt(NodeType* node, const Key& key, bool& removed)
+{
+    if (node == NULL) {
+        return NULL;
+    }
+    if (comp_(key, node->getKey())) {
+        NodeType* left = removeAt(node->getLeft(), key, removed);
+        if (!removed) {
+            if (left != NULL) {
+                left->release();
+            }
+            return retain(node);
+        }
+        return balanced(node->getItem(), left, retain(node->getRight()));
+    }
+    if (comp_(node->getKey(), key)) {
+        NodeType* right = removeAt(node->getRight(), key, removed);
+        if (!removed) {
+            if (right != NULL) {
+                right->release();
+            }
+            return retain(node);
+        }
+        return balanced(node->getItem(), retain(node->getLeft()), right);
+    }
+
+    removed = true;
+    if (node->getLeft() == NULL) {
+        return retain(node->getRight());
+    }
+    if (node->getRight() == NULL) {
+        return retain(node->getLeft());
+    }
+    // Two children: the successor takes this node's place
+    NodeType* successor = node->getRight();
+    while (successor->getLeft() != NULL) {
+        successor = successor->getLeft();
+    }
+    return balanced(successor->getItem(), retain(node->getLeft()), removeSmallest(node->getRight()));
+}
+
+/**
+* Returns a new subtree equal to node's without its smallest item.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::removeSmallest(NodeType* node)
+{
+    if (node->getLeft() == NULL) {
+        return retain(node->getRight());
+    }
+    return balanced(node->getItem(), removeSmallest(node->getLeft()), retain(node->getRight()));
+}
+
+/**
+* Builds a node holding item over left and right, whose heights differ by
+* at most two, rotating (by building new nodes) so the result is AVL
+* balanced. These are the same single and double rotations AVLTree
+* does in place.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::balanced(const std::pair<const Key, Value>& item,
+    NodeType* left, NodeType* right)
+{
+    int leftHeight = heightOf(left);
+    int rightHeight = heightOf(right);
+
+    if (leftHeight > rightHeight + 1) {
+        NodeType* result;
+        NodeType* outer = left->getLeft();
+        NodeType* inner = left->getRight();
+        if (heightOf(outer) >= heightOf(inner)) {
+            // zig-zig: rotate right
+            result = new NodeType(left->getItem(), retain(outer),
+                                  new NodeType(item, retain(inner), right));
+        }
+        else {
+            // zig-zag: rotate left at left, then right
+            result = new NodeType(inner->getItem(),
+                                  new NodeType(left->getItem(), retain(outer), retain(inner->getLeft())),
+                                  new NodeType(item, retain(inner->getRight()), right));
+        }
+        left->release();
+        return result;
+    }
+
+    if (rightHeight > leftHeight + 1) {
+        NodeType* result;
+        NodeType* outer = right->getRight();
+        NodeType* inner = right->getLeft();
+        if (heightOf(outer) >= heightOf(inner)) {
+            result = new NodeType(right->getItem(),
+                                  new NodeType(item, left, retain(inner)), retain(outer));
+        }
+        else {
+            result = new NodeType(inner->getItem(),
+                                  new NodeType(item, left, retain(inner->getLeft())),
+                                  new NodeType(right->getItem(), retain(inner->getRight()), retain(outer)));
+        }
+        right->release();
+        return result;
+    }
+
+    return new NodeType(item, left, right);
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::NodeType*
+PersistentAVLTree<Key, Value, Compare>::retain(NodeType* node)
+{
+    if (node != NULL) {
+        node->retain();
+    }
+    return node;
+}
+
+template<class Key, class Value, class Compare>
+int PersistentAVLTree<Key, Value, Compare>::heightOf(NodeType* node)
+{
+    return (node == NULL) ? 0 : node->getHeight();
+}
+
+/**
+* Makes root the current version and retires the one it replaces.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::publish(NodeType* root, std::size_t size)
+{
+    std::uintptr_t version = reinterpret_cast<std::uintptr_t>(newVersion(root, size));
+    retireVersion(current_.exchange(version, std::memory_order_acq_rel));
+}
+
+/**
+* Moves the reader count in current_ onto the version's refs, retrying
+* until it succeeds or finds the work done: another reader has folded
+* the count below FOLD_READERS, or the writer has replaced the version
+* and taken the count with it. The refs go up before each attempt to
+* clear the count, so the version is never short of references.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::foldReaders(std::uint64_t word) const
+{
+    Version* version = versionOf(word);
+    std::int64_t added = 0;
+    while (versionOf(word) == version && readersOf(word) >= FOLD_READERS) {
+        std::int64_t readers = static_cast<std::int64_t>(readersOf(word));
+        version->refs.fetch_add(readers - added, std::memory_order_relaxed);
+        added = readers;
+        // Release, so the writer that next takes current_ sees the refs
+        if (current_.compare_exchange_weak(word, word & POINTER_MASK, std::memory_order_release,
+                                           std::memory_order_relaxed)) {
+            return;
+        }
+    }
+    // This reader still holds its own reference, so this cannot free it
+    version->refs.fetch_sub(added, std::memory_order_relaxed);
+}
+
+/**
+* Drops the tree's reference on the version in word, which current_ no
+* longer holds: the snapshots taken of it become ordinary references in
+* place of CURRENT_BIAS, and it is freed if none is left.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::retireVersion(std::uint64_t word)
+{
+    Version* version = versionOf(word);
+    std::int64_t change = static_cast<std::int64_t>(readersOf(word)) - CURRENT_BIAS;
+    if (version->refs.fetch_add(change, std::memory_order_acq_rel) == -change) {
+        if (version->root != NULL) {
+            version->root->release();
+        }
+        delete version;
+    }
+}
+
+/**
+* Allocates a version to be made current, holding the tree's reference.
+* Throws std::runtime_error if its address does not fit in current_.
+*/
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Version*
+PersistentAVLTree<Key, Value, Compare>::newVersion(NodeType* root, std::size_t size)
+{
+    Version* version = new Version;
+    if ((reinterpret_cast<std::uintptr_t>(version) & ~POINTER_MASK) != 0) {
+        delete version;
+        throw std::runtime_error("PersistentAVLTree needs addresses below 2^48");
+    }
+    version->refs.store(CURRENT_BIAS, std::memory_order_relaxed);
+    version->root = root;
+    version->size = size;
+    return version;
+}
+
+/**
+* Drops a reference on version, freeing it and releasing its root once
+* nobody holds it. Nodes shared with newer versions survive.
+*/
+template<class Key, class Value, class Compare>
+void PersistentAVLTree<Key, Value, Compare>::releaseVersion(Version* version)
+{
+    if (version->refs.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+        if (version->root != NULL) {
+            version->root->release();
+        }
+        delete version;
+    }
+}
+
+template<class Key, class Value, class Compare>
+typename PersistentAVLTree<Key, Value, Compare>::Version*
+PersistentAVLTree<Key, Value, Compare>::versionOf(std::uint64_t word)
+{
+    return reinterpret_cast<Version*>(static_cast<std::uintptr_t>(word & POINTER_MASK));
+}
+
+template<class Key, class Value, class Compare>
+std::uint64_t PersistentAVLTree<Key, Value, Compare>::readersOf(std::uint64_t word)
+{
+    return word >> READER_SHIFT;
+}
+
+/*
+  --------------------------------------------------
+  End implementations for the PersistentAVLTree class.
+  --------------------------------------------------
+*/
+
+#endif
@@ -0,0 +1,114 @@
+#include <iostream>
+#include <iomanip>
+#include <cstdlib>
+#include <chrono>
+#include <vector>
+#include "avlbst.h"
+#include "rbbst.h"
+
+using namespace std;
+
+// Throughput of RedBlackTree against AVLTree on mixes of inserts, removes
+// and lookups, from read-mostly to write-only. Built with -DBST_STATS
+// (make DEFS=-DBST_STATS rb-bench) it also prints the rotations each tree
+// made per write.
+//
+// usage: rb-bench [ops] [keyRange]
+
+// Cheap random numbers (xorshift), so the generator is not what we measure
+struct Rng
+{
+    explicit Rng(unsigned long seed) : state(seed * 2654435761UL + 1) { }
+    unsigned long next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+    unsigned long state;
+};
+
+static long checksum = 0;
+
+struct Result
+{
+    double mops;
+    double rotationsPerWrite;
+};
+
+// Runs ops operations, writePercent of them split evenly between inserts
+// and removes and the rest lookups, on a tree that starts half full
+template<typename Tree>
+Result run(int ops, int keyRange, int writePercent)
+{
+    Tree tree;
+    Rng fill(0);
+    for (int i = 0; i < keyRange / 2; ++i) {
+        tree.insert(make_pair(static_cast<int>(fill.next() % keyRange), i));
+    }
+    tree.resetStats();
+
+    Rng rng(writePercent + 1);
+    long found = 0;
+    long writes = 0;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    for (int i = 0; i < ops; ++i) {
+        unsigned long r = rng.next();
+        int key = static_cast<int>((r >> 8) % keyRange);
+        int op = static_cast<int>(r % 100);
+        if (op >= writePercent) {
+            found += tree.find(key) != tree.end();
+        }
+        else if (op % 2 == 0) {
+            tree.insert(make_pair(key, i));
+            ++writes;
+        }
+        else {
+            tree.remove(key);
+            ++writes;
+        }
+    }
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    checksum += found;
+
+    TreeStats stats = tree.stats();
+    Result result;
+    result.mops = ops / seconds / 1e6;
+    result.rotationsPerWrite = writes > 0 ?
+        static_cast<double>(stats.singleRotations + 2 * stats.doubleRotations) / writes : 0;
+    return result;
+}
+
+int main(int argc, char *argv[])
+{
+    int ops = 2000000;
+    int keyRange = 1000000;
+    if (argc > 1) ops = atoi(argv[1]);
+    if (argc > 2) keyRange = atoi(argv[2]);
+    if (ops < 1 || keyRange < 2) {
+        cerr << "usage: rb-bench [ops] [keyRange]" << endl;
+        return 1;
+    }
+
+    cout << "ops " << ops << ", keys " << keyRange << endl;
+    cout << setw(8) << "writes" << setw(18) << "AVLTree Mops/s" << setw(22) << "RedBlackTree Mops/s";
+#ifdef BST_STATS
+    cout << setw(16) << "AVL rot/write" << setw(16) << "RB rot/write";
+#endif
+    cout << endl;
+
+    const int mixes[] = { 10, 30, 50, 70, 90, 100 };
+    for (size_t i = 0; i < sizeof(mixes) / sizeof(mixes[0]); ++i) {
+        Result avl = run<AVLTree<int, int> >(ops, keyRange, mixes[i]);
+        Result rb = run<RedBlackTree<int, int> >(ops, keyRange, mixes[i]);
+        cout << setw(7) << mixes[i] << "%" << fixed << setprecision(2)
+             << setw(18) << avl.mops << setw(22) << rb.mops;
+#ifdef BST_STATS
+        cout << setprecision(3) << setw(16) << avl.rotationsPerWrite << setw(16) << rb.rotationsPerWrite;
+#endif
+        cout << endl;
+    }
+    cout << "checksum " << checksum << endl;
+    return 0;
+}
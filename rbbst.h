@@ -0,0 +1,600 @@
+#ifndef RBBST_H
+#define RBBST_H
+
+#include <iostream>
+#include <exception>
+#include <cstdlib>
+#include <algorithm>
+#include <functional>
+#include "bst.h"
+
+/**
+* A node for a red-black tree, which adds the node's color to Node.
+* New nodes are red.
+*/
+template <typename Key, typename Value>
+class RBNode : public Node<Key, Value>
+{
+public:
+    // Constructor/destructor.
+    RBNode(const Key& key, const Value& value, RBNode<Key, Value>* parent);
+    template<typename... KeyArgs, typename... ValueArgs>
+    RBNode(std::piecewise_construct_t, std::tuple<KeyArgs...>&& keyArgs,
+           std::tuple<ValueArgs...>&& valueArgs, RBNode<Key, Value>* parent);
+    RBNode(ItemMaker<Key, Value>& maker, RBNode<Key, Value>* parent);
+    virtual ~RBNode();
+
+    // Getter/setter for the node's color.
+    bool isRed () const;
+    void setRed (bool red);
+
+    // Getters for parent, left, and right, returning RBNodes. These hide
+    // (not override) the Node getters; see the Node class in bst.h.
+    RBNode<Key, Value>* getParent() const;
+    RBNode<Key, Value>* getLeft() const;
+    RBNode<Key, Value>* getRight() const;
+
+protected:
+    bool red_;
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RBNode class.
+  -------------------------------------------------
+*/
+
+/**
+* An explicit constructor to initialize the elements by calling the base class constructor
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::RBNode(const Key& key, const Value& value, RBNode<Key, Value> *parent) :
+    Node<Key, Value>(key, value, parent), red_(true)
+{
+
+}
+
+/**
+* A piecewise constructor forwarding the key and value arguments to the base class.
+*/
+template<class Key, class Value>
+template<typename... KeyArgs, typename... ValueArgs>
+RBNode<Key, Value>::RBNode(std::piecewise_construct_t, std::tuple<KeyArgs...>&& keyArgs,
+                           std::tuple<ValueArgs...>&& valueArgs, RBNode<Key, Value> *parent) :
+    Node<Key, Value>(std::piecewise_construct, std::move(keyArgs), std::move(valueArgs), parent), red_(true)
+{
+
+}
+
+/**
+* A constructor taking the item from maker, see ItemMaker.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::RBNode(ItemMaker<Key, Value>& maker, RBNode<Key, Value> *parent) :
+    Node<Key, Value>(maker, parent), red_(true)
+{
+
+}
+
+/**
+* A destructor which does nothing.
+*/
+template<class Key, class Value>
+RBNode<Key, Value>::~RBNode()
+{
+
+}
+
+/**
+* A getter for the color of a RBNode.
+*/
+template<class Key, class Value>
+bool RBNode<Key, Value>::isRed() const
+{
+    return red_;
+}
+
+/**
+* A setter for the color of a RBNode.
+*/
+template<class Key, class Value>
+void RBNode<Key, Value>::setRed(bool red)
+{
+    red_ = red;
+}
+
+/**
+* A redefined getter for the parent since a static_cast is necessary to make sure
+* that our node is a RBNode.
+*/
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getParent() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->parent_);
+}
+
+/**
+* Redefined for the same reasons as above.
+*/
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getLeft() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->left_);
+}
+
+/**
+* Redefined for the same reasons as above.
+*/
+template<class Key, class Value>
+RBNode<Key, Value> *RBNode<Key, Value>::getRight() const
+{
+    return static_cast<RBNode<Key, Value>*>(this->right_);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RBNode class.
+  -----------------------------------------------
+*/
+
+
+/**
+* A self-balancing red-black tree. Its balance is looser than AVLTree's
+* (a path may be up to twice as long as another), which buys cheaper
+* updates: an insert makes at most two rotations and a remove at most
+* three, and the recoloring walk up the tree is O(1) amortized. Lookups
+* are the BinarySearchTree ones. isBalanced() and balanceReport() check
+* the stricter AVL condition, which a valid red-black tree need not meet;
+* use isRedBlack() to check this tree's own invariants.
+*/
+template <class Key, class Value, class Compare = std::less<Key> >
+class RedBlackTree : public BinarySearchTree<Key, Value, Compare>
+{
+public:
+    typedef typename BinarySearchTree<Key, Value, Compare>::iterator iterator;
+    typedef typename BinarySearchTree<Key, Value, Compare>::const_iterator const_iterator;
+    typedef typename BinarySearchTree<Key, Value, Compare>::reverse_iterator reverse_iterator;
+    typedef typename BinarySearchTree<Key, Value, Compare>::const_reverse_iterator const_reverse_iterator;
+
+    RedBlackTree();
+    explicit RedBlackTree(const Compare& comp);
+    template<typename InputIt>
+    RedBlackTree(InputIt first, InputIt last, const Compare& comp = Compare());
+    virtual void remove(const Key& key);
+
+    // Checks the red-black rules: black root, no red node with a red
+    // child, and the same number of black nodes on every path down
+    bool isRedBlack() const;
+protected:
+    virtual void nodeSwap( RBNode<Key,Value>* n1, RBNode<Key,Value>* n2);
+
+    // The inserting functions (insert, emplace, try_emplace) are the
+    // BinarySearchTree ones, which build RBNodes and recolor through these
+    virtual Node<Key, Value>* createLeaf(ItemMaker<Key, Value>& maker);
+    virtual void afterInsert(Node<Key, Value>* node);
+    virtual void buildSorted(std::vector<std::pair<Key, Value> >& items);
+
+    void rotateLeft (RBNode<Key, Value>* current);
+    void rotateRight (RBNode<Key, Value>* current);
+    void insertFix (RBNode<Key, Value>* node);
+    void removeFix (RBNode<Key, Value>* node, RBNode<Key, Value>* parent);
+    void unlinkNode (RBNode<Key, Value>* removeNode);
+    RBNode<Key, Value>* predecessor(RBNode<Key, Value>* current);
+    static bool isRed (RBNode<Key, Value>* node);
+    static int blackHeight (RBNode<Key, Value>* node);
+    static void colorLevel (RBNode<Key, Value>* node, int depth, int redDepth);
+
+    // Bulk-loaded nodes start out black; see buildSorted()
+    struct ColorBlack
+    {
+        void operator()(RBNode<Key, Value>* node, int, int) const
+        {
+            node->setRed(false);
+        }
+    };
+};
+
+/*
+  -------------------------------------------------
+  Begin implementations for the RedBlackTree class.
+  -------------------------------------------------
+*/
+
+/**
+* Default constructor; sizes the node pool for RBNodes.
+*/
+template<class Key, class Value, class Compare>
+RedBlackTree<Key, Value, Compare>::RedBlackTree() :
+    BinarySearchTree<Key, Value, Compare>(sizeof(RBNode<Key, Value>), Compare())
+{
+
+}
+
+/**
+* Constructor for a RedBlackTree ordered by the given comparator.
+*/
+template<class Key, class Value, class Compare>
+RedBlackTree<Key, Value, Compare>::RedBlackTree(const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare>(sizeof(RBNode<Key, Value>), comp)
+{
+
+}
+
+/**
+* Builds a RedBlackTree holding the items of [first, last) in linear time.
+* See assign().
+*/
+template<class Key, class Value, class Compare>
+template<typename InputIt>
+RedBlackTree<Key, Value, Compare>::RedBlackTree(InputIt first, InputIt last, const Compare& comp) :
+    BinarySearchTree<Key, Value, Compare>(sizeof(RBNode<Key, Value>), comp)
+{
+    this->assign(first, last);
+}
+
+/**
+* The bulk build behind BinarySearchTree::assign(), in O(n). The sorted
+* items are linked into a height-balanced tree, whose leaves all sit on the
+* bottom two levels; coloring the bottom level red and everything else
+* black satisfies the red-black rules.
+*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::buildSorted(std::vector<std::pair<Key, Value> >& items)
+{
+    this->template buildFromSorted<RBNode<Key, Value> >(items, ColorBlack());
+
+    // linkSubtree never puts fewer nodes on the left than on the right, so
+    // the left spine is as long as the tree is tall
+    int height = 0;
+    for (RBNode<Key, Value>* node = static_cast<RBNode<Key, Value>*>(this->root_); node != NULL;
+         node = node->getLeft()) {
+        ++height;
+    }
+    if (height > 1) {
+        colorLevel(static_cast<RBNode<Key, Value>*>(this->root_), 1, height);
+    }
+}
+
+/**
+* Colors the nodes at depth redDepth (the root being at depth 1) red.
+*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::colorLevel(RBNode<Key, Value>* node, int depth, int redDepth)
+{
+    if (node == NULL) {
+        return;
+    }
+    if (depth == redDepth) {
+        node->setRed(true);
+        return;
+    }
+    colorLevel(node->getLeft(), depth + 1, redDepth);
+    colorLevel(node->getRight(), depth + 1, redDepth);
+}
+
+/**
+* Builds an unlinked (red) RBNode for BinarySearchTree::emplaceNode.
+*/
+template<class Key, class Value, class Compare>
+Node<Key, Value>* RedBlackTree<Key, Value, Compare>::createLeaf(ItemMaker<Key, Value>& maker)
+{
+    return this->template createNode<RBNode<Key, Value> >(maker);
+}
+
+/**
+* Restores the red-black rules after BinarySearchTree::emplaceNode linked
+* in node.
+*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::afterInsert(Node<Key, Value>* node)
+{
+    insertFix(static_cast<RBNode<Key, Value>*>(node));
+}
+
+/**
+* Returns true for a red node; NULL children count as black.
+*/
+template<class Key, class Value, class Compare>
+bool RedBlackTree<Key, Value, Compare>::isRed (RBNode<Key, Value>* node)
+{
+    return node != NULL && node->isRed();
+}
+
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::rotateLeft (RBNode<Key, Value>* current)
+{
+    RBNode<Key, Value>* child = current->getRight();
+    RBNode<Key, Value>* parent = current->getParent();
+
+    child->setParent(parent);
+    if (parent == NULL) {
+        this->root_ = child;
+    }
+    else if (parent->getLeft() == current) {
+        parent->setLeft(child);
+    }
+    else {
+        parent->setRight(child);
+    }
+
+    current->setParent(child);
+    current->setRight(child->getLeft());
+    if (child->getLeft()) {
+        child->getLeft()->setParent(current);
+    }
+    child->setLeft(current);
+}
+
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::rotateRight (RBNode<Key, Value>* current)
+{
+    RBNode<Key, Value>* child = current->getLeft();
+    RBNode<Key, Value>* parent = current->getParent();
+
+    child->setParent(parent);
+    if (parent == NULL) {
+        this->root_ = child;
+    }
+    else if (parent->getLeft() == current) {
+        parent->setLeft(child);
+    }
+    else {
+        parent->setRight(child);
+    }
+
+    current->setParent(child);
+    current->setLeft(child->getRight());
+    if (child->getRight()) {
+        child->getRight()->setParent(current);
+    }
+    child->setRight(current);
+}
+
+/**
+* Restores the red-black rules after node has been linked in as a red leaf.
+* While node's parent is red too, a red uncle means the red can be pushed up
+* two levels by recoloring; otherwise one or two rotations finish the job.
+*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::insertFix (RBNode<Key, Value>* node)
+{
+    BST_STAT(++this->stats_.retraces;)
+    RBNode<Key, Value>* parent = node->getParent();
+    while (isRed(parent)) {
+        BST_STAT(++this->stats_.retraceSteps;)
+        // parent is red, so it is not the root and grand exists
+        RBNode<Key, Value>* grand = parent->getParent();
+        if (grand->getLeft() == parent) {
+            RBNode<Key, Value>* uncle = grand->getRight();
+            if (isRed(uncle)) {
+                parent->setRed(false);
+                uncle->setRed(false);
+                grand->setRed(true);
+                node = grand;
+                parent = node->getParent();
+                continue;
+            }
+            if (parent->getRight() == node) {
+                BST_STAT(++this->stats_.doubleRotations;)
+                rotateLeft(parent);
+                parent = node;
+            }
+            else {
+                BST_STAT(++this->stats_.singleRotations;)
+            }
+            rotateRight(grand);
+        }
+        else {
+            RBNode<Key, Value>* uncle = grand->getLeft();
+            if (isRed(uncle)) {
+                parent->setRed(false);
+                uncle->setRed(false);
+                grand->setRed(true);
+                node = grand;
+                parent = node->getParent();
+                continue;
+            }
+            if (parent->getLeft() == node) {
+                BST_STAT(++this->stats_.doubleRotations;)
+                rotateRight(parent);
+                parent = node;
+            }
+            else {
+                BST_STAT(++this->stats_.singleRotations;)
+            }
+            rotateLeft(grand);
+        }
+        parent->setRed(false);
+        grand->setRed(true);
+        break;
+    }
+    static_cast<RBNode<Key, Value>*>(this->root_)->setRed(false);
+}
+
+/**
+* Removes the entry with the given key, if there is one, and rebalances.
+*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::remove(const Key& key)
+{
+    RBNode<Key, Value>* removeNode = this->template findNode<RBNode<Key, Value> >(key);
+    if (removeNode != NULL) {
+        unlinkNode(removeNode);
+        this->destroyNode(removeNode);
+    }
+}
+
+/**
+* Takes node out of the tree and rebalances, without destroying it. A node
+* with two children first swaps places (and colors) with its predecessor,
+* so the node unlinked has at most one child.
+*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::unlinkNode(RBNode<Key, Value>* removeNode)
+{
+    if (removeNode->getLeft() && removeNode->getRight()) {
+        nodeSwap(removeNode, predecessor(removeNode));
+    }
+
+    RBNode<Key, Value>* parent = removeNode->getParent();
+    RBNode<Key, Value>* child = (removeNode->getLeft() != NULL) ? removeNode->getLeft() : removeNode->getRight();
+    if (child != NULL) {
+        child->setParent(parent);
+    }
+    if (parent == NULL) {
+        this->root_ = child;
+    }
+    else if (parent->getLeft() == removeNode) {
+        parent->setLeft(child);
+    }
+    else {
+        parent->setRight(child);
+    }
+
+    // Taking out a red node changes no black counts. A black one with a red
+    // child is replaced by that child turned black; otherwise the paths
+    // through child are a black node short.
+    if (!removeNode->isRed()) {
+        if (isRed(child)) {
+            child->setRed(false);
+        }
+        else {
+            removeFix(child, parent);
+        }
+    }
+}
+
+/**
+* Fixes the black counts after the paths through node (which may be NULL,
+* and is then identified by parent) lost a black node. Recoloring the
+* sibling moves the shortage up a level; otherwise at most three rotations
+* settle it.
+*/
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::removeFix (RBNode<Key, Value>* node, RBNode<Key, Value>* parent)
+{
+    BST_STAT(++this->stats_.retraces;)
+    while (node != this->root_ && !isRed(node)) {
+        BST_STAT(++this->stats_.retraceSteps;)
+        // node's side is a black node short, so its sibling is not NULL
+        if (parent->getLeft() == node) {
+            RBNode<Key, Value>* sibling = parent->getRight();
+            if (sibling->isRed()) {
+                BST_STAT(++this->stats_.singleRotations;)
+                sibling->setRed(false);
+                parent->setRed(true);
+                rotateLeft(parent);
+                sibling = parent->getRight();
+            }
+            if (!isRed(sibling->getLeft()) && !isRed(sibling->getRight())) {
+                sibling->setRed(true);
+                node = parent;
+                parent = node->getParent();
+                continue;
+            }
+            if (!isRed(sibling->getRight())) {
+                BST_STAT(++this->stats_.doubleRotations;)
+                sibling->getLeft()->setRed(false);
+                sibling->setRed(true);
+                rotateRight(sibling);
+                sibling = parent->getRight();
+            }
+            else {
+                BST_STAT(++this->stats_.singleRotations;)
+            }
+            sibling->setRed(parent->isRed());
+            parent->setRed(false);
+            sibling->getRight()->setRed(false);
+            rotateLeft(parent);
+        }
+        else {
+            RBNode<Key, Value>* sibling = parent->getLeft();
+            if (sibling->isRed()) {
+                BST_STAT(++this->stats_.singleRotations;)
+                sibling->setRed(false);
+                parent->setRed(true);
+                rotateRight(parent);
+                sibling = parent->getLeft();
+            }
+            if (!isRed(sibling->getLeft()) && !isRed(sibling->getRight())) {
+                sibling->setRed(true);
+                node = parent;
+                parent = node->getParent();
+                continue;
+            }
+            if (!isRed(sibling->getLeft())) {
+                BST_STAT(++this->stats_.doubleRotations;)
+                sibling->getRight()->setRed(false);
+                sibling->setRed(true);
+                rotateLeft(sibling);
+                sibling = parent->getLeft();
+            }
+            else {
+                BST_STAT(++this->stats_.singleRotations;)
+            }
+            sibling->setRed(parent->isRed());
+            parent->setRed(false);
+            sibling->getLeft()->setRed(false);
+            rotateRight(parent);
+        }
+        return;
+    }
+    if (node != NULL) {
+        node->setRed(false);
+    }
+}
+
+template<class Key, class Value, class Compare>
+RBNode<Key, Value>* RedBlackTree<Key, Value, Compare>::predecessor(RBNode<Key, Value>* current)
+{
+    return BinarySearchTree<Key, Value, Compare>::predecessorOf(current);
+}
+
+template<class Key, class Value, class Compare>
+void RedBlackTree<Key, Value, Compare>::nodeSwap( RBNode<Key,Value>* n1, RBNode<Key,Value>* n2)
+{
+    BinarySearchTree<Key, Value, Compare>::nodeSwap(n1, n2);
+    bool tempRed = n1->isRed();
+    n1->setRed(n2->isRed());
+    n2->setRed(tempRed);
+}
+
+/**
+* Returns true iff the tree satisfies the red-black rules. O(n).
+*/
+template<class Key, class Value, class Compare>
+bool RedBlackTree<Key, Value, Compare>::isRedBlack() const
+{
+    RBNode<Key, Value>* root = static_cast<RBNode<Key, Value>*>(this->root_);
+    return !isRed(root) && blackHeight(root) >= 0;
+}
+
+/**
+* Returns the number of black nodes on every path down from node (counting
+* node itself), or -1 if the paths disagree or a red node has a red child.
+* The recursion is as deep as the tree.
+*/
+template<class Key, class Value, class Compare>
+int RedBlackTree<Key, Value, Compare>::blackHeight(RBNode<Key, Value>* node)
+{
+    if (node == NULL) {
+        return 0;
+    }
+    if (node->isRed() && (isRed(node->getLeft()) || isRed(node->getRight()))) {
+        return -1;
+    }
+    int left = blackHeight(node->getLeft());
+    int right = blackHeight(node->getRight());
+    if (left < 0 || left != right) {
+        return -1;
+    }
+    return left + (node->isRed() ? 0 : 1);
+}
+
+/*
+  -----------------------------------------------
+  End implementations for the RedBlackTree class.
+  -----------------------------------------------
+*/
+
+#endif
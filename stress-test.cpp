@@ -0,0 +1,103 @@
+#include <iostream>
+#include <cstdlib>
+#include "bst.h"
+
+using namespace std;
+
+// Counts destructor calls so we can check clear() reaches every node
+static long destroyed = 0;
+
+struct Counted
+{
+    int value;
+    explicit Counted(int v) : value(v) { }
+    Counted(const Counted& other) : value(other.value) { }
+    ~Counted() { ++destroyed; }
+};
+
+ostream& operator<<(ostream& os, const Counted& c)
+{
+    return os << c.value;
+}
+
+// Builds the shape sorted inserts produce (every node a right child of the
+// last) in O(n), without paying the O(n^2) of actually inserting in order.
+class DegenerateBST : public BinarySearchTree<int, Counted>
+{
+public:
+    void buildChain(int n)
+    {
+        clear();
+        Node<int, Counted>* tail = NULL;
+        for (int i = 0; i < n; ++i) {
+            Node<int, Counted>* node = createNode<Node<int, Counted> >(i, Counted(i));
+            if (tail == NULL) {
+                root_ = node;
+            }
+            else {
+                node->setParent(tail);
+                tail->setRight(node);
+            }
+            tail = node;
+        }
+    }
+
+    int height() const
+    {
+        return getHeight(root_);
+    }
+};
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        cout << "FAILED: " << what << endl;
+        ++failures;
+    }
+}
+
+int main(int argc, char *argv[])
+{
+    int n = 10000000;
+    if (argc > 1) {
+        n = atoi(argv[1]);
+    }
+
+    {
+        DegenerateBST bt;
+        bt.buildChain(n);
+        cout << "Built a degenerate tree of " << n << " nodes" << endl;
+
+        check(bt.height() == n, "height of the chain");
+
+        DegenerateBST::BalanceReport report = bt.balanceReport();
+        check(report.nodes == static_cast<size_t>(n), "balance report node count");
+        check(report.height == n, "balance report height");
+        check(n < 3 || !report.balanced, "chain reported unbalanced");
+        check(n < 3 || report.firstUnbalanced->getKey() == n - 3, "first unbalanced node");
+        check(n < 3 || !bt.isBalanced(), "isBalanced on the chain");
+
+        long count = 0;
+        for (DegenerateBST::iterator it = bt.begin(); it != bt.end(); ++it) {
+            ++count;
+        }
+        check(count == n, "in-order walk visits every node");
+
+        destroyed = 0;
+        bt.clear();
+        check(destroyed == n, "clear destroys every node");
+        check(bt.empty(), "tree empty after clear");
+
+        // The destructor takes the same path as clear()
+        bt.buildChain(n);
+        destroyed = 0;
+    }
+    check(destroyed == n, "destructor destroys every node");
+
+    if (failures == 0) {
+        cout << "All stress checks passed" << endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
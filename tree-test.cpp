@@ -0,0 +1,941 @@
+#include <iostream>
+#include <sstream>
+#include <map>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <iterator>
+#include <algorithm>
+#include <fstream>
+#include <climits>
+#include <cfloat>
+#include <cstdlib>
+#include <chrono>
+#include <unistd.h>
+#include "bst.h"
+#include "avlbst.h"
+#include "rbbst.h"
+#include "btree.h"
+#include "compact_avlbst.h"
+#include "indexed_avlbst.h"
+#include "mapped_bst.h"
+
+using namespace std;
+
+// Checks the tree features against std::map on random operations. Every
+// check that fails is printed; the exit status is nonzero if any did.
+//
+// usage: tree-test [seed]
+
+static int failures = 0;
+
+static void check(bool ok, const char* what)
+{
+    if (!ok) {
+        cout << "FAILED: " << what << endl;
+        ++failures;
+    }
+}
+
+// Cheap random numbers (xorshift), seeded from the command line
+struct Rng
+{
+    explicit Rng(unsigned long seed) : state(seed * 2654435761UL + 1) { }
+    unsigned long next()
+    {
+        state ^= state << 13;
+        state ^= state >> 7;
+        state ^= state << 17;
+        return state;
+    }
+    int below(int n) { return static_cast<int>(next() % n); }
+    unsigned long state;
+};
+
+typedef map<int, int> Reference;
+
+// True if iterating tree yields exactly the items of ref, in order
+template<typename Tree>
+bool sameContents(Tree& tree, const Reference& ref)
+{
+    typename Tree::iterator it = tree.begin();
+    for (Reference::const_iterator m = ref.begin(); m != ref.end(); ++m, ++it) {
+        if (it == tree.end() || it->first != m->first || it->second != m->second) {
+            return false;
+        }
+    }
+    return it == tree.end();
+}
+
+// True if it is end() and m is ref.end(), or both point at the same key
+template<typename Tree>
+bool sameEntry(Tree& tree, typename Tree::iterator it, const Reference& ref, Reference::const_iterator m)
+{
+    if (m == ref.end()) {
+        return it == tree.end();
+    }
+    return it != tree.end() && it->first == m->first && it->second == m->second;
+}
+
+// Inserting, emplacing and bulk loading through a BinarySearchTree
+// reference must build the derived tree's own nodes
+template<typename Tree>
+void checkBaseReference(Rng& rng, const char* what)
+{
+    Tree tree;
+    BinarySearchTree<int, int>& base = tree;
+    Reference ref;
+    for (int i = 0; i < 3000; ++i) {
+        int key = rng.below(1000);
+        switch (i % 5) {
+        case 0: base.insert(make_pair(key, i)); ref[key] = i; break;
+        case 1: base.emplace(key, i); ref[key] = i; break;
+        case 2: base.try_emplace(key, i); ref.insert(make_pair(key, i)); break;
+        case 3: base.insert(base.find(key), make_pair(key, i)); ref[key] = i; break;
+        default: base.remove(key); ref.erase(key); break;
+        }
+    }
+    check(sameContents(tree, ref), what);
+    check(tree.balanceReport().balanceMismatches == 0, what);
+
+    vector<pair<int, int> > items(ref.begin(), ref.end());
+    base.assign(items.begin(), items.end());
+    for (int i = 0; i < 1000; i += 3) {
+        base.remove(i);
+        ref.erase(i);
+    }
+    check(sameContents(tree, ref), what);
+    check(tree.balanceReport().balanceMismatches == 0, what);
+}
+
+// An AVLTree whose root's stored balance can be knocked off
+struct CorruptibleAVLTree : public AVLTree<int, int>
+{
+    void corruptRoot()
+    {
+        AVLNode<int, int>* root = static_cast<AVLNode<int, int>*>(this->root_);
+        root->setBalance(static_cast<int8_t>(root->getBalance() == 0 ? 1 : 0));
+    }
+};
+
+void testBaseReference(Rng& rng)
+{
+    checkBaseReference<AVLTree<int, int> >(rng, "AVLTree through a BinarySearchTree reference");
+    checkBaseReference<RedBlackTree<int, int> >(rng, "RedBlackTree through a BinarySearchTree reference");
+
+    RedBlackTree<int, int> rb;
+    BinarySearchTree<int, int>& base = rb;
+    for (int i = 0; i < 1000; ++i) {
+        base.emplace(rng.below(500), i);
+    }
+    check(rb.isRedBlack(), "red-black rules after base-class emplace");
+    AVLTree<int, int> avl;
+    BinarySearchTree<int, int>& avlBase = avl;
+    for (int i = 0; i < 1000; ++i) {
+        avlBase.try_emplace(i, i);
+    }
+    check(avl.isBalanced(), "AVL balance after base-class try_emplace");
+
+    // The AVL check of stored balances must run through a base reference too
+    CorruptibleAVLTree corrupt;
+    for (int i = 0; i < 100; ++i) {
+        corrupt.insert(make_pair(i, i));
+    }
+    const BinarySearchTree<int, int>& corruptBase = corrupt;
+    bool before = corruptBase.isBalanced();
+    corrupt.corruptRoot();
+    check(before && corruptBase.balanceReport().balanceMismatches == 1 && !corruptBase.isBalanced() &&
+          !corrupt.isBalanced(), "isBalanced checks stored balances through a base reference");
+}
+
+void testOrderStatistics(Rng& rng)
+{
+    AVLTree<int, int, less<int>, true> tree;
+    Reference ref;
+    bool ranksOk = true;
+    bool selectOk = true;
+    bool countOk = true;
+    for (int round = 0; round < 40; ++round) {
+        for (int i = 0; i < 100; ++i) {
+            int key = rng.below(2000);
+            if (rng.below(3) == 0) {
+                tree.remove(key);
+                ref.erase(key);
+            }
+            else {
+                tree.insert(make_pair(key, i));
+                ref[key] = i;
+            }
+        }
+        for (int probe = 0; probe < 50; ++probe) {
+            int key = rng.below(2100) - 50;
+            size_t expected = distance(ref.begin(), ref.lower_bound(key));
+            ranksOk = ranksOk && tree.rank(key) == expected;
+
+            int lo = rng.below(2100) - 50;
+            int hi = lo + rng.below(300) - 50;
+            size_t inRange = (hi < lo) ? 0 : distance(ref.lower_bound(lo), ref.upper_bound(hi));
+            countOk = countOk && tree.count(lo, hi) == inRange;
+        }
+        size_t k = 0;
+        for (Reference::const_iterator m = ref.begin(); m != ref.end(); ++m, ++k) {
+            selectOk = selectOk && tree.select(k) != tree.end() && tree.select(k)->first == m->first;
+        }
+        selectOk = selectOk && tree.select(ref.size()) == tree.end();
+    }
+    check(ranksOk, "rank matches std::map");
+    check(selectOk, "select matches std::map");
+    check(countOk, "count matches std::map");
+}
+
+void testSplitJoinErase(Rng& rng)
+{
+    typedef AVLTree<int, int, less<int>, true> Tree;
+    bool splitOk = true;
+    bool joinOk = true;
+    bool eraseOk = true;
+    for (int round = 0; round < 50; ++round) {
+        Tree left;
+        Reference ref;
+        int n = rng.below(2000);
+        for (int i = 0; i < n; ++i) {
+            int key = rng.below(5000);
+            left.insert(make_pair(key, i));
+            ref[key] = i;
+        }
+
+        int cut = rng.below(5200) - 100;
+        Tree right;
+        right.insert(make_pair(-1, -1));  // split discards right's contents
+        left.split(cut, right);
+        Reference refRight(ref.lower_bound(cut), ref.end());
+        Reference refLeft(ref.begin(), ref.lower_bound(cut));
+        splitOk = splitOk && sameContents(left, refLeft) && sameContents(right, refRight) &&
+                  left.isBalanced() && right.isBalanced() &&
+                  left.balanceReport().balanceMismatches == 0 &&
+                  right.balanceReport().balanceMismatches == 0 &&
+                  right.select(refRight.size()) == right.end();
+
+        // New entries on both sides allocate from the slabs they now share
+        for (int i = 0; i < 100; ++i) {
+            int key = rng.below(5000);
+            if (key < cut) {
+                left.insert(make_pair(key, -i));
+                refLeft[key] = -i;
+            }
+            else {
+                right.remove(key);
+                refRight.erase(key);
+            }
+        }
+
+        left.join(right);
+        refLeft.insert(refRight.begin(), refRight.end());
+        joinOk = joinOk && sameContents(left, refLeft) && right.empty() && left.isBalanced() &&
+                 left.rank(cut) == static_cast<size_t>(distance(refLeft.begin(), refLeft.lower_bound(cut)));
+
+        int lo = rng.below(5000);
+        int hi = lo + rng.below(1000);
+        left.erase(lo, hi);
+        refLeft.erase(refLeft.lower_bound(lo), refLeft.lower_bound(hi));
+        eraseOk = eraseOk && sameContents(left, refLeft) && left.isBalanced() &&
+                  (hi == lo || left.count(lo, hi - 1) == 0);
+    }
+    check(splitOk, "split matches std::map");
+    check(joinOk, "join matches std::map");
+    check(eraseOk, "erase(lo, hi) matches std::map");
+}
+
+// Resident memory in KB, or -1 where /proc is not available
+static long residentKb()
+{
+    ifstream statm("/proc/self/statm");
+    long total = 0;
+    long resident = 0;
+    if (!(statm >> total >> resident)) {
+        return -1;
+    }
+    return resident * (sysconf(_SC_PAGESIZE) / 1024);
+}
+
+// A sliding window kept by splitting off the old keys, dropping them and
+// joining the rest back must reuse the dropped nodes' blocks, not keep
+// reserving new slabs every round.
+void testSplitDropJoinMemory()
+{
+    const long window = 100000;
+    const long step = 10000;
+    AVLTree<long, long> live;
+    long hi = 0;
+    for (; hi < window; ++hi) {
+        live.insert(make_pair(hi, hi));
+    }
+    long lo = 0;
+    long settled = 0;
+    for (int round = 1; round <= 30; ++round) {
+        AVLTree<long, long> newer;
+        live.split(lo + step, newer);
+        live.clear();
+        live.join(newer);
+        lo += step;
+        for (long i = 0; i < step; ++i, ++hi) {
+            live.insert(make_pair(hi, hi));
+        }
+        if (round == 5) {
+            settled = residentKb();
+        }
+    }
+    check(static_cast<long>(distance(live.begin(), live.end())) == window && live.begin()->first == lo && live.isBalanced(),
+          "sliding window contents");
+    long grown = residentKb() - settled;
+    if (settled >= 0) {
+        // Each round drops and re-adds about 1 MB of nodes
+        check(grown < 2048, "split, drop and join keep memory flat");
+    }
+}
+
+void testBounds(Rng& rng)
+{
+    AVLTree<int, int> tree;
+    Reference ref;
+    for (int i = 0; i < 500; ++i) {
+        int key = rng.below(3000) * 2;
+        tree.insert(make_pair(key, i));
+        ref[key] = i;
+    }
+    bool lowerOk = true;
+    bool upperOk = true;
+    bool rangeOk = true;
+    bool floorOk = true;
+    bool ceilingOk = true;
+    bool nearestOk = true;
+    for (int key = -3; key < 6004; ++key) {
+        Reference::const_iterator lower = ref.lower_bound(key);
+        Reference::const_iterator upper = ref.upper_bound(key);
+        lowerOk = lowerOk && sameEntry(tree, tree.lower_bound(key), ref, lower);
+        upperOk = upperOk && sameEntry(tree, tree.upper_bound(key), ref, upper);
+        pair<AVLTree<int, int>::iterator, AVLTree<int, int>::iterator> range = tree.equal_range(key);
+        rangeOk = rangeOk && sameEntry(tree, range.first, ref, lower) &&
+                  sameEntry(tree, range.second, ref, upper);
+
+        Reference::const_iterator below = (upper == ref.begin()) ? ref.end() : prev(upper);
+        floorOk = floorOk && sameEntry(tree, tree.floor(key), ref, below);
+        ceilingOk = ceilingOk && sameEntry(tree, tree.ceiling(key), ref, lower);
+
+        // The closer of the two neighbors, the smaller one on a tie
+        Reference::const_iterator nearest = below;
+        if (below == ref.end() || (lower != ref.end() && lower->first - key < key - below->first)) {
+            nearest = lower;
+        }
+        nearestOk = nearestOk && sameEntry(tree, tree.nearest(key), ref, nearest);
+    }
+    check(lowerOk, "lower_bound matches std::map");
+    check(upperOk, "upper_bound matches std::map");
+    check(rangeOk, "equal_range matches std::map");
+    check(floorOk, "floor matches std::map");
+    check(ceilingOk, "ceiling matches std::map");
+    check(nearestOk, "nearest picks the closer neighbor");
+
+    AVLTree<int, int> empty;
+    check(empty.floor(1) == empty.end() && empty.ceiling(1) == empty.end() &&
+          empty.nearest(1) == empty.end(), "bounds on an empty tree");
+}
+
+// Distance between the first letters, for nearest on string keys
+struct InitialDistance
+{
+    int operator()(const string& a, const string& b) const
+    {
+        return abs(a[0] - b[0]);
+    }
+};
+
+void testNearestEdgeCases()
+{
+    AVLTree<int, int, greater<int> > descending;
+    descending.insert(make_pair(10, 1));
+    descending.insert(make_pair(20, 2));
+    check(descending.nearest(16)->first == 20 && descending.nearest(14)->first == 10 &&
+          descending.nearest(30)->first == 20 && descending.nearest(0)->first == 10,
+          "nearest with greater<int>");
+    check(descending.nearest(15)->first == 20, "nearest tie goes to the first key in greater<int> order");
+
+    AVLTree<int, int> extremes;
+    extremes.insert(make_pair(INT_MIN, 1));
+    extremes.insert(make_pair(INT_MAX, 2));
+    check(extremes.nearest(0)->first == INT_MAX && extremes.nearest(-1)->first == INT_MIN,
+          "nearest between INT_MIN and INT_MAX");
+    extremes.remove(INT_MAX);
+    extremes.insert(make_pair(-1, 3));
+    check(extremes.nearest(INT_MAX)->first == -1 && extremes.nearest(INT_MIN + 1)->first == INT_MIN,
+          "nearest from the ends of the int range");
+
+    AVLTree<int, int, greater<int> > descendingExtremes;
+    descendingExtremes.insert(make_pair(INT_MIN, 1));
+    descendingExtremes.insert(make_pair(INT_MAX, 2));
+    check(descendingExtremes.nearest(0)->first == INT_MAX && descendingExtremes.nearest(-1)->first == INT_MIN,
+          "nearest between INT_MIN and INT_MAX with greater<int>");
+
+    AVLTree<unsigned long long, int> wide;
+    wide.insert(make_pair(0ULL, 1));
+    wide.insert(make_pair(ULLONG_MAX, 2));
+    check(wide.nearest(ULLONG_MAX / 2)->first == 0 && wide.nearest(ULLONG_MAX / 2 + 1)->first == ULLONG_MAX,
+          "nearest on unsigned long long extremes");
+
+    AVLTree<long long, int> narrow;
+    narrow.insert(make_pair(LLONG_MIN, 1));
+    narrow.insert(make_pair(LLONG_MAX, 2));
+    check(narrow.nearest(0)->first == LLONG_MAX && narrow.nearest(-1)->first == LLONG_MIN,
+          "nearest on long long extremes");
+
+    AVLTree<double, int> real;
+    real.insert(make_pair(-DBL_MAX, 1));
+    real.insert(make_pair(DBL_MAX, 2));
+    real.insert(make_pair(0.5, 3));
+    check(real.nearest(0.2)->first == 0.5 && real.nearest(-1.0)->first == 0.5 &&
+          real.nearest(-DBL_MAX / 2)->first == -DBL_MAX, "nearest on double keys");
+
+    AVLTree<string, int> words;
+    words.insert(make_pair(string("apple"), 1));
+    words.insert(make_pair(string("kiwi"), 2));
+    check(words.nearest("grape", InitialDistance())->first == "kiwi" &&
+          words.nearest("cherry", InitialDistance())->first == "apple",
+          "nearest with a distance functor");
+}
+
+void testIteration(Rng& rng)
+{
+    AVLTree<int, int> tree;
+    Reference ref;
+    for (int i = 0; i < 1000; ++i) {
+        int key = rng.below(5000);
+        tree.insert(make_pair(key, i));
+        ref[key] = i;
+    }
+
+    check(sameContents(tree, ref), "forward iteration");
+
+    bool backwardOk = true;
+    AVLTree<int, int>::iterator it = tree.end();
+    for (Reference::const_reverse_iterator m = ref.rbegin(); m != ref.rend(); ++m) {
+        --it;
+        backwardOk = backwardOk && it->first == m->first;
+    }
+    check(backwardOk && it == tree.begin(), "decrementing from end() to begin()");
+
+    bool reverseOk = true;
+    Reference::const_reverse_iterator m = ref.rbegin();
+    for (AVLTree<int, int>::reverse_iterator r = tree.rbegin(); r != tree.rend(); ++r, ++m) {
+        reverseOk = reverseOk && m != ref.rend() && r->first == m->first;
+    }
+    check(reverseOk && m == ref.rend(), "reverse_iterator");
+
+    bool constReverseOk = true;
+    m = ref.rbegin();
+    for (AVLTree<int, int>::const_reverse_iterator r = tree.crbegin(); r != tree.crend(); ++r, ++m) {
+        constReverseOk = constReverseOk && m != ref.rend() && r->first == m->first;
+    }
+    check(constReverseOk && m == ref.rend(), "const_reverse_iterator");
+
+    AVLTree<int, int>::iterator first = tree.begin();
+    AVLTree<int, int>::iterator old = first++;
+    check(old == tree.begin() && first-- == next(tree.begin()) && first == tree.begin(),
+          "postfix increment and decrement");
+    check(static_cast<size_t>(distance(tree.cbegin(), tree.cend())) == ref.size(), "const_iterator walk");
+}
+
+void testBatches(Rng& rng)
+{
+    AVLTree<int, int> tree;
+    Reference ref;
+    bool insertOk = true;
+    bool eraseOk = true;
+    for (int round = 0; round < 30; ++round) {
+        vector<pair<int, int> > batch;
+        size_t added = 0;
+        for (int i = rng.below(500); i > 0; --i) {
+            int key = rng.below(4000);
+            batch.push_back(make_pair(key, round * 1000 + i));
+        }
+        Reference before = ref;
+        for (size_t i = 0; i < batch.size(); ++i) {
+            ref[batch[i].first] = batch[i].second;
+        }
+        added = ref.size() - before.size();
+        insertOk = insertOk && tree.insert_batch(batch.begin(), batch.end()) == added &&
+                   sameContents(tree, ref) && tree.isBalanced();
+
+        vector<int> keys;
+        for (int i = rng.below(400); i > 0; --i) {
+            keys.push_back(rng.below(4000));
+        }
+        size_t removed = 0;
+        for (size_t i = 0; i < keys.size(); ++i) {
+            removed += ref.erase(keys[i]);
+        }
+        eraseOk = eraseOk && tree.erase_batch(keys.begin(), keys.end()) == removed &&
+                  sameContents(tree, ref) && tree.isBalanced();
+    }
+    check(insertOk, "insert_batch matches std::map");
+    check(eraseOk, "erase_batch matches std::map");
+}
+
+void testParallelLoad(Rng& rng)
+{
+    vector<pair<int, int> > items;
+    Reference ref;
+    for (int i = 0; i < 300000; ++i) {
+        int key = rng.below(250000);
+        items.push_back(make_pair(key, i));
+        ref[key] = i;
+    }
+
+    AVLTree<int, int, less<int>, true> parallel;
+    parallel.assign_parallel(items.begin(), items.end(), 4);
+    check(sameContents(parallel, ref), "assign_parallel contents, last value wins");
+    check(parallel.isBalanced() && parallel.balanceReport().balanceMismatches == 0,
+          "assign_parallel balances");
+    check(parallel.select(ref.size() / 2)->first == next(ref.begin(), ref.size() / 2)->first,
+          "assign_parallel subtree sizes");
+
+    sort(items.begin(), items.end());
+    AVLTree<int, int> sorted;
+    sorted.assign_parallel(items.begin(), items.end(), 3);
+    AVLTree<int, int> serial(items.begin(), items.end());
+    check(sameContents(sorted, ref) && sameContents(serial, ref), "assign_parallel on sorted input");
+}
+
+void testSerialize(Rng& rng)
+{
+    AVLTree<int, int, less<int>, true> tree;
+    Reference ref;
+    for (int i = 0; i < 5000; ++i) {
+        int key = rng.below(20000);
+        if (rng.below(4) == 0) {
+            tree.remove(key);
+            ref.erase(key);
+        }
+        else {
+            tree.insert(make_pair(key, i));
+            ref[key] = i;
+        }
+    }
+    ostringstream out;
+    tree.serialize(out);
+
+    AVLTree<int, int, less<int>, true> copy;
+    copy.insert(make_pair(-5, -5));
+    istringstream in(out.str());
+    copy.deserialize(in);
+    check(sameContents(copy, ref), "deserialize restores the contents");
+    check(copy.balanceReport().balanceMismatches == 0, "deserialize restores the balances");
+    check(copy.rank(10000) == tree.rank(10000), "deserialize restores subtree sizes");
+
+    // Writing the copy again gives the same bytes only if the shape matches
+    ostringstream again;
+    copy.serialize(again);
+    check(again.str() == out.str(), "deserialize restores the shape");
+
+    string truncated = out.str().substr(0, out.str().size() / 2);
+    istringstream bad(truncated);
+    bool threw = false;
+    try {
+        copy.deserialize(bad);
+    }
+    catch (const runtime_error&) {
+        threw = true;
+    }
+    check(threw && sameContents(copy, ref), "truncated input throws and keeps the tree");
+
+    // Keys 1, 2, 3 serialize as a 20-byte header, one byte of shape codes
+    // per two nodes and then 2, 1, 3 in pre-order, each key then value
+    AVLTree<int, int, less<int>, true> small;
+    for (int key = 1; key <= 3; ++key) {
+        small.insert(make_pair(key, key));
+    }
+    ostringstream smallOut;
+    small.serialize(smallOut);
+    const size_t header = 20;
+    const size_t firstNode = header + 2;
+    string badBalance = smallOut.str();
+    badBalance[header] = static_cast<char>(badBalance[header] ^ 0xC0);  // the leaf 1 now claims +1
+    string badOrder = smallOut.str();
+    swap_ranges(badOrder.begin() + firstNode + 8, badOrder.begin() + firstNode + 12,
+                badOrder.begin() + firstNode + 16);
+    AVLTree<int, int, less<int>, true> smallCopy;
+    istringstream smallIn(smallOut.str());
+    smallCopy.deserialize(smallIn);
+    check(distance(smallCopy.begin(), smallCopy.end()) == 3 && smallCopy.isBalanced(),
+          "a small tree reads back");
+
+    const string corrupt[] = { badBalance, badOrder };
+    bool rejected[2] = { false, false };
+    for (int i = 0; i < 2; ++i) {
+        istringstream corruptIn(corrupt[i]);
+        try {
+            copy.deserialize(corruptIn);
+        }
+        catch (const runtime_error&) {
+            rejected[i] = true;
+        }
+    }
+    check(rejected[0] && sameContents(copy, ref), "a balance that does not match the heights throws");
+    check(rejected[1] && sameContents(copy, ref), "keys out of order throw");
+
+    AVLTree<string, string> strings;
+    strings.insert(make_pair(string("alpha"), string("1")));
+    strings.insert(make_pair(string(""), string("empty key")));
+    strings.insert(make_pair(string("beta"), string(300, 'x')));
+    ostringstream stringOut;
+    strings.serialize(stringOut);
+    AVLTree<string, string> stringCopy;
+    istringstream stringIn(stringOut.str());
+    stringCopy.deserialize(stringIn);
+    check(stringCopy[""] == "empty key" && stringCopy["beta"].size() == 300 && stringCopy["alpha"] == "1",
+          "string round trip");
+}
+
+// less<int> that counts its calls
+struct CountingLess
+{
+    bool operator()(int a, int b) const
+    {
+        ++calls;
+        return a < b;
+    }
+    static long calls;
+};
+long CountingLess::calls = 0;
+
+void testMappedTree(Rng& rng)
+{
+    // Ascending inserts leave a plain tree a single right-leaning path
+    BinarySearchTree<int, int> path;
+    Reference ref;
+    for (int i = 0; i < 4000; ++i) {
+        path.insert(make_pair(i * 3, i));
+        ref[i * 3] = i;
+    }
+    writeMappedTree(path, "tree-test.map");
+    {
+        MappedTree<int, int, CountingLess> mapped("tree-test.map");
+        bool ok = mapped.size() == ref.size();
+        Reference::const_iterator m = ref.begin();
+        for (MappedTree<int, int, CountingLess>::const_iterator it = mapped.begin(); it != mapped.end(); ++it, ++m) {
+            ok = ok && m != ref.end() && it->first == m->first && it->second == m->second;
+        }
+        check(ok && m == ref.end(), "mapped tree iterates in key order");
+
+        bool lookupsOk = true;
+        long mostCalls = 0;
+        for (int probe = 0; probe < 2000; ++probe) {
+            int key = rng.below(12100) - 50;
+            CountingLess::calls = 0;
+            MappedTree<int, int, CountingLess>::const_iterator lower = mapped.lower_bound(key);
+            mostCalls = max(mostCalls, CountingLess::calls);
+            Reference::const_iterator expected = ref.lower_bound(key);
+            lookupsOk = lookupsOk && (expected == ref.end() ? lower == mapped.end() : lower->first == expected->first);
+            expected = ref.upper_bound(key);
+            MappedTree<int, int, CountingLess>::const_iterator upper = mapped.upper_bound(key);
+            lookupsOk = lookupsOk && (expected == ref.end() ? upper == mapped.end() : upper->first == expected->first);
+            lookupsOk = lookupsOk && (mapped.find(key) != mapped.end()) == (ref.count(key) == 1);
+        }
+        check(lookupsOk, "mapped tree lookups match std::map");
+        check(mostCalls <= 13, "mapped tree lookups of a degenerate tree take log2(n) + 1 comparisons");
+    }
+
+    // A header claiming more records than the file holds is refused
+    {
+        fstream file("tree-test.map", ios::in | ios::out | ios::binary);
+        MappedTreeHeader header;
+        file.read(reinterpret_cast<char*>(&header), sizeof(header));
+        header.count += 1;
+        file.seekp(0);
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+    }
+    bool threw = false;
+    try {
+        MappedTree<int, int> mapped("tree-test.map");
+    }
+    catch (const runtime_error&) {
+        threw = true;
+    }
+    check(threw, "mapped tree with a bad record count is refused");
+    remove("tree-test.map");
+}
+
+// Random inserts, removes and lookups on any of the map-like trees
+template<typename Tree>
+void checkAgainstMap(Rng& rng, const char* what)
+{
+    Tree tree;
+    Reference ref;
+    bool ok = true;
+    for (int i = 0; i < 20000 && ok; ++i) {
+        int key = rng.below(3000);
+        int op = rng.below(10);
+        if (op < 5) {
+            tree.insert(make_pair(key, i));
+            ref[key] = i;
+        }
+        else if (op < 8) {
+            tree.remove(key);
+            ref.erase(key);
+        }
+        else {
+            ok = sameEntry(tree, tree.find(key), ref, ref.find(key)) &&
+                 sameEntry(tree, tree.lower_bound(key), ref, ref.lower_bound(key)) &&
+                 sameEntry(tree, tree.upper_bound(key), ref, ref.upper_bound(key));
+        }
+        if (i % 1000 == 0) {
+            ok = ok && sameContents(tree, ref) && tree.size() == ref.size();
+        }
+    }
+    ok = ok && sameContents(tree, ref) && tree.size() == ref.size();
+
+    bool backwardOk = true;
+    typename Tree::iterator it = tree.end();
+    for (Reference::const_reverse_iterator m = ref.rbegin(); m != ref.rend(); ++m) {
+        --it;
+        backwardOk = backwardOk && it->first == m->first;
+    }
+    tree.clear();
+    check(ok && backwardOk && tree.empty() && tree.begin() == tree.end(), what);
+}
+
+// Appending past the largest key, with end() or the last insert as the
+// hint, and inserting right before the hint must link the node in without
+// a search: a bounded number of comparisons per insert, and time linear
+// in the count even for a plain tree that degenerates into a path.
+template<typename Tree>
+bool hintedAppendsAreFlat(int count)
+{
+    Tree tree;
+    CountingLess::calls = 0;
+    for (int i = 0; i < count; ++i) {
+        tree.insert(tree.end(), make_pair(2 * i, i));
+    }
+    bool ok = CountingLess::calls <= count;
+
+    typename Tree::iterator last = tree.end();
+    CountingLess::calls = 0;
+    for (int i = count; i < 2 * count; ++i) {
+        last = tree.insert(last, make_pair(2 * i, i));
+    }
+    ok = ok && CountingLess::calls <= count;
+
+    // Every odd key goes right before the even key used as its hint
+    CountingLess::calls = 0;
+    typename Tree::iterator hint = tree.begin();
+    for (int i = 0; i < 2 * count; ++i, ++hint) {
+        hint = tree.insert(hint, make_pair(2 * i - 1, -i));
+        ++hint;
+    }
+    ok = ok && CountingLess::calls <= 4 * 2 * count;
+    return ok && static_cast<int>(distance(tree.begin(), tree.end())) == 4 * count &&
+           tree.begin()->first == -1 && prev(tree.end())->first == 4 * count - 2;
+}
+
+// Descending keys, each hinted with the one inserted before it, also go in
+// without a search. (In a plain tree these build a left path whose end
+// takes a climb to the root to show it has no predecessor, so only the
+// comparisons are flat there.)
+template<typename Tree>
+bool hintedPrependsAreFlat(int count)
+{
+    Tree tree;
+    typename Tree::iterator first = tree.end();
+    CountingLess::calls = 0;
+    for (int i = count; i > 0; --i) {
+        first = tree.insert(first, make_pair(i, i));
+    }
+    return CountingLess::calls <= 3 * count && first == tree.begin() && first->first == 1 &&
+           static_cast<int>(distance(tree.begin(), tree.end())) == count &&
+           tree.balanceReport().balanceMismatches == 0;
+}
+
+// Inserting with random hints, some far from the key, must match std::map
+// and keep a balancing tree's bookkeeping right
+template<typename Tree>
+bool randomHintsMatch(Rng& rng)
+{
+    Tree tree;
+    Reference ref;
+    for (int i = 0; i < 5000; ++i) {
+        int key = rng.below(3000);
+        typename Tree::iterator hint = tree.end();
+        switch (rng.below(4)) {
+        case 0: hint = tree.lower_bound(key); break;
+        case 1: hint = tree.upper_bound(key); break;
+        case 2: hint = tree.lower_bound(rng.below(3000)); break;
+        default: break;
+        }
+        typename Tree::iterator it = tree.insert(hint, make_pair(key, i));
+        ref[key] = i;
+        if (it == tree.end() || it->first != key || it->second != i) {
+            return false;
+        }
+        if (i % 7 == 0) {
+            int doomed = rng.below(3000);
+            tree.remove(doomed);
+            ref.erase(doomed);
+        }
+    }
+    return sameContents(tree, ref) && tree.balanceReport().balanceMismatches == 0;
+}
+
+void testHintedInserts(Rng& rng)
+{
+    const int count = 100000;
+    chrono::steady_clock::time_point start = chrono::steady_clock::now();
+    check(hintedAppendsAreFlat<BinarySearchTree<int, int, CountingLess> >(count),
+          "hinted inserts into a plain tree need no search");
+    double seconds = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+    check(seconds < 2.0, "hinted appends to a degenerate plain tree take linear time");
+    check(hintedAppendsAreFlat<AVLTree<int, int, CountingLess> >(count),
+          "hinted inserts into an AVL tree need no search");
+    check(hintedAppendsAreFlat<RedBlackTree<int, int, CountingLess> >(count),
+          "hinted inserts into a red-black tree need no search");
+    check(hintedPrependsAreFlat<AVLTree<int, int, CountingLess> >(count),
+          "hinted prepends to an AVL tree need no search");
+    check(hintedPrependsAreFlat<RedBlackTree<int, int, CountingLess> >(count),
+          "hinted prepends to a red-black tree need no search");
+
+    check(randomHintsMatch<BinarySearchTree<int, int> >(rng), "random hints into a plain tree match std::map");
+    check(randomHintsMatch<AVLTree<int, int> >(rng), "random hints into an AVL tree match std::map");
+    check(randomHintsMatch<RedBlackTree<int, int> >(rng), "random hints into a red-black tree match std::map");
+
+    // Operations that remove or move the largest entry must not leave a
+    // stale one behind for appends to hang off
+    typedef AVLTree<int, int> Tree;
+    Tree tree;
+    Reference ref;
+    for (int i = 0; i < 1000; ++i) {
+        tree.insert(tree.end(), make_pair(i, i));
+        ref[i] = i;
+    }
+    bool ok = true;
+    int top = 1000;
+    for (int round = 0; round < 7 && ok; ++round) {
+        switch (round) {
+        case 0:
+            tree.remove(top - 1);
+            ref.erase(top - 1);
+            break;
+        case 1: {
+            Tree right;
+            tree.split(top - 100, right);
+            long moved = distance(ref.lower_bound(top - 100), ref.end());
+            ref.erase(ref.lower_bound(top - 100), ref.end());
+            right.insert(right.end(), make_pair(top + 5000, 0));
+            ok = distance(right.begin(), right.end()) == moved + 1 && prev(right.end())->first == top + 5000;
+            break;
+        }
+        case 2: {
+            Tree right;
+            right.insert(make_pair(top + 10, 10));
+            right.insert(make_pair(top + 20, 20));
+            tree.join(right);
+            ref[top + 10] = 10;
+            ref[top + 20] = 20;
+            top += 21;
+            break;
+        }
+        case 3: {
+            vector<pair<int, int> > batch;
+            batch.push_back(make_pair(top + 3, 3));
+            tree.insert_batch(batch.begin(), batch.end());
+            ref[top + 3] = 3;
+            top += 4;
+            break;
+        }
+        case 4:
+            tree.erase(top - 50, top + 1);
+            ref.erase(ref.lower_bound(top - 50), ref.end());
+            break;
+        case 5: {
+            vector<pair<int, int> > items(ref.begin(), ref.end());
+            items.resize(items.size() / 2);
+            tree.assign(items.begin(), items.end());
+            ref = Reference(items.begin(), items.end());
+            break;
+        }
+        default:
+            tree.clear();
+            ref.clear();
+            break;
+        }
+        for (int i = 0; i < 10; ++i, ++top) {
+            tree.insert(tree.end(), make_pair(top, -top));
+            ref[top] = -top;
+        }
+        ok = ok && sameContents(tree, ref) && tree.isBalanced();
+    }
+    check(ok, "appends after the largest entry is removed or moved match std::map");
+}
+
+void testOtherTrees(Rng& rng)
+{
+    checkAgainstMap<BTree<int, int> >(rng, "BTree matches std::map");
+    checkAgainstMap<BTree<int, int, less<int>, 64> >(rng, "BTree with small nodes matches std::map");
+    checkAgainstMap<CompactAVLTree<int, int> >(rng, "CompactAVLTree matches std::map");
+    checkAgainstMap<IndexedAVLTree<int, int> >(rng, "IndexedAVLTree matches std::map");
+
+    CompactAVLTree<int, int> compact;
+    IndexedAVLTree<int, int> indexed;
+    for (int i = 0; i < 5000; ++i) {
+        int key = rng.below(2000);
+        compact.insert(make_pair(key, i));
+        indexed.insert(make_pair(key, i));
+        if (i % 3 == 0) {
+            compact.remove(rng.below(2000));
+            indexed.remove(rng.below(2000));
+        }
+    }
+    check(compact.isBalanced(), "CompactAVLTree stays balanced");
+    check(indexed.isBalanced(), "IndexedAVLTree stays balanced");
+
+    // Read-only access through a const reference
+    const IndexedAVLTree<int, int>& view = indexed;
+    bool constOk = view.cbegin() == IndexedAVLTree<int, int>::const_iterator(indexed.begin());
+    size_t walked = 0;
+    int last = -1;
+    for (IndexedAVLTree<int, int>::const_iterator it = view.begin(); it != view.end(); ++it, ++walked) {
+        constOk = constOk && it->first > last && view.find(it->first)->second == it->second &&
+                  view[it->first] == it->second;
+        last = it->first;
+    }
+    IndexedAVLTree<int, int>::const_iterator lower = view.lower_bound(1000);
+    IndexedAVLTree<int, int>::const_iterator upper = view.upper_bound(1000);
+    constOk = constOk && walked == view.size() && lower->first >= 1000 && upper->first > 1000 &&
+              (--lower)->first < 1000 && view.find(5000) == view.cend() && (--view.end())->first == last;
+    check(constOk, "IndexedAVLTree const lookups and iteration");
+}
+
+int main(int argc, char *argv[])
+{
+    unsigned long seed = 1;
+    if (argc > 1) {
+        seed = strtoul(argv[1], NULL, 10);
+    }
+    Rng rng(seed);
+
+    testBaseReference(rng);
+    testOrderStatistics(rng);
+    testSplitJoinErase(rng);
+    testSplitDropJoinMemory();
+    testBounds(rng);
+    testNearestEdgeCases();
+    testIteration(rng);
+    testBatches(rng);
+    testParallelLoad(rng);
+    testSerialize(rng);
+    testOtherTrees(rng);
+    testMappedTree(rng);
+    testHintedInserts(rng);
+
+    if (failures == 0) {
+        cout << "All tree checks passed" << endl;
+    }
+    return failures == 0 ? 0 : 1;
+}
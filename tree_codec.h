@@ -0,0 +1,64 @@
+#ifndef TREE_CODEC_H
+#define TREE_CODEC_H
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <string>
+#include <type_traits>
+
+/**
+ * How AVLTree::serialize writes keys and values and deserialize reads them
+ * back. Trivially copyable types are copied byte for byte; std::string is
+ * written as its length followed by its characters. Other types need a
+ * specialization with the same two functions. read may leave the stream
+ * failed on bad input; the caller checks it.
+ */
+template <typename T>
+struct TreeCodec
+{
+    static_assert(std::is_trivially_copyable<T>::value,
+                  "specialize TreeCodec to serialize this type");
+
+    static void write(std::ostream& out, const T& value)
+    {
+        out.write(reinterpret_cast<const char*>(&value), sizeof(T));
+    }
+
+    static T read(std::istream& in)
+    {
+        T value;
+        in.read(reinterpret_cast<char*>(&value), sizeof(T));
+        return value;
+    }
+};
+
+template <>
+struct TreeCodec<std::string>
+{
+    static void write(std::ostream& out, const std::string& value)
+    {
+        std::uint64_t length = value.size();
+        out.write(reinterpret_cast<const char*>(&length), sizeof(length));
+        out.write(value.data(), static_cast<std::streamsize>(value.size()));
+    }
+
+    static std::string read(std::istream& in)
+    {
+        std::uint64_t length = 0;
+        in.read(reinterpret_cast<char*>(&length), sizeof(length));
+        std::string value;
+        // Grow as the characters arrive, so a corrupt length fails on the
+        // stream rather than on one huge allocation
+        char chunk[256];
+        while (in && length > 0) {
+            std::size_t step = length < sizeof(chunk) ? static_cast<std::size_t>(length) : sizeof(chunk);
+            in.read(chunk, static_cast<std::streamsize>(step));
+            value.append(chunk, static_cast<std::size_t>(in.gcount()));
+            length -= step;
+        }
+        return value;
+    }
+};
+
+#endif